@@ -0,0 +1,207 @@
+/*
+ * The code is part of the XIndex project.
+ *
+ *    Copyright (C) 2020 Institute of Parallel and Distributed Systems (IPADS),
+ * Shanghai Jiao Tong University. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ */
+
+#include <getopt.h>
+#include <stdlib.h>
+
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "../XIndex-R/perf_regression.h"
+#include "helper.h"
+#include "xindex_impl.h"
+
+class Key;
+
+typedef xindex::XIndex<Key, uint64_t> xindex_t;
+
+inline void run_lookups(perf_regression::Suite &suite);
+inline void parse_args(int, char **);
+
+// parameters, see XIndex-R's perf_regression for the other workloads
+size_t table_size = 1000000;
+size_t op_n = 2000000;
+size_t repeat_n = 5;
+int cpu = 0;
+std::string record_path;
+std::string baseline_path;
+double tolerance = 0.1;
+double counter_tolerance = 0.05;
+
+const uint64_t seed = 42;
+
+class Key {
+  typedef std::array<double, 1> model_key_t;
+
+ public:
+  static constexpr size_t model_key_size() { return 1; }
+  static Key max() {
+    static Key max_key(std::numeric_limits<uint64_t>::max());
+    return max_key;
+  }
+  static Key min() {
+    static Key min_key(std::numeric_limits<uint64_t>::min());
+    return min_key;
+  }
+
+  Key() : key(0) {}
+  Key(uint64_t key) : key(key) {}
+  Key(const Key &other) { key = other.key; }
+  Key &operator=(const Key &other) {
+    key = other.key;
+    return *this;
+  }
+
+  model_key_t to_model_key() const {
+    model_key_t model_key;
+    model_key[0] = key;
+    return model_key;
+  }
+
+  friend bool operator<(const Key &l, const Key &r) { return l.key < r.key; }
+  friend bool operator>(const Key &l, const Key &r) { return l.key > r.key; }
+  friend bool operator>=(const Key &l, const Key &r) { return l.key >= r.key; }
+  friend bool operator<=(const Key &l, const Key &r) { return l.key <= r.key; }
+  friend bool operator==(const Key &l, const Key &r) { return l.key == r.key; }
+  friend bool operator!=(const Key &l, const Key &r) { return l.key != r.key; }
+
+  uint64_t key;
+} PACKED;
+
+int main(int argc, char **argv) {
+  parse_args(argc, argv);
+  if (!baseline_path.empty() && record_path.empty() &&
+      !std::ifstream(baseline_path)) {
+    COUT_THIS("[perf] no baseline at " << baseline_path << ", skipping");
+    return perf_regression::skip_exit_code;
+  }
+
+  perf_regression::Suite suite(repeat_n, cpu);
+  run_lookups(suite);
+
+  if (!record_path.empty()) {
+    INVARIANT(suite.record(record_path));
+    COUT_THIS("[perf] recorded baseline " << record_path);
+  }
+  if (!baseline_path.empty()) {
+    if (!suite.check(baseline_path, tolerance, counter_tolerance)) {
+      return 1;
+    }
+    COUT_THIS("[perf] no regressions against " << baseline_path);
+  }
+}
+
+// gets on the key sets of XIndex-R's lookups, without background threads.
+// the dense runs of the segmented keys defeat the hash root, whose init keeps
+// growing the group count, so they are left out
+inline void run_lookups(perf_regression::Suite &suite) {
+  const perf_regression::Cdf cdfs[] = {perf_regression::Cdf::uniform,
+                                       perf_regression::Cdf::lognormal,
+                                       perf_regression::Cdf::normal};
+  for (perf_regression::Cdf cdf : cdfs) {
+    std::vector<uint64_t> raw_keys =
+        perf_regression::make_keys(cdf, table_size, seed);
+    std::vector<Key> keys(raw_keys.begin(), raw_keys.end());
+    std::unique_ptr<xindex_t> table(new xindex_t(keys, raw_keys, 1, 0));
+
+    std::mt19937_64 gen(seed);
+    std::vector<Key> queries(op_n);
+    for (auto &query : queries) {
+      query = keys[gen() % keys.size()];
+    }
+
+    uint64_t checksum = 0;
+    suite.run(std::string("h_lookup_") + perf_regression::cdf_name(cdf), op_n,
+              [&](size_t) {
+                uint64_t val;
+                for (auto &query : queries) {
+                  table->get(query, val, 0);
+                  checksum += val;
+                }
+              });
+    INVARIANT(checksum > 0);
+  }
+}
+
+inline void parse_args(int argc, char **argv) {
+  struct option long_options[] = {
+      {"table-size", required_argument, 0, 'a'},
+      {"op-n", required_argument, 0, 'b'},
+      {"repeat", required_argument, 0, 'c'},
+      {"cpu", required_argument, 0, 'd'},
+      {"record", required_argument, 0, 'e'},
+      {"baseline", required_argument, 0, 'f'},
+      {"tolerance", required_argument, 0, 'g'},
+      {"counter-tolerance", required_argument, 0, 'h'},
+      {0, 0, 0, 0}};
+  std::string ops = "a:b:c:d:e:f:g:h:";
+  int option_index = 0;
+
+  while (1) {
+    int c = getopt_long(argc, argv, ops.c_str(), long_options, &option_index);
+    if (c == -1) break;
+
+    switch (c) {
+      case 0:
+        if (long_options[option_index].flag != 0) break;
+        abort();
+        break;
+      case 'a':
+        table_size = strtoul(optarg, NULL, 10);
+        INVARIANT(table_size > 0);
+        break;
+      case 'b':
+        op_n = strtoul(optarg, NULL, 10);
+        INVARIANT(op_n > 0);
+        break;
+      case 'c':
+        repeat_n = strtoul(optarg, NULL, 10);
+        INVARIANT(repeat_n > 0);
+        break;
+      case 'd':
+        cpu = strtol(optarg, NULL, 10);
+        break;
+      case 'e':
+        record_path = optarg;
+        break;
+      case 'f':
+        baseline_path = optarg;
+        break;
+      case 'g':
+        tolerance = strtod(optarg, NULL);
+        INVARIANT(tolerance >= 0 && tolerance < 1);
+        break;
+      case 'h':
+        counter_tolerance = strtod(optarg, NULL);
+        INVARIANT(counter_tolerance >= 0);
+        break;
+      default:
+        abort();
+    }
+  }
+
+  COUT_VAR(table_size);
+  COUT_VAR(op_n);
+  COUT_VAR(repeat_n);
+  COUT_VAR(cpu);
+}
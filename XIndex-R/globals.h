@@ -9,7 +9,11 @@
 /// variable.
 /// For research purposes however, the speed at which we can get this
 /// measurement working is far more important. We know and actively work around
-/// its limitations by only ever having one XIndex at a time.
+/// its limitations by only ever having one XIndex at a time, or one group of
+/// indexes that are alive together (e.g., the shards of a ShardedXIndex), whose
+/// bytes are counted together.
 namespace xindex::_ {
 static size_t allocated_bytes = 0;
+// number of live XIndex instances, the first one resets the byte counter
+static size_t index_n = 0;
 }
\ No newline at end of file
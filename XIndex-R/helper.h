@@ -77,6 +77,15 @@ inline uint64_t cmpxchg(uint64_t* object, uint64_t expected, uint64_t desired) {
   return expected;
 }
 
+inline uint32_t cmpxchg(uint32_t* object, uint32_t expected, uint32_t desired) {
+  asm volatile("lock; cmpxchgl %2,%1"
+               : "+a"(expected), "+m"(*object)
+               : "r"(desired)
+               : "cc");
+  fence();
+  return expected;
+}
+
 inline uint8_t cmpxchgb(uint8_t* object, uint8_t expected, uint8_t desired) {
   asm volatile("lock; cmpxchgb %2,%1"
                : "+a"(expected), "+m"(*object)
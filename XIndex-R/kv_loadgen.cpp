@@ -0,0 +1,316 @@
+/*
+ * The code is part of the XIndex project.
+ *
+ *    Copyright (C) 2020 Institute of Parallel and Distributed Systems (IPADS),
+ * Shanghai Jiao Tong University. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For more about XIndex, visit:
+ *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
+ */
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "helper.h"
+#include "kv_protocol.h"
+
+struct alignas(CACHELINE_SIZE) ClientParam;
+
+typedef ClientParam client_param_t;
+
+inline int connect_socket();
+void* run_client(void* param);
+void run_benchmark(size_t sec);
+inline void parse_args(int, char**);
+
+// parameters
+std::string socket_path = kv_default_socket;
+double read_ratio = 1;
+double insert_ratio = 0;
+double update_ratio = 0;
+double delete_ratio = 0;
+double scan_ratio = 0;
+size_t table_size = 1000000;
+size_t runtime = 10;
+size_t fg_n = 1;
+size_t depth = 32;
+
+volatile bool running = false;
+std::atomic<size_t> ready_threads(0);
+
+struct alignas(CACHELINE_SIZE) ClientParam {
+  uint64_t throughput;
+  uint32_t thread_id;
+  std::vector<uint64_t> latencies;  // round trip of each batch, in ns
+};
+
+inline int connect_socket() {
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  INVARIANT(fd >= 0);
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  INVARIANT(socket_path.size() < sizeof(addr.sun_path));
+  strcpy(addr.sun_path, socket_path.c_str());
+  if (connect(fd, (sockaddr*)&addr, sizeof(addr)) != 0) {
+    COUT_N_EXIT("Error: can not connect to " << socket_path << ": "
+                                             << strerror(errno));
+  }
+  return fd;
+}
+
+inline void send_all(int fd, const char* data, size_t len) {
+  while (len > 0) {
+    ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+    if (sent <= 0) {
+      COUT_N_EXIT("Error: send failed: " << strerror(errno));
+    }
+    data += sent;
+    len -= sent;
+  }
+}
+
+inline void recv_all(int fd, char* data, size_t len) {
+  while (len > 0) {
+    ssize_t received = recv(fd, data, len, 0);
+    if (received <= 0) {
+      COUT_N_EXIT("Error: recv failed: " << strerror(errno));
+    }
+    data += received;
+    len -= received;
+  }
+}
+
+// every client keeps `depth` requests in flight: it sends a batch, waits for
+// all of its responses and measures the round trip
+void* run_client(void* param) {
+  client_param_t& thread_param = *(client_param_t*)param;
+  uint32_t thread_id = thread_param.thread_id;
+  int fd = connect_socket();
+
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  std::uniform_real_distribution<> ratio_dis(0, 1);
+  std::uniform_int_distribution<uint64_t> key_dis(0, table_size - 1);
+  uint64_t insert_i = table_size + thread_id;
+
+  std::vector<KVRequest> reqs(depth);
+  std::vector<KVResponse> resps(depth);
+  memset(reqs.data(), 0, depth * sizeof(KVRequest));
+
+  COUT_THIS("[loadgen] Client" << thread_id << " Ready.");
+  ready_threads++;
+
+  while (!running)
+    ;
+
+  while (running) {
+    for (KVRequest& req : reqs) {
+      double d = ratio_dis(gen);
+      req.key = kv_key(key_dis(gen));
+      req.val = 1234;
+      if (d <= read_ratio) {
+        req.op = KVOp::get;
+      } else if (d <= read_ratio + update_ratio) {
+        req.op = KVOp::put;
+      } else if (d <= read_ratio + update_ratio + insert_ratio) {
+        req.op = KVOp::put;
+        req.key = kv_key(insert_i);
+        insert_i += fg_n;
+      } else if (d <= read_ratio + update_ratio + insert_ratio +
+                          delete_ratio) {
+        req.op = KVOp::remove;
+      } else {
+        req.op = KVOp::scan;
+        req.val = 10;
+      }
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    send_all(fd, (const char*)reqs.data(), depth * sizeof(KVRequest));
+    recv_all(fd, (char*)resps.data(), depth * sizeof(KVResponse));
+    auto end = std::chrono::steady_clock::now();
+
+    thread_param.latencies.push_back(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(end - start)
+            .count());
+    thread_param.throughput += depth;
+  }
+
+  close(fd);
+  pthread_exit(nullptr);
+}
+
+void run_benchmark(size_t sec) {
+  pthread_t threads[fg_n];
+  client_param_t fg_params[fg_n];
+
+  running = false;
+  for (size_t worker_i = 0; worker_i < fg_n; worker_i++) {
+    fg_params[worker_i].thread_id = worker_i;
+    fg_params[worker_i].throughput = 0;
+    int ret = pthread_create(&threads[worker_i], nullptr, run_client,
+                             (void*)&fg_params[worker_i]);
+    if (ret) {
+      COUT_N_EXIT("Error:" << ret);
+    }
+  }
+
+  while (ready_threads < fg_n)
+    sleep(1);
+
+  running = true;
+  std::vector<size_t> tput_history(fg_n, 0);
+  size_t current_sec = 0;
+  while (current_sec < sec) {
+    sleep(1);
+    uint64_t tput = 0;
+    for (size_t i = 0; i < fg_n; i++) {
+      tput += fg_params[i].throughput - tput_history[i];
+      tput_history[i] = fg_params[i].throughput;
+    }
+    COUT_THIS("[loadgen] >>> sec " << current_sec << " throughput: " << tput);
+    ++current_sec;
+  }
+
+  running = false;
+  for (size_t i = 0; i < fg_n; i++) {
+    int rc = pthread_join(threads[i], nullptr);
+    if (rc) {
+      COUT_N_EXIT("Error:unable to join," << rc);
+    }
+  }
+
+  size_t throughput = 0;
+  std::vector<uint64_t> latencies;
+  for (auto& p : fg_params) {
+    throughput += p.throughput;
+    latencies.insert(latencies.end(), p.latencies.begin(), p.latencies.end());
+  }
+  COUT_THIS("[loadgen] Throughput(op/s): " << throughput / sec);
+  if (latencies.empty()) {
+    return;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) {
+    return latencies[std::min(latencies.size() - 1,
+                              (size_t)(latencies.size() * p))] /
+           1000.0;
+  };
+  COUT_THIS("[loadgen] Batch latency(us): p50 "
+            << percentile(0.5) << ", p99 " << percentile(0.99) << ", p99.9 "
+            << percentile(0.999));
+}
+
+int main(int argc, char** argv) {
+  parse_args(argc, argv);
+  run_benchmark(runtime);
+}
+
+inline void parse_args(int argc, char** argv) {
+  struct option long_options[] = {
+      {"read", required_argument, 0, 'a'},
+      {"insert", required_argument, 0, 'b'},
+      {"remove", required_argument, 0, 'c'},
+      {"update", required_argument, 0, 'd'},
+      {"scan", required_argument, 0, 'e'},
+      {"table-size", required_argument, 0, 'f'},
+      {"runtime", required_argument, 0, 'g'},
+      {"fg", required_argument, 0, 'h'},
+      {"depth", required_argument, 0, 'i'},
+      {"socket", required_argument, 0, 'j'},
+      {0, 0, 0, 0}};
+  std::string ops = "a:b:c:d:e:f:g:h:i:j:";
+  int option_index = 0;
+
+  while (1) {
+    int c = getopt_long(argc, argv, ops.c_str(), long_options, &option_index);
+    if (c == -1)
+      break;
+
+    switch (c) {
+      case 0:
+        if (long_options[option_index].flag != 0)
+          break;
+        abort();
+        break;
+      case 'a':
+        read_ratio = strtod(optarg, NULL);
+        INVARIANT(read_ratio >= 0 && read_ratio <= 1);
+        break;
+      case 'b':
+        insert_ratio = strtod(optarg, NULL);
+        INVARIANT(insert_ratio >= 0 && insert_ratio <= 1);
+        break;
+      case 'c':
+        delete_ratio = strtod(optarg, NULL);
+        INVARIANT(delete_ratio >= 0 && delete_ratio <= 1);
+        break;
+      case 'd':
+        update_ratio = strtod(optarg, NULL);
+        INVARIANT(update_ratio >= 0 && update_ratio <= 1);
+        break;
+      case 'e':
+        scan_ratio = strtod(optarg, NULL);
+        INVARIANT(scan_ratio >= 0 && scan_ratio <= 1);
+        break;
+      case 'f':
+        table_size = strtoul(optarg, NULL, 10);
+        INVARIANT(table_size > 0);
+        break;
+      case 'g':
+        runtime = strtoul(optarg, NULL, 10);
+        INVARIANT(runtime > 0);
+        break;
+      case 'h':
+        fg_n = strtoul(optarg, NULL, 10);
+        INVARIANT(fg_n > 0);
+        break;
+      case 'i':
+        depth = strtoul(optarg, NULL, 10);
+        INVARIANT(depth > 0 && depth <= kv_max_batch);
+        break;
+      case 'j':
+        socket_path = optarg;
+        break;
+      default:
+        abort();
+    }
+  }
+
+  COUT_THIS("[loadgen] Read:Insert:Update:Delete:Scan = "
+            << read_ratio << ":" << insert_ratio << ":" << update_ratio << ":"
+            << delete_ratio << ":" << scan_ratio)
+  double ratio_sum =
+      read_ratio + insert_ratio + delete_ratio + scan_ratio + update_ratio;
+  INVARIANT(ratio_sum > 0.9999 && ratio_sum < 1.0001);  // avoid precision lost
+  COUT_VAR(socket_path);
+  COUT_VAR(table_size);
+  COUT_VAR(runtime);
+  COUT_VAR(fg_n);
+  COUT_VAR(depth);
+}
@@ -0,0 +1,66 @@
+/*
+ * The code is part of the XIndex project.
+ *
+ *    Copyright (C) 2020 Institute of Parallel and Distributed Systems (IPADS),
+ * Shanghai Jiao Tong University. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For more about XIndex, visit:
+ *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
+ */
+
+#include <cstddef>
+#include <cstdint>
+
+#if !defined(KV_PROTOCOL_H)
+#define KV_PROTOCOL_H
+
+// binary protocol of kv_server and kv_loadgen. a client writes fixed-size
+// requests back to back and the server answers each with a fixed-size
+// response, in request order
+// in the order of xindex::QueueOp
+enum class KVOp : uint8_t { get, put, remove, scan };
+
+enum class KVStatus : uint8_t { ok, not_found };
+
+struct KVRequest {
+  KVOp op;
+  uint8_t padding[7];
+  uint64_t key;
+  uint64_t val;  // value of put, record count of scan
+};
+
+struct KVResponse {
+  KVStatus status;
+  uint8_t padding[7];
+  uint64_t val;  // value of get, records returned by scan
+};
+
+static_assert(sizeof(KVRequest) == 24, "unexpected request size");
+static_assert(sizeof(KVResponse) == 16, "unexpected response size");
+
+const char* const kv_default_socket = "/tmp/xindex_kv.sock";
+// requests the server reads and executes at once per connection
+const size_t kv_max_batch = 256;
+
+// the i-th key of the data set. the server bulk loads keys [0, table_size)
+// and the load generator inserts keys from table_size on
+inline uint64_t kv_key(uint64_t i) {
+  uint64_t z = i + 0x9e3779b97f4a7c15;
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+  return (z ^ (z >> 31)) >> 1;
+}
+
+#endif  // KV_PROTOCOL_H
@@ -0,0 +1,397 @@
+/*
+ * The code is part of the XIndex project.
+ *
+ *    Copyright (C) 2020 Institute of Parallel and Distributed Systems (IPADS),
+ * Shanghai Jiao Tong University. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For more about XIndex, visit:
+ *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
+ */
+
+#include <getopt.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "helper.h"
+#include "kv_protocol.h"
+#include "xindex.h"
+#include "xindex_impl.h"
+
+struct alignas(CACHELINE_SIZE) LoopParam;
+struct Connection;
+class Key;
+
+typedef LoopParam loop_param_t;
+typedef xindex::XIndex<Key, uint64_t> xindex_t;
+typedef xindex_t::op_queue_t op_queue_t;
+
+inline void prepare_xindex(xindex_t*& table);
+inline int listen_socket();
+void* run_loop(void* param);
+inline bool serve(Connection& conn, op_queue_t& queue, uint32_t thread_id,
+                  uint64_t& served_n);
+inline void parse_args(int, char**);
+
+// parameters
+std::string socket_path = kv_default_socket;
+size_t table_size = 1000000;
+size_t fg_n = 1;
+size_t bg_n = 1;
+const size_t max_scan_n = 1000;
+
+volatile bool running = true;
+xindex_t* table = nullptr;
+int listen_fd = -1;
+
+struct alignas(CACHELINE_SIZE) LoopParam {
+  uint64_t throughput;
+  uint32_t thread_id;
+};
+
+// requests of a connection that are not complete yet
+struct Connection {
+  int fd;
+  size_t read_len = 0;
+  char in[kv_max_batch * sizeof(KVRequest)];
+};
+
+class Key {
+  typedef std::array<double, 1> model_key_t;
+
+ public:
+  static constexpr size_t model_key_size() { return 1; }
+  static Key max() {
+    static Key max_key(std::numeric_limits<uint64_t>::max());
+    return max_key;
+  }
+  static Key min() {
+    static Key min_key(std::numeric_limits<uint64_t>::min());
+    return min_key;
+  }
+
+  Key() : key(0) {}
+  Key(uint64_t key) : key(key) {}
+  Key(const Key& other) { key = other.key; }
+  Key& operator=(const Key& other) {
+    key = other.key;
+    return *this;
+  }
+
+  model_key_t to_model_key() const {
+    model_key_t model_key;
+    model_key[0] = key;
+    return model_key;
+  }
+
+  uint64_t radix_key() const { return key; }
+
+  friend bool operator<(const Key& l, const Key& r) { return l.key < r.key; }
+  friend bool operator>(const Key& l, const Key& r) { return l.key > r.key; }
+  friend bool operator>=(const Key& l, const Key& r) { return l.key >= r.key; }
+  friend bool operator<=(const Key& l, const Key& r) { return l.key <= r.key; }
+  friend bool operator==(const Key& l, const Key& r) { return l.key == r.key; }
+  friend bool operator!=(const Key& l, const Key& r) { return l.key != r.key; }
+
+  uint64_t key;
+} PACKED;
+
+inline void prepare_xindex(xindex_t*& table) {
+  std::vector<std::pair<Key, uint64_t>> records;
+  records.reserve(table_size);
+  for (size_t key_i = 0; key_i < table_size; key_i++) {
+    records.emplace_back(Key(kv_key(key_i)), 1);
+  }
+  table = new xindex_t(std::move(records), fg_n, bg_n,
+                       std::max(1u, std::thread::hardware_concurrency()));
+  table->force_adjustment_sync();
+
+  std::cout << (table->byte_size().allocated) << ", "
+            << (table->byte_size().used) << std::endl;
+}
+
+inline int listen_socket() {
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+  INVARIANT(fd >= 0);
+  sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  INVARIANT(socket_path.size() < sizeof(addr.sun_path));
+  strcpy(addr.sun_path, socket_path.c_str());
+  unlink(socket_path.c_str());
+  if (bind(fd, (sockaddr*)&addr, sizeof(addr)) != 0 || listen(fd, 128) != 0) {
+    COUT_N_EXIT("Error: can not listen on " << socket_path << ": "
+                                            << strerror(errno));
+  }
+  return fd;
+}
+
+// writes all bytes to a non-blocking socket
+inline bool send_all(int fd, const char* data, size_t len) {
+  while (len > 0) {
+    ssize_t sent = send(fd, data, len, MSG_NOSIGNAL);
+    if (sent < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) {
+        return false;
+      }
+      pollfd pfd = {.fd = fd, .events = POLLOUT, .revents = 0};
+      poll(&pfd, 1, -1);
+      continue;
+    }
+    data += sent;
+    len -= sent;
+  }
+  return true;
+}
+
+// reads what is available and executes the complete requests as one batch.
+// returns false once the connection is closed
+inline bool serve(Connection& conn, op_queue_t& queue, uint32_t thread_id,
+                  uint64_t& served_n) {
+  ssize_t len =
+      recv(conn.fd, conn.in + conn.read_len, sizeof(conn.in) - conn.read_len, 0);
+  if (len == 0) {
+    return false;
+  } else if (len < 0) {
+    return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+  }
+  conn.read_len += len;
+
+  size_t req_n = conn.read_len / sizeof(KVRequest);
+  KVRequest reqs[kv_max_batch];
+  memcpy(reqs, conn.in, req_n * sizeof(KVRequest));
+  for (size_t req_i = 0; req_i < req_n; req_i++) {
+    if (reqs[req_i].op > KVOp::scan) {
+      return false;  // not speaking the protocol
+    }
+  }
+
+  std::vector<std::pair<Key, uint64_t>> results;
+  for (size_t req_i = 0; req_i < req_n; req_i++) {
+    op_queue_t::submission_t sub;
+    sub.op = (xindex::QueueOp)reqs[req_i].op;
+    sub.key = Key(reqs[req_i].key);
+    sub.val = reqs[req_i].val;
+    sub.n = std::min(reqs[req_i].val, max_scan_n);
+    sub.scan_result = &results;
+    sub.user_data = req_i;
+    INVARIANT(queue.submit(sub));
+  }
+
+  // the batch is executed inline, with the group records prefetched
+  table->process(queue, thread_id);
+  op_queue_t::completion_t comps[kv_max_batch];
+  INVARIANT(queue.reap(comps, req_n) == req_n);
+  KVResponse out[kv_max_batch];
+  for (size_t req_i = 0; req_i < req_n; req_i++) {
+    const op_queue_t::completion_t& comp = comps[req_i];
+    KVResponse& resp = out[comp.user_data];
+    memset(&resp, 0, sizeof(resp));
+    resp.status = comp.ok ? KVStatus::ok : KVStatus::not_found;
+    if (reqs[comp.user_data].op == KVOp::get) {
+      resp.val = comp.val;
+    } else if (reqs[comp.user_data].op == KVOp::scan) {
+      resp.val = comp.n;
+    }
+  }
+  served_n += req_n;
+
+  // keep the partial request for the next read
+  size_t used_len = req_n * sizeof(KVRequest);
+  memmove(conn.in, conn.in + used_len, conn.read_len - used_len);
+  conn.read_len -= used_len;
+  return send_all(conn.fd, (const char*)out, req_n * sizeof(KVResponse));
+}
+
+// event loop of one core. every loop accepts connections itself and serves
+// them until they are closed, so a connection never changes its worker
+void* run_loop(void* param) {
+  loop_param_t& loop_param = *(loop_param_t*)param;
+  uint32_t thread_id = loop_param.thread_id;
+
+  int epoll_fd = epoll_create1(0);
+  INVARIANT(epoll_fd >= 0);
+  epoll_event listen_ev;
+  listen_ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+  listen_ev.data.ptr = nullptr;
+  INVARIANT(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_ev) == 0);
+
+  op_queue_t queue(kv_max_batch);
+  const int max_event_n = 64;
+  epoll_event events[max_event_n];
+  while (running) {
+    int event_n = epoll_wait(epoll_fd, events, max_event_n, 100);
+    for (int event_i = 0; event_i < event_n; event_i++) {
+      Connection* conn = (Connection*)events[event_i].data.ptr;
+      if (conn == nullptr) {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK);
+        if (fd < 0) {
+          continue;  // taken by another loop
+        }
+        conn = new Connection();
+        conn->fd = fd;
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = conn;
+        INVARIANT(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == 0);
+      } else if (!serve(*conn, queue, thread_id, loop_param.throughput)) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        close(conn->fd);
+        delete conn;
+      }
+    }
+  }
+
+  close(epoll_fd);
+  pthread_exit(nullptr);
+}
+
+void stop(int) { running = false; }
+
+int main(int argc, char** argv) {
+  parse_args(argc, argv);
+  prepare_xindex(table);
+  listen_fd = listen_socket();
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+
+  pthread_t threads[fg_n];
+  loop_param_t loop_params[fg_n];
+  for (size_t worker_i = 0; worker_i < fg_n; worker_i++) {
+    loop_params[worker_i].thread_id = worker_i;
+    loop_params[worker_i].throughput = 0;
+    int ret = pthread_create(&threads[worker_i], nullptr, run_loop,
+                             (void*)&loop_params[worker_i]);
+    if (ret) {
+      COUT_N_EXIT("Error:" << ret);
+    }
+  }
+  COUT_THIS("[server] listening on " << socket_path);
+
+  std::vector<size_t> tput_history(fg_n, 0);
+  size_t current_sec = 0;
+  while (running) {
+    sleep(1);
+    uint64_t tput = 0;
+    for (size_t i = 0; i < fg_n; i++) {
+      tput += loop_params[i].throughput - tput_history[i];
+      tput_history[i] = loop_params[i].throughput;
+    }
+    if (tput > 0) {
+      COUT_THIS("[server] >>> sec " << current_sec << " throughput: " << tput);
+    }
+    ++current_sec;
+  }
+
+  for (size_t i = 0; i < fg_n; i++) {
+    int rc = pthread_join(threads[i], nullptr);
+    if (rc) {
+      COUT_N_EXIT("Error:unable to join," << rc);
+    }
+  }
+  close(listen_fd);
+  unlink(socket_path.c_str());
+  delete table;
+}
+
+inline void parse_args(int argc, char** argv) {
+  struct option long_options[] = {
+      {"socket", required_argument, 0, 'a'},
+      {"table-size", required_argument, 0, 'b'},
+      {"fg", required_argument, 0, 'c'},
+      {"bg", required_argument, 0, 'd'},
+      {"xindex-root-err-bound", required_argument, 0, 'e'},
+      {"xindex-root-memory", required_argument, 0, 'f'},
+      {"xindex-group-err-bound", required_argument, 0, 'g'},
+      {"xindex-group-err-tolerance", required_argument, 0, 'h'},
+      {"xindex-buf-size-bound", required_argument, 0, 'i'},
+      {"xindex-buf-compact-threshold", required_argument, 0, 'j'},
+      {0, 0, 0, 0}};
+  std::string ops = "a:b:c:d:e:f:g:h:i:j:";
+  int option_index = 0;
+
+  while (1) {
+    int c = getopt_long(argc, argv, ops.c_str(), long_options, &option_index);
+    if (c == -1)
+      break;
+
+    switch (c) {
+      case 0:
+        if (long_options[option_index].flag != 0)
+          break;
+        abort();
+        break;
+      case 'a':
+        socket_path = optarg;
+        break;
+      case 'b':
+        table_size = strtoul(optarg, NULL, 10);
+        INVARIANT(table_size > 0);
+        break;
+      case 'c':
+        fg_n = strtoul(optarg, NULL, 10);
+        INVARIANT(fg_n > 0);
+        break;
+      case 'd':
+        bg_n = strtoul(optarg, NULL, 10);
+        break;
+      case 'e':
+        xindex::config.root_error_bound = strtol(optarg, NULL, 10);
+        INVARIANT(xindex::config.root_error_bound > 0);
+        break;
+      case 'f':
+        xindex::config.root_memory_constraint =
+            strtol(optarg, NULL, 10) * 1024 * 1024;
+        INVARIANT(xindex::config.root_memory_constraint > 0);
+        break;
+      case 'g':
+        xindex::config.group_error_bound = strtol(optarg, NULL, 10);
+        INVARIANT(xindex::config.group_error_bound > 0);
+        break;
+      case 'h':
+        xindex::config.group_error_tolerance = strtol(optarg, NULL, 10);
+        INVARIANT(xindex::config.group_error_tolerance > 0);
+        break;
+      case 'i':
+        xindex::config.buffer_size_bound = strtol(optarg, NULL, 10);
+        INVARIANT(xindex::config.buffer_size_bound > 0);
+        break;
+      case 'j':
+        xindex::config.buffer_compact_threshold = strtol(optarg, NULL, 10);
+        INVARIANT(xindex::config.buffer_compact_threshold > 0);
+        break;
+      default:
+        abort();
+    }
+  }
+
+  COUT_VAR(socket_path);
+  COUT_VAR(table_size);
+  COUT_VAR(fg_n);
+  COUT_VAR(bg_n);
+}
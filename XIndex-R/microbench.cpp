@@ -29,23 +29,36 @@
 #include <memory>
 #include <random>
 #include <string>
+#include <thread>
+#include <tuple>
 #include <vector>
 
 #include "helper.h"
 #include "xindex.h"
 #include "xindex_impl.h"
 
+template <class key_t>
 struct alignas(CACHELINE_SIZE) FGParam;
 class Key;
+class TpccKey;
 
-typedef FGParam fg_param_t;
-typedef Key index_key_t;
-typedef xindex::XIndex<index_key_t, uint64_t> xindex_t;
+template <class key_t>
+using fg_param_t = FGParam<key_t>;
+template <class key_t>
+using xindex_t = xindex::XIndex<key_t, uint64_t>;
 
-inline void prepare_xindex(xindex_t*& table);
+template <class key_t>
+inline void prepare_xindex(xindex_t<key_t>*& table);
 
-void run_benchmark(xindex_t* table, size_t sec);
+inline void generate_keys(std::vector<Key>& exist_keys,
+                          std::vector<Key>& non_exist_keys);
+inline void generate_keys(std::vector<TpccKey>& exist_keys,
+                          std::vector<TpccKey>& non_exist_keys);
 
+template <class key_t>
+void run_benchmark(xindex_t<key_t>* table, size_t sec);
+
+template <class key_t>
 void* run_fg(void* param);
 
 inline void parse_args(int, char**);
@@ -60,14 +73,20 @@ size_t table_size = 1000000;
 size_t runtime = 10;
 size_t fg_n = 1;
 size_t bg_n = 1;
+std::string key_type = "uint64";
+size_t tpcc_warehouse_n = 16;
+const size_t tpcc_district_per_warehouse = 10;
 
 volatile bool running = false;
 std::atomic<size_t> ready_threads(0);
-std::vector<index_key_t> exist_keys;
-std::vector<index_key_t> non_exist_keys;
+template <class key_t>
+std::vector<key_t> exist_keys;
+template <class key_t>
+std::vector<key_t> non_exist_keys;
 
+template <class key_t>
 struct alignas(CACHELINE_SIZE) FGParam {
-  xindex_t* table;
+  xindex_t<key_t>* table;
   uint64_t throughput;
   uint32_t thread_id;
 };
@@ -100,6 +119,8 @@ class Key {
     return model_key;
   }
 
+  uint64_t radix_key() const { return key; }
+
   friend bool operator<(const Key& l, const Key& r) { return l.key < r.key; }
   friend bool operator>(const Key& l, const Key& r) { return l.key > r.key; }
   friend bool operator>=(const Key& l, const Key& r) { return l.key >= r.key; }
@@ -110,17 +131,80 @@ class Key {
   uint64_t key;
 } PACKED;
 
-int main(int argc, char** argv) {
-  parse_args(argc, argv);
-  xindex_t* tab_xi;
+// composite (warehouse, district, order) key as in TPC-C's ORDER table
+class TpccKey {
+  typedef std::array<double, 3> model_key_t;
+
+ public:
+  static constexpr size_t model_key_size() { return 3; }
+  static TpccKey max() {
+    static TpccKey max_key(std::numeric_limits<uint32_t>::max(),
+                           std::numeric_limits<uint32_t>::max(),
+                           std::numeric_limits<uint32_t>::max());
+    return max_key;
+  }
+  static TpccKey min() {
+    static TpccKey min_key(0, 0, 0);
+    return min_key;
+  }
+
+  TpccKey() : w_id(0), d_id(0), o_id(0) {}
+  TpccKey(uint32_t w_id, uint32_t d_id, uint32_t o_id)
+      : w_id(w_id), d_id(d_id), o_id(o_id) {}
+
+  model_key_t to_model_key() const {
+    model_key_t model_key;
+    model_key[0] = w_id;
+    model_key[1] = d_id;
+    model_key[2] = o_id;
+    return model_key;
+  }
+
+  friend bool operator<(const TpccKey& l, const TpccKey& r) {
+    return l.as_tuple() < r.as_tuple();
+  }
+  friend bool operator>(const TpccKey& l, const TpccKey& r) { return r < l; }
+  friend bool operator>=(const TpccKey& l, const TpccKey& r) {
+    return !(l < r);
+  }
+  friend bool operator<=(const TpccKey& l, const TpccKey& r) {
+    return !(r < l);
+  }
+  friend bool operator==(const TpccKey& l, const TpccKey& r) {
+    return l.as_tuple() == r.as_tuple();
+  }
+  friend bool operator!=(const TpccKey& l, const TpccKey& r) {
+    return !(l == r);
+  }
+
+  uint32_t w_id, d_id, o_id;
+
+ private:
+  std::tuple<uint32_t, uint32_t, uint32_t> as_tuple() const {
+    return std::make_tuple(w_id, d_id, o_id);
+  }
+} PACKED;
+
+template <class key_t>
+void run() {
+  xindex_t<key_t>* tab_xi;
   prepare_xindex(tab_xi);
   run_benchmark(tab_xi, runtime);
   if (tab_xi != nullptr)
     delete tab_xi;
 }
 
-inline void prepare_xindex(xindex_t*& table) {
-  // prepare data
+int main(int argc, char** argv) {
+  parse_args(argc, argv);
+  if (key_type == "tpcc") {
+    run<TpccKey>();
+  } else {
+    run<Key>();
+  }
+}
+
+inline void generate_keys(std::vector<Key>& exist_keys,
+                          std::vector<Key>& non_exist_keys) {
   std::random_device rd;
   std::mt19937 gen(rd());
   std::uniform_int_distribution<int64_t> rand_int64(
@@ -128,23 +212,62 @@ inline void prepare_xindex(xindex_t*& table) {
 
   exist_keys.reserve(table_size);
   for (size_t i = 0; i < table_size; ++i) {
-    exist_keys.push_back(index_key_t(rand_int64(gen)));
+    exist_keys.push_back(Key(rand_int64(gen)));
   }
 
   if (insert_ratio > 0) {
     non_exist_keys.reserve(table_size);
     for (size_t i = 0; i < table_size; ++i) {
-      non_exist_keys.push_back(index_key_t(rand_int64(gen)));
+      non_exist_keys.push_back(Key(rand_int64(gen)));
     }
   }
+}
 
-  COUT_VAR(exist_keys.size());
-  COUT_VAR(non_exist_keys.size());
+// every district starts with the same number of orders, new orders are
+// appended to randomly chosen districts like TPC-C's New-Order transaction
+inline void generate_keys(std::vector<TpccKey>& exist_keys,
+                          std::vector<TpccKey>& non_exist_keys) {
+  std::random_device rd;
+  std::mt19937 gen(rd());
+  size_t district_n = tpcc_warehouse_n * tpcc_district_per_warehouse;
+  std::uniform_int_distribution<size_t> rand_district(0, district_n - 1);
+
+  size_t order_per_district = std::max((size_t)1, table_size / district_n);
+  exist_keys.reserve(district_n * order_per_district);
+  for (uint32_t w_id = 1; w_id <= tpcc_warehouse_n; w_id++) {
+    for (uint32_t d_id = 1; d_id <= tpcc_district_per_warehouse; d_id++) {
+      for (uint32_t o_id = 1; o_id <= order_per_district; o_id++) {
+        exist_keys.push_back(TpccKey(w_id, d_id, o_id));
+      }
+    }
+  }
+
+  if (insert_ratio > 0) {
+    std::vector<uint32_t> next_o_id(district_n, order_per_district + 1);
+    non_exist_keys.reserve(table_size);
+    for (size_t i = 0; i < table_size; ++i) {
+      size_t district_i = rand_district(gen);
+      non_exist_keys.push_back(
+          TpccKey(district_i / tpcc_district_per_warehouse + 1,
+                  district_i % tpcc_district_per_warehouse + 1,
+                  next_o_id[district_i]++));
+    }
+  }
+}
+
+template <class key_t>
+inline void prepare_xindex(xindex_t<key_t>*& table) {
+  // prepare data
+  generate_keys(exist_keys<key_t>, non_exist_keys<key_t>);
+
+  COUT_VAR(exist_keys<key_t>.size());
+  COUT_VAR(non_exist_keys<key_t>.size());
 
   // initilize XIndex (sort keys first)
-  std::sort(exist_keys.begin(), exist_keys.end());
-  std::vector<uint64_t> vals(exist_keys.size(), 1);
-  table = new xindex_t(exist_keys, vals, fg_n, bg_n);
+  xindex::parallel_sort(exist_keys<key_t>,
+                        std::max(1u, std::thread::hardware_concurrency()));
+  std::vector<uint64_t> vals(exist_keys<key_t>.size(), 1);
+  table = new xindex_t<key_t>(exist_keys<key_t>, vals, fg_n, bg_n);
 
   table->force_adjustment_sync();
 
@@ -152,10 +275,13 @@ inline void prepare_xindex(xindex_t*& table) {
             << (table->byte_size().used) << std::endl;
 }
 
+template <class key_t>
 void* run_fg(void* param) {
-  fg_param_t& thread_param = *(fg_param_t*)param;
+  fg_param_t<key_t>& thread_param = *(fg_param_t<key_t>*)param;
   uint32_t thread_id = thread_param.thread_id;
-  xindex_t* table = thread_param.table;
+  xindex_t<key_t>* table = thread_param.table;
+  const std::vector<key_t>& exist_keys = ::exist_keys<key_t>;
+  const std::vector<key_t>& non_exist_keys = ::non_exist_keys<key_t>;
 
   std::random_device rd;
   std::mt19937 gen(rd());
@@ -164,7 +290,7 @@ void* run_fg(void* param) {
   size_t exist_key_n_per_thread = exist_keys.size() / fg_n;
   size_t exist_key_start = thread_id * exist_key_n_per_thread;
   size_t exist_key_end = (thread_id + 1) * exist_key_n_per_thread;
-  std::vector<index_key_t> op_keys(exist_keys.begin() + exist_key_start,
+  std::vector<key_t> op_keys(exist_keys.begin() + exist_key_start,
                                    exist_keys.begin() + exist_key_end);
 
   if (non_exist_keys.size() > 0) {
@@ -216,7 +342,7 @@ void* run_fg(void* param) {
         delete_i = 0;
       }
     } else {  // scan
-      std::vector<std::pair<index_key_t, uint64_t>> results;
+      std::vector<std::pair<key_t, uint64_t>> results;
       table->scan(op_keys[(query_i + delete_i) % op_keys.size()], 10, results,
                   thread_id);
       query_i++;
@@ -230,9 +356,10 @@ void* run_fg(void* param) {
   pthread_exit(nullptr);
 }
 
-void run_benchmark(xindex_t* table, size_t sec) {
+template <class key_t>
+void run_benchmark(xindex_t<key_t>* table, size_t sec) {
   pthread_t threads[fg_n];
-  fg_param_t fg_params[fg_n];
+  fg_param_t<key_t> fg_params[fg_n];
   // check if parameters are cacheline aligned
   for (size_t i = 0; i < fg_n; i++) {
     if ((uint64_t)(&(fg_params[i])) % CACHELINE_SIZE != 0) {
@@ -245,7 +372,7 @@ void run_benchmark(xindex_t* table, size_t sec) {
     fg_params[worker_i].table = table;
     fg_params[worker_i].thread_id = worker_i;
     fg_params[worker_i].throughput = 0;
-    int ret = pthread_create(&threads[worker_i], nullptr, run_fg,
+    int ret = pthread_create(&threads[worker_i], nullptr, run_fg<key_t>,
                              (void*)&fg_params[worker_i]);
     if (ret) {
       COUT_N_EXIT("Error:" << ret);
@@ -303,8 +430,12 @@ inline void parse_args(int argc, char** argv) {
       {"xindex-group-err-tolerance", required_argument, 0, 'm'},
       {"xindex-buf-size-bound", required_argument, 0, 'n'},
       {"xindex-buf-compact-threshold", required_argument, 0, 'o'},
+      {"key-type", required_argument, 0, 'p'},
+      {"tpcc-warehouses", required_argument, 0, 'q'},
+      {"xindex-tier-dir", required_argument, 0, 'r'},
+      {"xindex-point-hints", required_argument, 0, 's'},
       {0, 0, 0, 0}};
-  std::string ops = "a:b:c:d:e:f:g:h:i:j:k:l:m:n:o:";
+  std::string ops = "a:b:c:d:e:f:g:h:i:j:k:l:m:n:o:p:q:r:s:";
   int option_index = 0;
 
   while (1) {
@@ -378,6 +509,20 @@ inline void parse_args(int argc, char** argv) {
         xindex::config.buffer_compact_threshold = strtol(optarg, NULL, 10);
         INVARIANT(xindex::config.buffer_compact_threshold > 0);
         break;
+      case 'p':
+        key_type = optarg;
+        INVARIANT(key_type == "uint64" || key_type == "tpcc");
+        break;
+      case 'q':
+        tpcc_warehouse_n = strtoul(optarg, NULL, 10);
+        INVARIANT(tpcc_warehouse_n > 0);
+        break;
+      case 'r':
+        xindex::config.tier_dir = optarg;
+        break;
+      case 's':
+        xindex::config.point_hint_n = strtoul(optarg, NULL, 10);
+        break;
       default:
         abort();
     }
@@ -389,6 +534,10 @@ inline void parse_args(int argc, char** argv) {
   double ratio_sum =
       read_ratio + insert_ratio + delete_ratio + scan_ratio + update_ratio;
   INVARIANT(ratio_sum > 0.9999 && ratio_sum < 1.0001);  // avoid precision lost
+  COUT_VAR(key_type);
+  if (key_type == "tpcc") {
+    COUT_VAR(tpcc_warehouse_n);
+  }
   COUT_VAR(runtime);
   COUT_VAR(fg_n);
   COUT_VAR(bg_n);
@@ -399,4 +548,8 @@ inline void parse_args(int argc, char** argv) {
   COUT_VAR(xindex::config.buffer_size_bound);
   COUT_VAR(xindex::config.buffer_size_tolerance);
   COUT_VAR(xindex::config.buffer_compact_threshold);
+  if (!xindex::config.tier_dir.empty()) {
+    COUT_VAR(xindex::config.tier_dir);
+  }
+  COUT_VAR(xindex::config.point_hint_n);
 }
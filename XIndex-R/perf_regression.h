@@ -0,0 +1,293 @@
+/*
+ * The code is part of the XIndex project.
+ *
+ *    Copyright (C) 2020 Institute of Parallel and Distributed Systems (IPADS),
+ * Shanghai Jiao Tong University. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For more about XIndex, visit:
+ *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
+ */
+
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if !defined(PERF_REGRESSION_H)
+#define PERF_REGRESSION_H
+
+// Harness of the perf_regression executables of XIndex-R and XIndex-H. It
+// only depends on the standard library and Linux, so that both trees can
+// include it. Workloads run on one pinned thread with fixed seeds, and each
+// reports its best throughput of several runs together with hardware counters
+// per operation, which are compared against a baseline file recorded on the
+// same machine.
+
+namespace perf_regression {
+
+/// exit code of a check whose baseline file does not exist yet, which CTest
+/// reports as a skipped test (SKIP_RETURN_CODE)
+static const int skip_exit_code = 77;
+
+/// synthetic key distributions, each with a fixed seed
+enum class Cdf { uniform, lognormal, normal, segmented };
+
+static const Cdf all_cdfs[] = {Cdf::uniform, Cdf::lognormal, Cdf::normal,
+                               Cdf::segmented};
+
+inline const char* cdf_name(Cdf cdf) {
+  switch (cdf) {
+    case Cdf::uniform:
+      return "uniform";
+    case Cdf::lognormal:
+      return "lognormal";
+    case Cdf::normal:
+      return "normal";
+    case Cdf::segmented:
+      return "segmented";
+  }
+  return "";
+}
+
+// n sorted unique keys below 2^63, so that inserts can use the upper half
+inline std::vector<uint64_t> make_keys(Cdf cdf, size_t n, uint64_t seed) {
+  std::mt19937_64 gen(seed);
+  std::vector<uint64_t> keys;
+  keys.reserve(n);
+  std::lognormal_distribution<double> lognormal(0, 2);
+  std::normal_distribution<double> normal(0, 1);
+  uint64_t segment_base = 0, segment_left = 0;
+  while (keys.size() < n) {
+    for (size_t key_i = keys.size(); key_i < n; key_i++) {
+      uint64_t key = 0;
+      switch (cdf) {
+        case Cdf::uniform:
+          key = gen() >> 1;
+          break;
+        case Cdf::lognormal:
+          key = (uint64_t)std::min(lognormal(gen) * 1e12, 9e18);
+          break;
+        case Cdf::normal:
+          key = (uint64_t)std::max(0.0, normal(gen) * 1e17 + 4.6e18);
+          break;
+        case Cdf::segmented:
+          // dense runs of 1 to 4096 keys, separated by random gaps
+          if (segment_left == 0) {
+            segment_base = gen() >> 1;
+            segment_left = gen() % 4096 + 1;
+          }
+          key = segment_base + segment_left--;
+          break;
+      }
+      keys.push_back(key & ((1ull << 63) - 1));
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+  }
+  return keys;
+}
+
+// pins the calling thread, since migrations show up as noise in the counters
+inline bool pin_thread(int cpu) {
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  CPU_SET(cpu, &cpu_set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set) ==
+         0;
+}
+
+/// user-space hardware counters of the calling thread. counters that the
+/// kernel does not grant (e.g., in containers) are left out of the results
+class Counters {
+ public:
+  Counters() {
+    const std::pair<const char*, uint64_t> events[] = {
+        {"cycles", PERF_COUNT_HW_CPU_CYCLES},
+        {"instructions", PERF_COUNT_HW_INSTRUCTIONS},
+        {"branch_misses", PERF_COUNT_HW_BRANCH_MISSES},
+        {"cache_misses", PERF_COUNT_HW_CACHE_MISSES}};
+    for (auto& event : events) {
+      perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.size = sizeof(attr);
+      attr.config = event.second;
+      attr.disabled = 1;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      int fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+      if (fd >= 0) {
+        names.push_back(event.first);
+        fds.push_back(fd);
+      }
+    }
+    values.resize(fds.size(), 0);
+  }
+  ~Counters() {
+    for (int fd : fds) {
+      close(fd);
+    }
+  }
+
+  void start() {
+    for (int fd : fds) {
+      ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+  void stop() {
+    for (size_t counter_i = 0; counter_i < fds.size(); counter_i++) {
+      ioctl(fds[counter_i], PERF_EVENT_IOC_DISABLE, 0);
+      if (read(fds[counter_i], &values[counter_i], sizeof(uint64_t)) !=
+          sizeof(uint64_t)) {
+        values[counter_i] = 0;
+      }
+    }
+  }
+
+  std::vector<std::string> names;
+  std::vector<uint64_t> values;
+
+ private:
+  std::vector<int> fds;
+};
+
+/// metrics of a workload: "mops" (higher is better) and counters per
+/// operation (lower is better)
+typedef std::map<std::string, double> metrics_t;
+
+/// Runs the workloads, then records or checks the baseline. A workload is a
+/// function of the run index that performs op_n operations; setup that must
+/// not be measured goes into the optional prepare function.
+class Suite {
+ public:
+  Suite(size_t repeat_n, int cpu) : repeat_n(repeat_n) {
+    if (!pin_thread(cpu)) {
+      std::cerr << "[perf] can not pin to cpu " << cpu << std::endl;
+    }
+  }
+
+  template <class prepare_t, class run_t>
+  void run(const std::string& name, size_t op_n, prepare_t prepare,
+           run_t run) {
+    metrics_t best;
+    for (size_t run_i = 0; run_i < repeat_n; run_i++) {
+      prepare(run_i);
+      counters.start();
+      auto begin = std::chrono::steady_clock::now();
+      run(run_i);
+      auto end = std::chrono::steady_clock::now();
+      counters.stop();
+
+      double sec = std::chrono::duration<double>(end - begin).count();
+      double mops = op_n / sec / 1e6;
+      if (mops > best["mops"]) {
+        best.clear();
+        best["mops"] = mops;
+        for (size_t counter_i = 0; counter_i < counters.names.size();
+             counter_i++) {
+          best[counters.names[counter_i] + "_per_op"] =
+              (double)counters.values[counter_i] / op_n;
+        }
+      }
+    }
+
+    std::cout << std::left << std::setw(28) << name << std::right;
+    for (auto& metric : best) {
+      std::cout << " " << metric.first << "=" << std::fixed
+                << std::setprecision(3) << metric.second;
+    }
+    std::cout << std::endl;
+    results[name] = best;
+  }
+  template <class run_t>
+  void run(const std::string& name, size_t op_n, run_t run) {
+    this->run(name, op_n, [](size_t) {}, run);
+  }
+
+  // one "workload metric value" line per metric
+  bool record(const std::string& path) const {
+    std::ofstream out(path);
+    for (auto& result : results) {
+      for (auto& metric : result.second) {
+        out << result.first << " " << metric.first << " "
+            << std::setprecision(6) << metric.second << std::endl;
+      }
+    }
+    return (bool)out;
+  }
+
+  /// returns false if a metric regressed by more than its tolerance, the
+  /// baseline can not be read, or a workload or metric of the baseline was
+  /// not measured (e.g., the counters are no longer available). metrics that
+  /// only the current run has are not compared
+  bool check(const std::string& path, double tolerance,
+             double counter_tolerance) const {
+    std::ifstream in(path);
+    if (!in) {
+      std::cerr << "[perf] can not read baseline " << path << std::endl;
+      return false;
+    }
+    bool passed = true;
+    std::string workload, metric;
+    double baseline;
+    while (in >> workload >> metric >> baseline) {
+      auto result = results.find(workload);
+      if (result == results.end() ||
+          result->second.find(metric) == result->second.end()) {
+        passed = false;
+        std::cout << "[perf] MISSING " << workload << " " << metric
+                  << " of the baseline" << std::endl;
+        continue;
+      }
+      double current = result->second.at(metric);
+      bool is_throughput = metric == "mops";
+      bool regressed =
+          is_throughput ? current < baseline * (1 - tolerance)
+                        : current > baseline * (1 + counter_tolerance);
+      if (regressed) {
+        passed = false;
+        std::cout << "[perf] REGRESSION " << workload << " " << metric
+                  << ": " << current << " vs baseline " << baseline
+                  << std::endl;
+      }
+    }
+    return passed;
+  }
+
+ private:
+  size_t repeat_n;
+  Counters counters;
+  std::map<std::string, metrics_t> results;
+};
+
+}  // namespace perf_regression
+
+#endif  // PERF_REGRESSION_H
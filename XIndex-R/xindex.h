@@ -24,44 +24,151 @@
 #include "globals.h"
 #include "helper.h"
 #include "xindex_buffer.h"
+#include "xindex_change_log.h"
+#include "xindex_export.h"
 #include "xindex_group.h"
+#include "xindex_hint.h"
 #include "xindex_model.h"
+#include "xindex_queue.h"
 #include "xindex_root.h"
+#include "xindex_shape.h"
+#include "xindex_sort.h"
+#include "xindex_str_key.h"
+#include "xindex_ttl.h"
 #include "xindex_util.h"
+#include "xindex_var_val.h"
 
 #if !defined(XINDEX_H)
 #define XINDEX_H
 
 namespace xindex {
 
-template <class key_t, class val_t, bool seq = false>
+template <class key_t, class val_t, bool seq = false, bool multi = false>
 class XIndex {
-  typedef Group<key_t, val_t, seq> group_t;
-  typedef Root<key_t, val_t, seq> root_t;
+  static_assert(!(seq && multi),
+                "sequential insertion assumes unique keys, so it can not be "
+                "combined with the multimap mode");
+
+  typedef Group<key_t, val_t, seq, multi> group_t;
+  typedef Root<key_t, val_t, seq, multi> root_t;
+  typedef PointHints<group_t> hints_t;
   typedef void iterator_t;
 
  public:
+  typedef BatchWrite<key_t, val_t> batch_write_t;
+  typedef ChangeLog<key_t, val_t> change_log_t;
+  typedef Change<key_t, val_t> change_t;
+  typedef OpQueue<key_t, val_t> op_queue_t;
+
   XIndex(const std::vector<key_t>& keys, const std::vector<val_t>& vals,
          size_t worker_num, size_t bg_n);
+  /// bulk load of out-of-line values, for val_t = VarVal
+  XIndex(const std::vector<key_t>& keys,
+         const std::vector<std::string_view>& vals, size_t worker_num,
+         size_t bg_n);
+  /// lazy bulk load: only the root and group pivots are built, each group is
+  /// built from the source records on its first access. the sorted source
+  /// (e.g., an mmapped file) must stay valid until materialize_all returns
+  XIndex(const key_t* keys, const val_t* vals, size_t record_n,
+         size_t worker_num, size_t bg_n);
+  /// bulk load of unsorted records, which are sorted in place with
+  /// sort_thread_n threads. unless multi, the last record of a key wins
+  XIndex(std::vector<std::pair<key_t, val_t>>&& records, size_t worker_num,
+         size_t bg_n, size_t sort_thread_n);
   ~XIndex();
 
   inline bool get(const key_t& key, val_t& val, const uint32_t worker_id);
   inline bool put(const key_t& key, const val_t& val, const uint32_t worker_id);
+  /// zero-copy read of an out-of-line value (val_t = VarVal). the view stays
+  /// valid until the worker's next call into the index
+  inline bool get(const key_t& key, std::string_view& val,
+                  const uint32_t worker_id);
+  /// copies the value into the value arena (val_t = VarVal)
+  inline bool put(const key_t& key, std::string_view val,
+                  const uint32_t worker_id);
   inline bool remove(const key_t& key, const uint32_t worker_id);
+  /// applies puts and removes of several keys atomically, of several writes
+  /// to one key the last wins. not available in multimap or sequential mode
+  void write_batch(const std::vector<batch_write_t>& writes,
+                   const uint32_t worker_id);
+  /// reads several keys as one snapshot that is consistent with write_batch
+  size_t multi_get(const std::vector<key_t>& keys, std::vector<val_t>& vals,
+                   std::vector<bool>& found, const uint32_t worker_id);
+  inline size_t equal_range(const key_t& key, std::vector<val_t>& vals,
+                            const uint32_t worker_id);
+  /// removes all keys in [begin, end). groups inside the range are unlinked
+  /// with a single root rebuild and reclaimed after an RCU barrier, so the
+  /// cost grows with the number of groups rather than keys
+  void remove_range(const key_t& begin, const key_t& end,
+                    const uint32_t worker_id);
+  /// puts all records of `other`, which must not be in use, with a single
+  /// root rebuild. groups that receive no records are reused and the others
+  /// are rebuilt, so the cost grows with the overlapping groups. writers must
+  /// be paused, the barrier waits for the other workers like remove_range's
+  void merge_from(XIndex& other, const uint32_t worker_id);
+  /// moves the groups of all keys >= key to a new index, splitting only the
+  /// group that holds key, and returns it. returns nullptr if either index
+  /// would have no groups. writers must be paused, as for merge_from
+  std::unique_ptr<XIndex> split_at(const key_t& key, const uint32_t worker_id);
   inline size_t scan(const key_t& begin, const size_t n,
                      std::vector<std::pair<key_t, val_t>>& result,
                      const uint32_t worker_id);
   size_t range_scan(const key_t& begin, const key_t& end,
                     std::vector<std::pair<key_t, val_t>>& result,
                     const uint32_t worker_id);
+  /// calls visit(range_i, key, val) for the records of several sorted and
+  /// disjoint ranges [begin, end), in one pass over the groups. returns the
+  /// number of visited records
+  template <class visit_t>
+  size_t multi_range_scan(const std::vector<std::pair<key_t, key_t>>& ranges,
+                          visit_t visit, const uint32_t worker_id);
+  /// calls fn(part_i, key, val) for all records in [begin, end) on thread_n
+  /// threads and returns the number of parts. the range is split at group
+  /// boundaries into parts numbered in key order, and each part is visited in
+  /// order by one thread, so per-part outputs concatenate in key order
+  template <class fn_t>
+  size_t parallel_for_each(const key_t& begin, const key_t& end, fn_t fn,
+                           size_t thread_n, const uint32_t worker_id);
+  /// writes all records on thread_n threads to a SOSD key file of the
+  /// radix_key of each key and a value file in the same layout. returns false
+  /// if a file can not be written or concurrent writes changed the record count
+  bool export_sosd(const std::string& key_path, const std::string& val_path,
+                   size_t thread_n, const uint32_t worker_id);
+
+  /// executes up to max_n submitted requests of the queue in batches and
+  /// returns how many. the group records of a batch are prefetched before the
+  /// batch is executed, so their cache misses overlap
+  size_t process(op_queue_t& queue, const uint32_t worker_id,
+                 size_t max_n = std::numeric_limits<size_t>::max());
+
+  /// records put, remove, write_batch and remove_range from now on. must be
+  /// called before workers issue requests; the returned log is consumed by a
+  /// single replication thread
+  change_log_t* enable_change_log(size_t ring_size = 1 << 16);
+
+  /// builds all groups that were not accessed yet after a lazy bulk load
+  void materialize_all();
 
-  /// synchronously forces merging of all delta buffers
+  /// synchronously forces merging of all delta buffers. waits for workers
+  /// that are in a request or have not called quiesce since their last one
   void force_adjustment_sync();
+  /// marks the worker idle until its next request, so that barriers do not
+  /// wait for it. called by the worker's own thread, views of out-of-line
+  /// values it holds become invalid
+  void quiesce(const uint32_t worker_id);
 
   /// computes the in memory size of the index in bytes
   _::ByteSize byte_size() const;
+  /// collects the group count, the errors of the root and group models and
+  /// the memory by component. must not run concurrently with adjustments
+  IndexShape<key_t> shape();
 
  private:
+  void init(const std::vector<key_t>& keys, const std::vector<val_t>& vals,
+            size_t worker_num);
+  // takes over the groups of a root that was split off by split_at
+  XIndex(root_t* root, size_t worker_num, size_t bg_n);
+  void init_config(size_t worker_num);
   void start_bg();
   void terminate_bg();
 
@@ -69,6 +176,11 @@ class XIndex {
   static void* background(void* this_);
 
   root_t* volatile root = nullptr;
+  std::mutex root_update_mut;  // serializes the updates that replace groups
+  std::unique_ptr<rcu_domain_t> rcu;  // RCU status of the index's workers
+  std::unique_ptr<ValueArena> arena;  // only used for VarVal
+  std::unique_ptr<change_log_t> change_log;  // only if enabled
+  std::unique_ptr<hints_t> hints;  // only if config.point_hint_n > 0
   pthread_t bg_master;
   size_t bg_num;
   volatile bool bg_running = true;
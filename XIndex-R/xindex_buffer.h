@@ -21,6 +21,7 @@
  */
 
 #include "byte_size.hpp"
+#include "xindex_simd.h"
 #include "xindex_util.h"
 
 #if !defined(xindex_buffer_H)
@@ -33,8 +34,11 @@ const uint8_t node_capacity = alt_buf_fanout - 1;
 
 template <class key_t, class val_t>
 class AltBtreeBuffer {
-  template <class key_t_, class val_t_, bool optt, size_t max_model_n>
+  template <class key_t_, class val_t_, bool optt, bool multi,
+            size_t max_model_n>
   friend class Group;
+  template <class key_tt, class val_tt, bool sequential, bool multimap>
+  friend class Root;
   class Node;
   class Internal;
   class Leaf;
@@ -147,15 +151,20 @@ class AltBtreeBuffer {
   ~AltBtreeBuffer();
 
   inline bool get(const key_t& key, val_t& val);
+  inline bool get(const key_t& key, val_t& val, uint64_t& version);
   inline bool update(const key_t& key, const val_t& val);
   inline void insert(const key_t& key, const val_t& val);
   inline bool remove(const key_t& key);
+  // inserts a removed record unless the key has one, see Root::write_batch
+  inline void reserve(const key_t& key);
   inline size_t scan(const key_t& key_begin, const size_t n,
                      std::vector<std::pair<key_t, val_t>>& result);
   inline void range_scan(const key_t& key_begin, const key_t& key_end,
                          std::vector<std::pair<key_t, val_t>>& result);
 
-  inline uint32_t size();
+  inline group_size_t size();
+  // sequence numbers that keep duplicate keys apart in multimap mode
+  inline uint64_t next_insert_seq();
 
   /// computes the in memory size in bytes
   _::ByteSize byte_size() const;
@@ -164,9 +173,15 @@ class AltBtreeBuffer {
   leaf_t* locate_leaf(key_t key, uint64_t& version);
   leaf_t* locate_leaf_locked(key_t key);
 
-  void insert_leaf(const key_t& key, const val_t& val, leaf_t* target);
+  void insert_leaf(const key_t& key, const val_t& val, leaf_t* target,
+                   bool removed = false);
   void split_n_insert_leaf(const key_t& key, const val_t& val, int slot,
-                           leaf_t* target);
+                           leaf_t* target, bool removed);
+
+  // batch writes lock whole leaves in key order and write in place
+  leaf_t* lock_leaf(const key_t& key, leaf_t* held);
+  void write_locked(leaf_t* leaf_ptr, const key_t& key, const val_t& val);
+  void remove_locked(leaf_t* leaf_ptr, const key_t& key);
 
   inline void allocate_new_block();
   inline uint8_t* allocate_node();
@@ -176,7 +191,8 @@ class AltBtreeBuffer {
 
   node_t* root = nullptr;
   leaf_t* begin = nullptr;
-  std::atomic<uint32_t> size_est;
+  std::atomic<group_size_t> size_est;
+  std::atomic<uint64_t> insert_seq;
   std::mutex alloc_mut;
   std::vector<uint8_t*> allocated_blocks;
   size_t next_node_i = 0;
@@ -36,6 +36,7 @@ namespace xindex {
 template <class key_t, class val_t>
 AltBtreeBuffer<key_t, val_t>::AltBtreeBuffer() {
   size_est = 0;
+  insert_seq = 1;
   next_node_i = 0;
   allocated_blocks.reserve(1);
   _::allocated_bytes += sizeof(typename decltype(allocated_blocks)::value_type);
@@ -69,13 +70,21 @@ AltBtreeBuffer<key_t, val_t>::~AltBtreeBuffer() {
 
 template <class key_t, class val_t>
 inline bool AltBtreeBuffer<key_t, val_t>::get(const key_t& key, val_t& val) {
+  uint64_t version;
+  return get(key, val, version);
+}
+
+// the version is only set if the key has a (possibly removed) record
+template <class key_t, class val_t>
+inline bool AltBtreeBuffer<key_t, val_t>::get(const key_t& key, val_t& val,
+                                              uint64_t& version) {
   uint64_t leaf_ver;
   leaf_t* leaf_ptr = locate_leaf(key, leaf_ver);
 
   while (true) {
     int slot = leaf_ptr->find_first_larger_than_or_equal_to(key);
     bool res = (slot < leaf_ptr->key_n && leaf_ptr->keys[slot] == key)
-                   ? leaf_ptr->vals[slot].read_ignoring_ptr(val)
+                   ? leaf_ptr->vals[slot].read_ignoring_ptr(val, version)
                    : false;
     memory_fence();
     bool locked = leaf_ptr->locked == 1;
@@ -131,6 +140,17 @@ inline bool AltBtreeBuffer<key_t, val_t>::remove(const key_t& key) {
   return res;
 }
 
+template <class key_t, class val_t>
+inline void AltBtreeBuffer<key_t, val_t>::reserve(const key_t& key) {
+  leaf_t* leaf_ptr = locate_leaf_locked(key);
+  int slot = leaf_ptr->find_first_larger_than_or_equal_to(key);
+  if (slot < leaf_ptr->key_n && leaf_ptr->keys[slot] == key) {
+    leaf_ptr->unlock();
+    return;
+  }
+  insert_leaf(key, val_t(), leaf_ptr, true);  // lock is released within
+}
+
 template <class key_t, class val_t>
 inline size_t AltBtreeBuffer<key_t, val_t>::scan(
     const key_t& key_begin, const size_t n,
@@ -157,10 +177,15 @@ inline void AltBtreeBuffer<key_t, val_t>::range_scan(
 }
 
 template <class key_t, class val_t>
-inline uint32_t AltBtreeBuffer<key_t, val_t>::size() {
+inline group_size_t AltBtreeBuffer<key_t, val_t>::size() {
   return size_est;
 }
 
+template <class key_t, class val_t>
+inline uint64_t AltBtreeBuffer<key_t, val_t>::next_insert_seq() {
+  return insert_seq++;
+}
+
 template <class key_t, class val_t>
 inline typename AltBtreeBuffer<key_t, val_t>::leaf_t*
 AltBtreeBuffer<key_t, val_t>::locate_leaf(key_t key, uint64_t& leaf_ver) {
@@ -223,10 +248,47 @@ AltBtreeBuffer<key_t, val_t>::locate_leaf_locked(key_t key) {
   return leaf_ptr;
 }
 
+// keys are locked in ascending order, so the leaf of `key` is either `held`,
+// which the caller locked for a previous key, or one after it. the key range
+// of a locked leaf is fixed, as it can't split and the first key of its next
+// leaf is the separator
+template <class key_t, class val_t>
+inline typename AltBtreeBuffer<key_t, val_t>::leaf_t*
+AltBtreeBuffer<key_t, val_t>::lock_leaf(const key_t& key, leaf_t* held) {
+  if (held != nullptr && (held->next == nullptr || key < held->next->keys[0])) {
+    return held;
+  }
+  return locate_leaf_locked(key);
+}
+
+// the record must exist, i.e., have been reserved before locking
+template <class key_t, class val_t>
+void AltBtreeBuffer<key_t, val_t>::write_locked(leaf_t* leaf_ptr,
+                                                const key_t& key,
+                                                const val_t& val) {
+  assert(leaf_ptr->locked);
+  int slot = leaf_ptr->find_first_larger_than_or_equal_to(key);
+  INVARIANT(slot < leaf_ptr->key_n && leaf_ptr->keys[slot] == key);
+  atomic_val_t& record = leaf_ptr->vals[slot];
+  record.lock();
+  record.write_locked(val);
+  record.unlock();  // readers are held off by the leaf lock
+}
+
+template <class key_t, class val_t>
+void AltBtreeBuffer<key_t, val_t>::remove_locked(leaf_t* leaf_ptr,
+                                                 const key_t& key) {
+  assert(leaf_ptr->locked);
+  int slot = leaf_ptr->find_first_larger_than_or_equal_to(key);
+  if (slot < leaf_ptr->key_n && leaf_ptr->keys[slot] == key) {
+    leaf_ptr->vals[slot].remove_ignoring_ptr();
+  }
+}
+
 template <class key_t, class val_t>
 void AltBtreeBuffer<key_t, val_t>::insert_leaf(const key_t& key,
                                                const val_t& val,
-                                               leaf_t* target) {
+                                               leaf_t* target, bool removed) {
   // first try to update inplace (without modifying mem layout)
   int slot = target->find_first_larger_than_or_equal_to(key);
   if (slot < target->key_n && target->keys[slot] == key) {
@@ -235,7 +297,13 @@ void AltBtreeBuffer<key_t, val_t>::insert_leaf(const key_t& key,
       target->unlock();  // didn't insert anything
       return;
     } else {
-      target->vals[slot] = atomic_val_t(val);
+      // keep counting the versions of the removed record, which multi-record
+      // reads validate against
+      atomic_val_t& old_val = target->vals[slot];
+      atomic_val_t revived(val);
+      revived.status = old_val.get_version(old_val.status);
+      revived.incr_version();
+      target->vals[slot] = revived;
 
       memory_fence();
       target->version++;
@@ -251,6 +319,9 @@ void AltBtreeBuffer<key_t, val_t>::insert_leaf(const key_t& key,
     target->move_vals_backward(slot, 1);
     target->keys[slot] = key;
     target->vals[slot] = atomic_val_t(val);
+    if (removed) {
+      target->vals[slot].set_removed();
+    }
     target->key_n++;
 
     memory_fence();
@@ -260,7 +331,7 @@ void AltBtreeBuffer<key_t, val_t>::insert_leaf(const key_t& key,
     size_est++;
     return;
   } else {
-    split_n_insert_leaf(key, val, slot, target);
+    split_n_insert_leaf(key, val, slot, target, removed);
     size_est++;
   }
 }
@@ -269,7 +340,8 @@ template <class key_t, class val_t>
 void AltBtreeBuffer<key_t, val_t>::split_n_insert_leaf(const key_t& insert_key,
                                                        const val_t& val,
                                                        int slot,
-                                                       leaf_t* target) {
+                                                       leaf_t* target,
+                                                       bool removed) {
   node_t* node_ptr = target;
   node_t* sib_ptr = allocate_leaf();
   sib_ptr->lock();
@@ -293,6 +365,9 @@ void AltBtreeBuffer<key_t, val_t>::split_n_insert_leaf(const key_t& insert_key,
 
     sib_ptr->keys[slot - mid] = insert_key;
     ((leaf_t*)sib_ptr)->vals[slot - mid] = atomic_val_t(val);
+    if (removed) {
+      ((leaf_t*)sib_ptr)->vals[slot - mid].set_removed();
+    }
 
     sib_ptr->key_n = node_ptr->key_n - mid + 1;
     node_ptr->key_n = mid;
@@ -304,6 +379,9 @@ void AltBtreeBuffer<key_t, val_t>::split_n_insert_leaf(const key_t& insert_key,
 
     node_ptr->keys[slot] = insert_key;
     ((leaf_t*)node_ptr)->vals[slot] = atomic_val_t(val);
+    if (removed) {
+      ((leaf_t*)node_ptr)->vals[slot].set_removed();
+    }
 
     sib_ptr->key_n = node_ptr->key_n - mid;
     node_ptr->key_n = mid + 1;
@@ -601,6 +679,9 @@ template <class key_t, class val_t>
 int AltBtreeBuffer<key_t, val_t>::Node::find_first_larger_than_or_equal_to(
     const key_t& key) {
   uint8_t key_n = this->key_n;
+  if constexpr (has_radix_key<key_t>::value) {
+    return simd::count_less(keys, key_n, key.radix_key());
+  }
   uint8_t begin_i = 0, end_i = key_n;
   uint8_t mid = (begin_i + end_i) / 2;
 
@@ -620,6 +701,9 @@ template <class key_t, class val_t>
 int AltBtreeBuffer<key_t, val_t>::Node::find_first_larger_than(
     const key_t& key) {
   uint8_t key_n = this->key_n;
+  if constexpr (has_radix_key<key_t>::value) {
+    return simd::count_not_greater(keys, key_n, key.radix_key());
+  }
   uint8_t begin_i = 0, end_i = key_n;
   uint8_t mid = (begin_i + end_i) / 2;
 
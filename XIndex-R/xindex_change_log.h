@@ -0,0 +1,223 @@
+/*
+ * The code is part of the XIndex project.
+ *
+ *    Copyright (C) 2020 Institute of Parallel and Distributed Systems (IPADS),
+ * Shanghai Jiao Tong University. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For more about XIndex, visit:
+ *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "byte_size.hpp"
+#include "helper.h"
+#include "xindex_hint.h"
+#include "xindex_util.h"
+
+#if !defined(XINDEX_CHANGE_LOG_H)
+#define XINDEX_CHANGE_LOG_H
+
+namespace xindex {
+
+enum class ChangeOp : uint8_t { put, remove, remove_range };
+
+/// One modification of the index. `seq` is a global sequence number that
+/// orders all changes; replaying them in that order reproduces the index.
+template <class key_t, class val_t>
+struct Change {
+  uint64_t seq;
+  ChangeOp op;
+  key_t key;
+  key_t end;  // exclusive end of remove_range
+  val_t val;  // value of put
+};
+
+/// Change-data-capture stream of an index. Each worker appends to its own
+/// single-producer ring and a single consumer thread merges the rings into
+/// sequence order. Writes to the same key take a striped lock around applying
+/// the change and drawing its sequence number, so the order of the stream
+/// matches the order in which the changes were applied.
+template <class key_t, class val_t>
+class ChangeLog {
+  typedef Change<key_t, val_t> change_t;
+
+  static const size_t stripe_n = 1024;
+  static const uint64_t idle = std::numeric_limits<uint64_t>::max();
+
+  struct alignas(CACHELINE_SIZE) Ring {
+    std::unique_ptr<change_t[]> changes;
+    std::atomic<uint64_t> head{0};  // next change to consume
+    std::atomic<uint64_t> tail{0};  // next change to publish
+    // lower bound of the sequence number being published, `idle` otherwise
+    std::atomic<uint64_t> active_seq{idle};
+  };
+
+  struct alignas(CACHELINE_SIZE) Stripe {
+    std::atomic<bool> locked{false};
+  };
+
+ public:
+  ChangeLog(rcu_domain_t& rcu, size_t ring_size)
+      : rcu(rcu),
+        worker_n(rcu.worker_n),
+        ring_mask(ring_size - 1),
+        rings(new Ring[worker_n]),
+        stripes(new Stripe[stripe_n]) {
+    INVARIANT(ring_size > 0 && (ring_size & ring_mask) == 0);
+    for (size_t w_i = 0; w_i < worker_n; w_i++) {
+      rings[w_i].changes = std::make_unique<change_t[]>(ring_size);
+    }
+  }
+  ChangeLog(const ChangeLog&) = delete;
+  ChangeLog& operator=(const ChangeLog&) = delete;
+
+  /// sequence number of the next change. a scan started afterwards contains
+  /// every change with a smaller number
+  uint64_t next_seq() const { return seq_counter.load(); }
+
+  /// appends the changes with all smaller sequence numbers published, in
+  /// sequence order, and returns how many were appended. single consumer only
+  size_t consume(std::vector<change_t>& out) {
+    uint64_t watermark = seq_counter.load();
+    for (size_t w_i = 0; w_i < worker_n; w_i++) {
+      watermark = std::min(watermark, rings[w_i].active_seq.load());
+    }
+
+    for (size_t w_i = 0; w_i < worker_n; w_i++) {
+      Ring& ring = rings[w_i];
+      uint64_t head = ring.head.load(std::memory_order_relaxed);
+      uint64_t tail = ring.tail.load(std::memory_order_acquire);
+      for (; head != tail; head++) {
+        pending.push_back(ring.changes[head & ring_mask]);
+      }
+      ring.head.store(head, std::memory_order_release);
+    }
+
+    std::sort(pending.begin(), pending.end(),
+              [](const change_t& a, const change_t& b) {
+                return a.seq < b.seq;
+              });
+    size_t ready_n = 0;
+    while (ready_n < pending.size() && pending[ready_n].seq < watermark) {
+      ready_n++;
+    }
+    out.insert(out.end(), pending.begin(), pending.begin() + ready_n);
+    pending.erase(pending.begin(), pending.begin() + ready_n);
+    return ready_n;
+  }
+
+  // serialize the writes of one key, see the class comment
+  void lock(const key_t& key, const uint32_t worker_id) {
+    lock_stripe(stripe_of(key), worker_id);
+  }
+  void unlock(const key_t& key) { unlock_stripe(stripe_of(key)); }
+  // the stripes of several keys, always in ascending order
+  void lock(const std::vector<size_t>& stripe_ids, const uint32_t worker_id) {
+    for (size_t stripe_i : stripe_ids) {
+      lock_stripe(stripe_i, worker_id);
+    }
+  }
+  void unlock(const std::vector<size_t>& stripe_ids) {
+    for (size_t stripe_i : stripe_ids) {
+      unlock_stripe(stripe_i);
+    }
+  }
+  void stripes_of(const std::vector<key_t>& keys,
+                  std::vector<size_t>& stripe_ids) const {
+    stripe_ids.clear();
+    for (const key_t& key : keys) {
+      stripe_ids.push_back(stripe_of(key));
+    }
+    std::sort(stripe_ids.begin(), stripe_ids.end());
+    stripe_ids.erase(std::unique(stripe_ids.begin(), stripe_ids.end()),
+                     stripe_ids.end());
+  }
+  void all_stripes(std::vector<size_t>& stripe_ids) const {
+    stripe_ids.resize(stripe_n);
+    for (size_t stripe_i = 0; stripe_i < stripe_n; stripe_i++) {
+      stripe_ids[stripe_i] = stripe_i;
+    }
+  }
+
+  /// records changes that were applied while holding the lock of their keys,
+  /// several changes get consecutive sequence numbers
+  void append(const uint32_t worker_id, const change_t* changes, size_t n) {
+    INVARIANT(worker_id < worker_n);
+    Ring& ring = rings[worker_id];
+    ring.active_seq.store(seq_counter.load());
+    uint64_t seq = seq_counter.fetch_add(n);
+
+    uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+    for (size_t change_i = 0; change_i < n; change_i++, tail++) {
+      // wait for the consumer when the ring is full
+      while (tail - ring.head.load(std::memory_order_acquire) > ring_mask)
+        ;
+      change_t& change = ring.changes[tail & ring_mask];
+      change = changes[change_i];
+      change.seq = seq + change_i;
+      ring.tail.store(tail + 1, std::memory_order_release);
+    }
+    ring.active_seq.store(idle);
+  }
+
+  /// computes the in memory size in bytes
+  _::ByteSize byte_size() const {
+    size_t size = sizeof(ChangeLog) + worker_n * sizeof(Ring) +
+                  stripe_n * sizeof(Stripe) +
+                  (worker_n * (ring_mask + 1) + pending.capacity()) *
+                      sizeof(change_t);
+    return {.allocated = size, .used = size};
+  }
+
+ private:
+  static size_t stripe_of(const key_t& key) {
+    return (key_hash(key) >> 32) % stripe_n;
+  }
+
+  // stripes are taken before touching the index, so a waiting worker must
+  // not hold up the rcu_barrier of the stripe's owner
+  void lock_stripe(size_t stripe_i, const uint32_t worker_id) {
+    std::atomic<bool>& locked = stripes[stripe_i].locked;
+    if (!locked.exchange(true, std::memory_order_acquire)) {
+      return;
+    }
+    rcu.status[worker_id].waiting = true;
+    while (locked.exchange(true, std::memory_order_acquire))
+      ;
+    rcu.status[worker_id].waiting = false;
+  }
+  void unlock_stripe(size_t stripe_i) {
+    stripes[stripe_i].locked.store(false, std::memory_order_release);
+  }
+
+  rcu_domain_t& rcu;
+  size_t worker_n;
+  uint64_t ring_mask;
+  std::unique_ptr<Ring[]> rings;
+  std::unique_ptr<Stripe[]> stripes;
+  std::atomic<uint64_t> seq_counter{0};
+  std::vector<change_t> pending;  // consumed but not yet in order
+};
+
+}  // namespace xindex
+
+#endif  // XINDEX_CHANGE_LOG_H
@@ -0,0 +1,111 @@
+/*
+ * The code is part of the XIndex project.
+ *
+ *    Copyright (C) 2020 Institute of Parallel and Distributed Systems (IPADS),
+ * Shanghai Jiao Tong University. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For more about XIndex, visit:
+ *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "helper.h"
+
+#if !defined(XINDEX_EXPORT_H)
+#define XINDEX_EXPORT_H
+
+namespace xindex {
+
+// bytes a RegionWriter collects before writing them out
+const size_t export_write_size = 1 << 20;
+
+/// creates a file in SOSD layout, a 64-bit record count followed by
+/// record_n records of record_size bytes, and returns its descriptor or -1.
+/// the records are left to be filled in by RegionWriters
+int export_create(const std::string& path, uint64_t record_n,
+                  size_t record_size) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return -1;
+  }
+  if (ftruncate(fd, sizeof(uint64_t) + record_n * record_size) != 0 ||
+      pwrite(fd, &record_n, sizeof(uint64_t), 0) != sizeof(uint64_t)) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+/// fills the file region [offset, offset + capacity) with large positional
+/// writes, so that several writers can fill disjoint regions of one file in
+/// parallel. appends beyond the capacity are dropped and make the writer fail
+class RegionWriter {
+ public:
+  RegionWriter(int fd, size_t offset, size_t capacity)
+      : fd(fd), offset(offset), end(offset + capacity) {}
+  ~RegionWriter() { flush(); }
+
+  inline void append(const void* rec, size_t len) {
+    if (offset + buf_n + len > end) {
+      failed = true;
+      return;
+    }
+    if (buf_n + len > export_write_size) {
+      flush();
+    }
+    if (buf == nullptr) {
+      buf.reset(new char[export_write_size]);
+    }
+    memcpy(buf.get() + buf_n, rec, len);
+    buf_n += len;
+  }
+
+  void flush() {
+    size_t written = 0;
+    while (written < buf_n && !failed) {
+      ssize_t ret = pwrite(fd, buf.get() + written, buf_n - written, offset);
+      if (ret <= 0) {
+        failed = true;
+        break;
+      }
+      written += ret;
+      offset += ret;
+    }
+    buf_n = 0;
+  }
+
+  /// whether all appends fit and were written, and the region is full
+  bool done() {
+    flush();
+    return !failed && offset == end;
+  }
+
+ private:
+  int fd;
+  size_t offset, end;
+  std::unique_ptr<char[]> buf;
+  size_t buf_n = 0;
+  bool failed = false;
+};
+
+}  // namespace xindex
+
+#endif  // XINDEX_EXPORT_H
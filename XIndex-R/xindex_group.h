@@ -20,9 +20,15 @@
  *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
  */
 
+#include <optional>
+#include <type_traits>
+
 #include "byte_size.hpp"
 #include "xindex_buffer.h"
 #include "xindex_model.h"
+#include "xindex_shape.h"
+#include "xindex_simd.h"
+#include "xindex_tier.h"
 #include "xindex_util.h"
 
 #if !defined(XINDEX_GROUP_H)
@@ -30,7 +36,8 @@
 
 namespace xindex {
 
-template <class key_t, class val_t, bool seq, size_t max_model_n = 4>
+template <class key_t, class val_t, bool seq, bool multi,
+          size_t max_model_n = 4>
 class alignas(CACHELINE_SIZE) Group {
   struct ModelInfo;
 
@@ -38,14 +45,23 @@ class alignas(CACHELINE_SIZE) Group {
   typedef ModelInfo model_info_t;
   typedef AtomicVal<val_t> atomic_val_t;
   typedef atomic_val_t wrapped_val_t;
-  typedef AltBtreeBuffer<key_t, val_t> buffer_t;
+  // in multimap mode buffer keys carry a sequence number to hold duplicates
+  typedef typename std::conditional<multi, DupKey<key_t>, key_t>::type
+      buf_key_t;
+  typedef AltBtreeBuffer<buf_key_t, val_t> buffer_t;
   typedef uint64_t version_t;
-  typedef std::pair<key_t, wrapped_val_t> record_t;
+  typedef ArrayKeys<key_t> array_keys_t;
+  typedef std::pair<typename array_keys_t::stored_t, wrapped_val_t> record_t;
+  static_assert(!seq || !array_keys_t::compressed,
+                "sequential insertion appends to the array, whose keys are "
+                "then not compressed");
 
-  template <class key_tt, class val_tt, bool sequential>
+  template <class key_tt, class val_tt, bool sequential, bool multimap>
   friend class XIndex;
-  template <class key_tt, class val_tt, bool sequential>
+  template <class key_tt, class val_tt, bool sequential, bool multimap>
   friend class Root;
+  template <class group_tt>
+  friend class PointHints;
 
   struct ModelInfo {
     key_t pivot;
@@ -57,26 +73,30 @@ class alignas(CACHELINE_SIZE) Group {
   };
 
   struct ArrayDataSource {
-    ArrayDataSource(record_t* data, uint32_t array_size, uint32_t pos);
+    ArrayDataSource(record_t* data, const array_keys_t& keys,
+                    group_size_t array_size, group_size_t pos);
     void advance_to_next_valid();
     const key_t& get_key();
     const val_t& get_val();
 
-    uint32_t array_size, pos;
+    group_size_t array_size, pos;
     record_t* data;
+    array_keys_t keys;
     bool has_next;
     key_t next_key;
     val_t next_val;
   };
 
   struct ArrayRefSource {
-    ArrayRefSource(record_t* data, uint32_t array_size);
+    ArrayRefSource(record_t* data, const array_keys_t& keys,
+                   group_size_t array_size);
     void advance_to_next_valid();
     const key_t& get_key();
     atomic_val_t& get_val();
 
-    uint32_t array_size, pos;
+    group_size_t array_size, pos;
     record_t* data;
+    array_keys_t keys;
     bool has_next;
     key_t next_key;
     atomic_val_t* next_val_ptr;
@@ -84,27 +104,53 @@ class alignas(CACHELINE_SIZE) Group {
 
  public:
   ~Group();
-  void init(const typename std::vector<key_t>::const_iterator& keys_begin,
-            const typename std::vector<val_t>::const_iterator& vals_begin,
-            uint32_t array_size);
-  void init(const typename std::vector<key_t>::const_iterator& keys_begin,
-            const typename std::vector<val_t>::const_iterator& vals_begin,
-            uint32_t model_n, uint32_t array_size);
+  template <class key_iter_t, class val_iter_t>
+  void init(const key_iter_t& keys_begin, const val_iter_t& vals_begin,
+            group_size_t array_size);
+  template <class key_iter_t, class val_iter_t>
+  void init(const key_iter_t& keys_begin, const val_iter_t& vals_begin,
+            uint32_t model_n, group_size_t array_size);
+  /// defers building the array and models to the first access, so the source
+  /// records must stay valid until the group is materialized
+  void init_lazy(const key_t* keys_begin, const val_t* vals_begin,
+                 group_size_t array_size);
+  /// builds a lazily initialized group, concurrent callers wait for the first
+  inline void materialize();
+  inline bool materialized() const;
   const key_t& get_pivot();
 
   inline result_t get(const key_t& key, val_t& val);
+  inline result_t get(const key_t& key, val_t& val, version_t& version);
+  /// additionally reports the array record, or nullptr if in a buffer
+  inline result_t get_n_locate(const key_t& key, val_t& val,
+                               record_t*& record);
+  /// reads record if it holds key and is not removed
+  inline bool get_at(const key_t& key, val_t& val, record_t* record);
   inline result_t put(const key_t& key, const val_t& val,
                       const uint32_t worker_id);
   inline result_t remove(const key_t& key);
+  inline void prefetch(const key_t& key);
+  inline size_t equal_range(const key_t& key, std::vector<val_t>& vals);
+  inline size_t remove_range(const key_t& begin, const key_t& end);
   inline size_t scan(const key_t& begin, const size_t n,
                      std::vector<std::pair<key_t, val_t>>& result);
   inline size_t range_scan(const key_t& begin, const key_t& end,
                            std::vector<std::pair<key_t, val_t>>& result);
+  /// collects every record of the group in key order, key_t::max() included
+  inline size_t scan_all(std::vector<std::pair<key_t, val_t>>& result);
+  /// visits the records of ranges[range_i..range_n) that lie in the group,
+  /// continuing the cursors from one range to the next. returns the first
+  /// range that may continue in the following groups
+  template <class visit_t>
+  size_t multi_range_scan(const std::pair<key_t, key_t>* ranges,
+                          size_t range_n, size_t range_i, visit_t& visit,
+                          size_t& visited_n);
 
   double mean_error_est();
   Group* split_model();
   Group* merge_model();
-  Group* split_group_pt1();
+  bool get_split_pivot(key_t& split_pivot) const;
+  Group* split_group_pt1(const key_t& split_pivot);
   Group* split_group_pt2();
   Group* merge_group(Group& next_group);
   Group* compact_phase_1();
@@ -113,24 +159,43 @@ class alignas(CACHELINE_SIZE) Group {
   void free_data();
   void free_buffer();
   void free_buffer_temp();
+  void free_unlinked();
+
+  /// moves a cold array to a segment file and a hot one back to memory.
+  /// only called by force_adjustment_sync, while no worker accesses the group
+  void adjust_tier();
 
   /// computes the in memory size in bytes
   _::ByteSize byte_size() const;
+  /// adds the statistics of the group and the errors of its models to shape
+  void collect_shape(size_t group_i, IndexShape<key_t>& shape);
 
  private:
+  enum class InitState : uint8_t { ready, lazy, materializing };
+
+  void materialize_slow();
   inline size_t locate_model(const key_t& key);
+  inline void sample_access();
+  inline void note_array_write();
+  inline void count_expired(const val_t& val);
+  inline bool expired_dense() const;
+  void tier_out();
+  void tier_in();
 
   inline bool get_from_array(const key_t& key, val_t& val);
   inline result_t update_to_array(const key_t& key, const val_t& val,
                                   const uint32_t worker_id);
   inline bool remove_from_array(const key_t& key);
 
+  inline typename array_keys_t::load_t key_at(size_t pos) const;
   inline size_t get_pos_from_array(const key_t& key);
   inline size_t binary_search_key(const key_t& key, size_t pos_hint,
                                   size_t search_begin, size_t search_end);
   inline size_t exponential_search_key(const key_t& key, size_t pos_hint) const;
   inline size_t exponential_search_key(record_t* const data,
-                                       uint32_t array_size, const key_t& key,
+                                       const array_keys_t& keys,
+                                       group_size_t array_size,
+                                       const key_t& key,
                                        size_t pos_hint) const;
 
   inline bool get_from_buffer(const key_t& key, val_t& val, buffer_t* buffer);
@@ -139,23 +204,41 @@ class alignas(CACHELINE_SIZE) Group {
   inline void insert_to_buffer(const key_t& key, const val_t& val,
                                buffer_t* buffer);
   inline bool remove_from_buffer(const key_t& key, buffer_t* buffer);
+  inline void equal_range_from_buffer(const key_t& key,
+                                      std::vector<val_t>& vals,
+                                      buffer_t* buffer);
+  inline size_t remove_range_from_buffer(const key_t& begin, const key_t& end,
+                                         buffer_t* buffer);
+  static inline buf_key_t to_buf_key(const key_t& key);
+  static inline const key_t& from_buf_key(const buf_key_t& buf_key);
 
   void init_models(uint32_t model_n);
   inline double train_model(size_t model_i, size_t begin, size_t end);
+  inline void get_training_set(size_t begin, size_t end,
+                               std::vector<key_t>& keys,
+                               std::vector<size_t>& positions) const;
 
-  inline void merge_refs(record_t*& new_data, uint32_t& new_array_size,
-                         int32_t& new_capacity) const;
+  inline void merge_refs(record_t*& new_data, array_keys_t& new_keys,
+                         group_size_t& new_array_size,
+                         group_ssize_t& new_capacity) const;
   inline void merge_refs_n_split(record_t*& new_data_1,
-                                 uint32_t& new_array_size_1,
-                                 int32_t& new_capacity_1, record_t*& new_data_2,
-                                 uint32_t& new_array_size_2,
-                                 int32_t& new_capacity_2,
+                                 array_keys_t& new_keys_1,
+                                 group_size_t& new_array_size_1,
+                                 group_ssize_t& new_capacity_1,
+                                 record_t*& new_data_2,
+                                 array_keys_t& new_keys_2,
+                                 group_size_t& new_array_size_2,
+                                 group_ssize_t& new_capacity_2,
                                  const key_t& key) const;
   inline void merge_refs_with(const Group& next_group, record_t*& new_data,
-                              uint32_t& new_array_size,
-                              int32_t& new_capacity) const;
-  inline void merge_refs_internal(record_t* new_data,
-                                  uint32_t& new_array_size) const;
+                              array_keys_t& new_keys,
+                              group_size_t& new_array_size,
+                              group_ssize_t& new_capacity) const;
+  inline void merge_refs_internal(record_t* new_data, array_keys_t& new_keys,
+                                  group_size_t& new_array_size) const;
+  // storage for the keys merged from the array and buffer, and from those of
+  // next_group if given
+  array_keys_t merged_keys(const Group* next_group, size_t key_n) const;
   inline size_t scan_2_way(const key_t& begin, const size_t n, const key_t& end,
                            std::vector<std::pair<key_t, val_t>>& result);
   inline size_t scan_3_way(const key_t& begin, const size_t n, const key_t& end,
@@ -168,17 +251,26 @@ class alignas(CACHELINE_SIZE) Group {
   key_t pivot;
   // make array_size atomic because we don't want to acquire lock during `get`.
   // it is okay to obtain a stale (smaller) array_size during `get`.
-  uint32_t array_size;
+  group_size_t array_size;
   uint16_t model_n = 0;
   bool buf_frozen = false;
   Group* next = nullptr;
   std::array<model_info_t, max_model_n> models;
   record_t* data = nullptr;
+  array_keys_t array_keys;  // of data, shared along with it
   buffer_t* buffer = nullptr;
   buffer_t* buffer_temp = nullptr;
   double mean_error;
-  int32_t capacity = 0;       // used for seqential insertion
+  group_ssize_t capacity = 0;       // used for seqential insertion
   volatile uint8_t lock = 0;  // used for seqential insertion
+  bool tiered = false;        // data is mapped from a segment file
+  uint8_t cold_pass_n = 0;    // adjustment passes the group was cold in
+  std::atomic<uint32_t> access_n{0};  // sampled while tiering is enabled
+  std::atomic<bool> array_written{false};  // in place while tiered
+  uint32_t expired_n = 0;  // gets that hit expired records, racy increments
+  std::atomic<InitState> init_state{InitState::ready};
+  const key_t* lazy_keys = nullptr;  // source records until materialized
+  const val_t* lazy_vals = nullptr;
 
 #ifdef DEBUGGING
   // used to ignore first group's pivot value (which should be considered zero)
@@ -28,26 +28,26 @@
 
 namespace xindex {
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-Group<key_t, val_t, seq, max_model_n>::~Group() {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+Group<key_t, val_t, seq, multi, max_model_n>::~Group() {
   free_data();
   free_buffer();
   free_buffer_temp();
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-void Group<key_t, val_t, seq, max_model_n>::init(
-    const typename std::vector<key_t>::const_iterator& keys_begin,
-    const typename std::vector<val_t>::const_iterator& vals_begin,
-    uint32_t array_size) {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+template <class key_iter_t, class val_iter_t>
+void Group<key_t, val_t, seq, multi, max_model_n>::init(
+    const key_iter_t& keys_begin, const val_iter_t& vals_begin,
+    group_size_t array_size) {
   init(keys_begin, vals_begin, 1, array_size);
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-void Group<key_t, val_t, seq, max_model_n>::init(
-    const typename std::vector<key_t>::const_iterator& keys_begin,
-    const typename std::vector<val_t>::const_iterator& vals_begin,
-    uint32_t model_n, uint32_t array_size) {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+template <class key_iter_t, class val_iter_t>
+void Group<key_t, val_t, seq, multi, max_model_n>::init(
+    const key_iter_t& keys_begin, const val_iter_t& vals_begin,
+    uint32_t model_n, group_size_t array_size) {
   assert(array_size > 0);
   this->pivot = *keys_begin;
   this->array_size = array_size;
@@ -58,26 +58,71 @@ void Group<key_t, val_t, seq, max_model_n>::init(
   buffer = new buffer_t();
   _::allocated_bytes += sizeof(buffer_t);
 
+  array_keys =
+      array_keys_t(*keys_begin, *(keys_begin + array_size - 1), array_size);
   for (size_t rec_i = 0; rec_i < array_size; rec_i++) {
-    data[rec_i].first = *(keys_begin + rec_i);
+    data[rec_i].first = array_keys.store(*(keys_begin + rec_i));
     data[rec_i].second = wrapped_val_t(*(vals_begin + rec_i));
   }
+  array_keys.seal();
 
   for (size_t rec_i = 1; rec_i < array_size; rec_i++) {
-    assert(data[rec_i].first >= data[rec_i - 1].first);
+    assert(key_at(rec_i) >= key_at(rec_i - 1));
   }
 
   init_models(model_n);
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-const key_t& Group<key_t, val_t, seq, max_model_n>::get_pivot() {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+void Group<key_t, val_t, seq, multi, max_model_n>::init_lazy(
+    const key_t* keys_begin, const val_t* vals_begin, group_size_t array_size) {
+  assert(array_size > 0);
+  this->pivot = *keys_begin;
+  this->array_size = array_size;
+  lazy_keys = keys_begin;
+  lazy_vals = vals_begin;
+  init_state.store(InitState::lazy, std::memory_order_release);
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline void Group<key_t, val_t, seq, multi, max_model_n>::materialize() {
+  if (likely(materialized())) {
+    return;
+  }
+  materialize_slow();
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline bool Group<key_t, val_t, seq, multi, max_model_n>::materialized()
+    const {
+  return init_state.load(std::memory_order_acquire) == InitState::ready;
+}
+
+// semantics: the first caller builds the group, the others spin until it is
+// published. building does not wait for other workers, so the wait is bounded
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+void Group<key_t, val_t, seq, multi, max_model_n>::materialize_slow() {
+  InitState expected = InitState::lazy;
+  if (init_state.compare_exchange_strong(expected, InitState::materializing)) {
+    init(lazy_keys, lazy_vals, array_size);
+    lazy_keys = nullptr;
+    lazy_vals = nullptr;
+    init_state.store(InitState::ready, std::memory_order_release);
+    return;
+  }
+  while (!materialized())
+    ;
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+const key_t& Group<key_t, val_t, seq, multi, max_model_n>::get_pivot() {
   return pivot;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline result_t Group<key_t, val_t, seq, max_model_n>::get(const key_t& key,
-                                                           val_t& val) {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline result_t Group<key_t, val_t, seq, multi, max_model_n>::get(
+    const key_t& key, val_t& val) {
+  sample_access();
   if (get_from_array(key, val)) {
     return result_t::ok;
   }
@@ -90,16 +135,71 @@ inline result_t Group<key_t, val_t, seq, max_model_n>::get(const key_t& key,
   return result_t::failed;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline result_t Group<key_t, val_t, seq, max_model_n>::put(
+// semantics: additionally report the version of the record that decides the
+// result (0 if there is none), so that reads of several keys can be validated
+// against batch writes
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline result_t Group<key_t, val_t, seq, multi, max_model_n>::get(
+    const key_t& key, val_t& val, version_t& version) {
+  assert(!multi);
+  version = 0;
+  size_t pos = get_pos_from_array(key);
+  if (pos != array_size && key_at(pos) == key &&
+      data[pos].second.read(val, version)) {
+    return result_t::ok;
+  }
+  if (buffer->get(key, val, version)) {
+    return result_t::ok;
+  }
+  if (buffer_temp && buffer_temp->get(key, val, version)) {
+    return result_t::ok;
+  }
+  return result_t::failed;
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline result_t Group<key_t, val_t, seq, multi, max_model_n>::get_n_locate(
+    const key_t& key, val_t& val, record_t*& record) {
+  assert(!multi);
+  sample_access();
+  size_t pos = get_pos_from_array(key);
+  if (pos != array_size && key_at(pos) == key) {
+    if (data[pos].second.read(val)) {
+      record = data + pos;
+      return result_t::ok;
+    }
+    count_expired(val);
+  }
+  record = nullptr;
+  if (get_from_buffer(key, val, buffer)) {
+    return result_t::ok;
+  }
+  if (buffer_temp && get_from_buffer(key, val, buffer_temp)) {
+    return result_t::ok;
+  }
+  return result_t::failed;
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline bool Group<key_t, val_t, seq, multi, max_model_n>::get_at(
+    const key_t& key, val_t& val, record_t* record) {
+  sample_access();
+  return array_keys.load(record->first) == key && record->second.read(val);
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline result_t Group<key_t, val_t, seq, multi, max_model_n>::put(
     const key_t& key, const val_t& val, const uint32_t worker_id) {
 #ifdef DEBUGGING
   assert(is_first || key >= pivot);
 #endif
-  result_t res;
-  res = update_to_array(key, val, worker_id);
-  if (res == result_t::ok || res == result_t::retry) {
-    return res;
+  sample_access();
+  // in multimap mode every put adds a new occurrence of the key
+  if (!multi) {
+    result_t res = update_to_array(key, val, worker_id);
+    if (res == result_t::ok || res == result_t::retry) {
+      return res;
+    }
   }
 
   if (likely(buffer_temp == nullptr)) {
@@ -109,7 +209,7 @@ inline result_t Group<key_t, val_t, seq, max_model_n>::put(
     insert_to_buffer(key, val, buffer);
     return result_t::ok;
   } else {
-    if (update_to_buffer(key, val, buffer)) {
+    if (!multi && update_to_buffer(key, val, buffer)) {
       return result_t::ok;
     }
     insert_to_buffer(key, val, buffer_temp);
@@ -118,9 +218,17 @@ inline result_t Group<key_t, val_t, seq, max_model_n>::put(
   COUT_N_EXIT("put should not fail!");
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline result_t Group<key_t, val_t, seq, max_model_n>::remove(
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline result_t Group<key_t, val_t, seq, multi, max_model_n>::remove(
     const key_t& key) {
+  sample_access();
+  if (multi) {  // remove all occurrences
+    bool removed = remove_from_array(key);
+    removed = remove_from_buffer(key, buffer) || removed;
+    removed = (buffer_temp && remove_from_buffer(key, buffer_temp)) || removed;
+    return removed ? result_t::ok : result_t::failed;
+  }
+
   if (remove_from_array(key)) {
     return result_t::ok;
   }
@@ -133,16 +241,78 @@ inline result_t Group<key_t, val_t, seq, max_model_n>::remove(
   return result_t::failed;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline size_t Group<key_t, val_t, seq, max_model_n>::scan(
+// semantics: collect the values of all not-removed occurrences of the key,
+// those in the array first. without multimap mode at most one is found
+// semantics: prefetch the predicted position of the key, without searching
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline void Group<key_t, val_t, seq, multi, max_model_n>::prefetch(
+    const key_t& key) {
+  if (array_size == 0) {
+    return;
+  }
+  size_t pos = models[locate_model(key)].model.predict(key);
+  __builtin_prefetch(&data[std::min(pos, (size_t)array_size - 1)]);
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline size_t Group<key_t, val_t, seq, multi, max_model_n>::equal_range(
+    const key_t& key, std::vector<val_t>& vals) {
+  size_t old_size = vals.size();
+  if (!multi) {
+    val_t val;
+    if (get(key, val) == result_t::ok) {
+      vals.push_back(val);
+    }
+    return vals.size() - old_size;
+  }
+
+  for (size_t pos = get_pos_from_array(key);
+       pos < array_size && key_at(pos) == key; pos++) {
+    val_t val;
+    if (data[pos].second.read(val)) {
+      vals.push_back(val);
+    }
+  }
+  equal_range_from_buffer(key, vals, buffer);
+  if (buffer_temp) {
+    equal_range_from_buffer(key, vals, buffer_temp);
+  }
+  return vals.size() - old_size;
+}
+
+// semantics: logically remove all records in [begin, end), those in the array
+// are marked in place. returns the number of records removed
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline size_t Group<key_t, val_t, seq, multi, max_model_n>::remove_range(
+    const key_t& begin, const key_t& end) {
+  size_t removed_n = 0;
+  for (size_t pos = get_pos_from_array(begin);
+       pos < array_size && key_at(pos) < end; pos++) {
+    if (data[pos].second.remove()) {
+      removed_n++;
+    }
+  }
+  if (removed_n > 0) {
+    note_array_write();
+  }
+  removed_n += remove_range_from_buffer(begin, end, buffer);
+  if (buffer_temp) {
+    removed_n += remove_range_from_buffer(begin, end, buffer_temp);
+  }
+  return removed_n;
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline size_t Group<key_t, val_t, seq, multi, max_model_n>::scan(
     const key_t& begin, const size_t n,
     std::vector<std::pair<key_t, val_t>>& result) {
+  sample_access();
   return buffer_temp ? scan_3_way(begin, n, key_t::max(), result)
                      : scan_2_way(begin, n, key_t::max(), result);
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline size_t Group<key_t, val_t, seq, max_model_n>::range_scan(
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline size_t Group<key_t, val_t, seq, multi, max_model_n>::range_scan(
     const key_t& begin, const key_t& end,
     std::vector<std::pair<key_t, val_t>>& result) {
   size_t old_size = result.size();
@@ -154,24 +324,127 @@ inline size_t Group<key_t, val_t, seq, max_model_n>::range_scan(
   return result.size() - old_size;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-double Group<key_t, val_t, seq, max_model_n>::mean_error_est() {
+// semantics: range scans end before their end key, so records of
+// key_t::max() are appended by a separate lookup
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline size_t Group<key_t, val_t, seq, multi, max_model_n>::scan_all(
+    std::vector<std::pair<key_t, val_t>>& result) {
+  size_t old_size = result.size();
+  range_scan(key_t::min(), key_t::max(), result);
+  std::vector<val_t> vals;
+  equal_range(key_t::max(), vals);
+  for (const val_t& val : vals) {
+    result.push_back(std::pair<key_t, val_t>(key_t::max(), val));
+  }
+  return result.size() - old_size;
+}
+
+// semantics: the ranges are sorted and disjoint. the array cursor moves to the
+// next range by an exponential search from its current position, and the
+// buffer cursors by skipping, so a dense list of ranges costs about as much as
+// one scan over the group
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+template <class visit_t>
+size_t Group<key_t, val_t, seq, multi, max_model_n>::multi_range_scan(
+    const std::pair<key_t, key_t>* ranges, size_t range_n, size_t range_i,
+    visit_t& visit, size_t& visited_n) {
+  typedef typename buffer_t::DataSource buffer_source_t;
+
+  sample_access();
+  const key_t& first_begin = ranges[range_i].first;
+  ArrayDataSource array_source(data, array_keys, array_size,
+                               get_pos_from_array(first_begin));
+  buffer_source_t buffer_source(to_buf_key(first_begin), buffer);
+  std::optional<buffer_source_t> temp_buffer_source;
+  if (buffer_temp) {
+    temp_buffer_source.emplace(to_buf_key(first_begin), buffer_temp);
+    temp_buffer_source->advance_to_next_valid();
+  }
+  array_source.advance_to_next_valid();
+  buffer_source.advance_to_next_valid();
+
+  for (; range_i < range_n; range_i++) {
+    const key_t& begin = ranges[range_i].first;
+    const key_t& end = ranges[range_i].second;
+    assert(begin <= end);
+    assert(range_i == 0 || ranges[range_i - 1].second <= begin);
+    if (range_i + 1 < range_n) {
+      prefetch(ranges[range_i + 1].first);
+    }
+
+    // move the cursors to the begin of the range
+    if (array_source.has_next && array_source.get_key() < begin) {
+      array_source.pos = exponential_search_key(begin, array_source.pos);
+      array_source.advance_to_next_valid();
+    }
+    while (buffer_source.has_next &&
+           from_buf_key(buffer_source.get_key()) < begin) {
+      buffer_source.advance_to_next_valid();
+    }
+    while (temp_buffer_source && temp_buffer_source->has_next &&
+           from_buf_key(temp_buffer_source->get_key()) < begin) {
+      temp_buffer_source->advance_to_next_valid();
+    }
+
+    // merge the cursors up to the end of the range
+    while (true) {
+      const key_t* key = nullptr;
+      const val_t* val = nullptr;
+      int source_i = -1;
+      if (array_source.has_next) {
+        key = &array_source.get_key();
+        val = &array_source.get_val();
+        source_i = 0;
+      }
+      if (buffer_source.has_next &&
+          (key == nullptr || from_buf_key(buffer_source.get_key()) < *key)) {
+        key = &from_buf_key(buffer_source.get_key());
+        val = &buffer_source.get_val();
+        source_i = 1;
+      }
+      if (temp_buffer_source && temp_buffer_source->has_next &&
+          (key == nullptr ||
+           from_buf_key(temp_buffer_source->get_key()) < *key)) {
+        key = &from_buf_key(temp_buffer_source->get_key());
+        val = &temp_buffer_source->get_val();
+        source_i = 2;
+      }
+
+      if (key == nullptr) {
+        return range_i;  // the range might continue in the next group
+      }
+      if (!(*key < end)) {
+        break;
+      }
+      visit(range_i, *key, *val);
+      visited_n++;
+      if (source_i == 0) {
+        array_source.advance_to_next_valid();
+      } else if (source_i == 1) {
+        buffer_source.advance_to_next_valid();
+      } else {
+        temp_buffer_source->advance_to_next_valid();
+      }
+    }
+  }
+  return range_i;
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+double Group<key_t, val_t, seq, multi, max_model_n>::mean_error_est() {
   // we did not disable seq op here so array_size can be changed.
   // however, we only need an estimated error
-  uint32_t array_size = this->array_size;
+  group_size_t array_size = this->array_size;
 
   size_t pos_last_pivot = get_pos_from_array(models[model_n - 1].pivot);
   assert(pos_last_pivot != array_size);
-  assert(data[pos_last_pivot].first == models[model_n - 1].pivot);
+  assert(key_at(pos_last_pivot) == models[model_n - 1].pivot);
 
   // get current last model error
   size_t model_data_size = array_size - pos_last_pivot;
-  std::vector<key_t> keys(model_data_size);
-  std::vector<size_t> positions(model_data_size);
-  for (size_t rec_i = 0; rec_i < model_data_size; rec_i++) {
-    keys[rec_i] = data[pos_last_pivot + rec_i].first;
-    positions[rec_i] = pos_last_pivot + rec_i;
-  }
+  std::vector<key_t> keys;
+  std::vector<size_t> positions;
+  get_training_set(pos_last_pivot, array_size, keys, positions);
   double error_last_model_now =
       models[model_n - 1].model.get_error_bound(keys, positions);
 
@@ -194,9 +467,9 @@ double Group<key_t, val_t, seq, max_model_n>::mean_error_est() {
   }
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-Group<key_t, val_t, seq, max_model_n>*
-Group<key_t, val_t, seq, max_model_n>::split_model() {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+Group<key_t, val_t, seq, multi, max_model_n>*
+Group<key_t, val_t, seq, multi, max_model_n>::split_model() {
   if (seq) {  // disable seq seq
     disable_seq_insert_opt();
   }
@@ -210,21 +483,24 @@ Group<key_t, val_t, seq, max_model_n>::split_model() {
   new_group->array_size = array_size;
   new_group->capacity = capacity;  // keep capacity negative for now
   new_group->data = data;
+  new_group->array_keys = array_keys;
+  new_group->tiered = tiered;
+  new_group->models = models;  // keep per-model training state
   new_group->init_models(model_n + 1);
   new_group->buffer = buffer;
   new_group->buffer_temp = buffer_temp;
   new_group->next = next;
 #ifdef DEBUGGING
   new_group->is_first = is_first;
-  assert(is_first || new_group->data[0].first >= new_group->pivot);
+  assert(is_first || new_group->key_at(0) >= new_group->pivot);
 #endif
 
   return new_group;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-Group<key_t, val_t, seq, max_model_n>*
-Group<key_t, val_t, seq, max_model_n>::merge_model() {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+Group<key_t, val_t, seq, multi, max_model_n>*
+Group<key_t, val_t, seq, multi, max_model_n>::merge_model() {
   if (seq) {  // disable seq seq
     disable_seq_insert_opt();
   }
@@ -238,6 +514,9 @@ Group<key_t, val_t, seq, max_model_n>::merge_model() {
   new_group->array_size = array_size;
   new_group->capacity = capacity;  // keep capacity negative for now
   new_group->data = data;
+  new_group->array_keys = array_keys;
+  new_group->tiered = tiered;
+  new_group->models = models;  // keep per-model training state
   new_group->init_models(model_n - 1);
   new_group->buffer = buffer;
   new_group->buffer_temp = buffer_temp;
@@ -249,9 +528,53 @@ Group<key_t, val_t, seq, max_model_n>::merge_model() {
   return new_group;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-Group<key_t, val_t, seq, max_model_n>*
-Group<key_t, val_t, seq, max_model_n>::split_group_pt1() {
+// picks the pivot of the second half for split_group_pt1: the median of the
+// records that survive merging, since removed ones (e.g., left by
+// remove_range) are dropped and can't serve as pivot. in multimap mode the
+// pivot is moved to the start of the next run, so that no run is split across
+// groups. fails when there is no live key larger than the first live one
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+bool Group<key_t, val_t, seq, multi, max_model_n>::get_split_pivot(
+    key_t& split_pivot) const {
+  size_t live_n = 0;
+  val_t val;
+  for (size_t rec_i = 0; rec_i < array_size; rec_i++) {
+    if (data[rec_i].second.read(val)) {
+      live_n++;
+    }
+  }
+  if (live_n < 2) {
+    return false;
+  }
+
+  size_t mid = 0;
+  size_t first = array_size;
+  for (size_t rec_i = 0, live_i = 0; rec_i < array_size; rec_i++) {
+    if (data[rec_i].second.read(val)) {
+      first = first == array_size ? rec_i : first;
+      if (live_i++ == live_n / 2) {
+        mid = rec_i;
+        break;
+      }
+    }
+  }
+  while (mid < array_size &&
+         (key_at(mid) == key_at(first) ||
+          (multi && key_at(mid) == key_at(mid - 1)) ||
+          !data[mid].second.read(val))) {
+    mid++;
+  }
+  if (mid == array_size) {
+    return false;
+  }
+  split_pivot = key_at(mid);
+  return true;
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+Group<key_t, val_t, seq, multi, max_model_n>*
+Group<key_t, val_t, seq, multi, max_model_n>::split_group_pt1(
+    const key_t& split_pivot) {
   if (seq) {  // disable seq seq
     disable_seq_insert_opt();
   }
@@ -262,17 +585,21 @@ Group<key_t, val_t, seq, max_model_n>::split_group_pt1() {
   _::allocated_bytes += sizeof(Group);
 
   new_group_1->pivot = pivot;
-  new_group_2->pivot = data[array_size / 2].first;
+  new_group_2->pivot = split_pivot;
 #ifdef DEBUGGING
   assert(is_first || new_group_2->pivot > new_group_1->pivot);
 #endif
   new_group_1->data = data;
   new_group_2->data = data;
+  new_group_1->array_keys = array_keys;
+  new_group_2->array_keys = array_keys;
   new_group_1->array_size = array_size;
   new_group_2->array_size = array_size;
   // mark capacity as negative to let seq insert not inserting to buf
   new_group_1->capacity = capacity;
   new_group_2->capacity = capacity;
+  new_group_1->models = models;  // keep per-model training state
+  new_group_2->models = models;
   new_group_1->init_models((model_n + 1) / 2);
   new_group_2->init_models((model_n + 1) / 2);
   new_group_1->buf_frozen = true;
@@ -287,15 +614,15 @@ Group<key_t, val_t, seq, max_model_n>::split_group_pt1() {
   new_group_2->next = next;
 #ifdef DEBUGGING
   new_group_1->is_first = is_first;
-  assert(is_first || new_group_1->data[0].first >= new_group_1->pivot);
+  assert(is_first || new_group_1->key_at(0) >= new_group_1->pivot);
 #endif
 
   return new_group_1;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-Group<key_t, val_t, seq, max_model_n>*
-Group<key_t, val_t, seq, max_model_n>::split_group_pt2() {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+Group<key_t, val_t, seq, multi, max_model_n>*
+Group<key_t, val_t, seq, multi, max_model_n>::split_group_pt2() {
   // note that now this->data, this->buffer point to the old group's
   // and are shared with this->next
   Group* new_group_1 = new Group();
@@ -305,8 +632,9 @@ Group<key_t, val_t, seq, max_model_n>::split_group_pt2() {
 
   new_group_1->pivot = pivot;
   new_group_2->pivot = this->next->pivot;
-  merge_refs_n_split(new_group_1->data, new_group_1->array_size,
-                     new_group_1->capacity, new_group_2->data,
+  merge_refs_n_split(new_group_1->data, new_group_1->array_keys,
+                     new_group_1->array_size, new_group_1->capacity,
+                     new_group_2->data, new_group_2->array_keys,
                      new_group_2->array_size, new_group_2->capacity,
                      this->next->pivot);
   // mark capacity as negative to let seq insert not inserting to buf
@@ -314,6 +642,8 @@ Group<key_t, val_t, seq, max_model_n>::split_group_pt2() {
     new_group_1->disable_seq_insert_opt();
     new_group_2->disable_seq_insert_opt();
   }
+  new_group_1->models = models;  // keep per-model training state
+  new_group_2->models = next->models;
   new_group_1->init_models(model_n);  // model_n is reduced in pt1
   new_group_2->init_models(model_n);
   new_group_1->buffer = buffer_temp;
@@ -322,17 +652,17 @@ Group<key_t, val_t, seq, max_model_n>::split_group_pt2() {
   new_group_2->next = next->next;
 #ifdef DEBUGGING
   new_group_1->is_first = is_first;
-  assert(is_first || new_group_1->data[0].first >= new_group_1->pivot);
-  assert(new_group_2->data[0].first >= new_group_2->pivot);
+  assert(is_first || new_group_1->key_at(0) >= new_group_1->pivot);
+  assert(new_group_2->key_at(0) >= new_group_2->pivot);
 #endif
 
   return new_group_1;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-Group<key_t, val_t, seq, max_model_n>*
-Group<key_t, val_t, seq, max_model_n>::merge_group(
-    Group<key_t, val_t, seq, max_model_n>& next_group) {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+Group<key_t, val_t, seq, multi, max_model_n>*
+Group<key_t, val_t, seq, multi, max_model_n>::merge_group(
+    Group<key_t, val_t, seq, multi, max_model_n>& next_group) {
   if (seq) {  // disable seq seq
     disable_seq_insert_opt();
     next_group.disable_seq_insert_opt();
@@ -354,12 +684,13 @@ Group<key_t, val_t, seq, max_model_n>::merge_group(
   }
 
   new_group->pivot = pivot;
-  merge_refs_with(next_group, new_group->data, new_group->array_size,
-                  new_group->capacity);
+  merge_refs_with(next_group, new_group->data, new_group->array_keys,
+                  new_group->array_size, new_group->capacity);
   if (seq) {
     // mark capacity as negative to let seq insert not insert to buf
     new_group->disable_seq_insert_opt();
   }
+  new_group->models = models;  // keep per-model training state
   new_group->init_models(new_group->model_n);
   new_group->buffer = buffer_temp;
   new_group->next = next_group.next;
@@ -370,9 +701,9 @@ Group<key_t, val_t, seq, max_model_n>::merge_group(
   return new_group;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-Group<key_t, val_t, seq, max_model_n>*
-Group<key_t, val_t, seq, max_model_n>::compact_phase_1() {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+Group<key_t, val_t, seq, multi, max_model_n>*
+Group<key_t, val_t, seq, multi, max_model_n>::compact_phase_1() {
   if (seq) {  // disable seq seq
     disable_seq_insert_opt();
   }
@@ -388,10 +719,12 @@ Group<key_t, val_t, seq, max_model_n>::compact_phase_1() {
   _::allocated_bytes += sizeof(Group);
 
   new_group->pivot = pivot;
-  merge_refs(new_group->data, new_group->array_size, new_group->capacity);
+  merge_refs(new_group->data, new_group->array_keys, new_group->array_size,
+             new_group->capacity);
   if (seq) {  // mark capacity as negative to let seq insert not insert to buf
     new_group->disable_seq_insert_opt();
   }
+  new_group->models = models;  // keep per-model training state
   new_group->init_models(model_n);
   new_group->buffer = buffer_temp;
   new_group->next = next;
@@ -402,8 +735,8 @@ Group<key_t, val_t, seq, max_model_n>::compact_phase_1() {
   return new_group;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline void Group<key_t, val_t, seq, max_model_n>::compact_phase_2() {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline void Group<key_t, val_t, seq, multi, max_model_n>::compact_phase_2() {
   for (size_t rec_i = 0; rec_i < array_size; ++rec_i) {
     data[rec_i].second.replace_pointer();
   }
@@ -414,19 +747,19 @@ inline void Group<key_t, val_t, seq, max_model_n>::compact_phase_2() {
   }
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-void Group<key_t, val_t, seq, max_model_n>::free_data() {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+void Group<key_t, val_t, seq, multi, max_model_n>::free_data() {
   if (data == nullptr)
     return;
 
   const size_t bytes_to_delete = sizeof(decltype(*data)) * capacity;
-  assert(_::allocated_bytes > bytes_to_delete);
+  assert(tiered || _::allocated_bytes > bytes_to_delete);  // tiered: on disk
   // _::allocated_bytes -= bytes_to_delete;
   // delete[] data;
   data = nullptr;
 }
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-void Group<key_t, val_t, seq, max_model_n>::free_buffer() {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+void Group<key_t, val_t, seq, multi, max_model_n>::free_buffer() {
   if (buffer == nullptr)
     return;
 
@@ -439,8 +772,8 @@ void Group<key_t, val_t, seq, max_model_n>::free_buffer() {
   buffer = nullptr;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-void Group<key_t, val_t, seq, max_model_n>::free_buffer_temp() {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+void Group<key_t, val_t, seq, multi, max_model_n>::free_buffer_temp() {
   if (buffer_temp == nullptr)
     return;
 
@@ -451,8 +784,143 @@ void Group<key_t, val_t, seq, max_model_n>::free_buffer_temp() {
   buffer_temp = nullptr;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline size_t Group<key_t, val_t, seq, max_model_n>::locate_model(
+// reclaims a group that was unlinked by Root::remove_range. unlike the groups
+// replaced during adjustment, no other group shares its array or buffers, so
+// they are freed along with any out-of-line values still stored in them
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+void Group<key_t, val_t, seq, multi, max_model_n>::free_unlinked() {
+  if (ValRetire<val_t>::owns_storage) {
+    for (size_t rec_i = 0; rec_i < array_size; rec_i++) {
+      val_t val;
+      if (data[rec_i].second.read(val)) {
+        ValRetire<val_t>::retire(val);
+      }
+    }
+    for (buffer_t* buf : {buffer, buffer_temp}) {
+      if (buf == nullptr) {
+        continue;
+      }
+      typename buffer_t::DataSource source(to_buf_key(key_t::min()), buf);
+      source.advance_to_next_valid();
+      while (source.has_next) {
+        ValRetire<val_t>::retire(source.get_val());
+        source.advance_to_next_valid();
+      }
+    }
+  }
+
+  if (data != nullptr && tiered) {
+    tier_unmap(data,
+               sizeof(decltype(*data)) * (capacity < 0 ? -capacity : capacity));
+    data = nullptr;
+  } else if (data != nullptr) {
+    const size_t bytes_to_delete =
+        sizeof(decltype(*data)) * (capacity < 0 ? -capacity : capacity);
+    assert(_::allocated_bytes > bytes_to_delete);
+    _::allocated_bytes -= bytes_to_delete;
+    delete[] data;
+    data = nullptr;
+  }
+  array_keys.free();
+  if (buffer != nullptr) {
+    const size_t bytes_to_delete = sizeof(decltype(*buffer));
+    assert(_::allocated_bytes >= bytes_to_delete);
+    _::allocated_bytes -= bytes_to_delete;
+    delete buffer;
+    buffer = nullptr;
+  }
+  free_buffer_temp();
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+void Group<key_t, val_t, seq, multi, max_model_n>::adjust_tier() {
+  size_t sampled_n = access_n.exchange(0, std::memory_order_relaxed);
+  if (tiered) {
+    // a write to the array or buffer, or frequent access makes the group hot
+    if (sampled_n >= config.tier_hot_access_n || buffer->size() > 0 ||
+        array_written.load(std::memory_order_relaxed)) {
+      tier_in();
+    }
+    return;
+  }
+
+  if (sampled_n > config.tier_cold_access_n || buffer->size() > 0 ||
+      buffer_temp != nullptr) {
+    cold_pass_n = 0;
+  } else if (++cold_pass_n >= tier_cold_pass_n) {
+    tier_out();
+  }
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+void Group<key_t, val_t, seq, multi, max_model_n>::tier_out() {
+  const size_t bytes =
+      sizeof(record_t) * (capacity < 0 ? -capacity : capacity);
+  record_t* mapped = (record_t*)tier_map(data, bytes);
+  if (mapped == nullptr) {
+    return;  // keep the array in memory, e.g., when the disk is full
+  }
+  record_t* old_data = data;
+  data = mapped;
+  tiered = true;
+  cold_pass_n = 0;
+
+  assert(_::allocated_bytes >= bytes);
+  _::allocated_bytes -= bytes;
+  delete[] old_data;
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+void Group<key_t, val_t, seq, multi, max_model_n>::tier_in() {
+  const size_t capacity_n = capacity < 0 ? -capacity : capacity;
+  record_t* new_data = new record_t[capacity_n]();
+  _::allocated_bytes += sizeof(record_t) * capacity_n;
+  memcpy((void*)new_data, (void*)data, sizeof(record_t) * capacity_n);
+  tier_unmap(data, sizeof(record_t) * capacity_n);
+  data = new_data;
+  tiered = false;
+  array_written.store(false, std::memory_order_relaxed);
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline void Group<key_t, val_t, seq, multi, max_model_n>::sample_access() {
+  if (config.tier_dir.empty()) {
+    return;  // only tiering reads the samples
+  }
+  static thread_local uint32_t access_i = 0;
+  if (++access_i % tier_access_sample_rate == 0) {
+    access_n.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+// in-place writes to a tiered array dirty its segment file, so they make the
+// group hot like writes to its buffer
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline void Group<key_t, val_t, seq, multi, max_model_n>::note_array_write() {
+  if (tiered && !array_written.load(std::memory_order_relaxed)) {
+    array_written.store(true, std::memory_order_relaxed);
+  }
+}
+
+// a failed read still returns the value, so expired records can be told
+// apart from removed ones
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline void Group<key_t, val_t, seq, multi, max_model_n>::count_expired(
+    const val_t& val) {
+  if (ValExpiry<val_t>::can_expire && ValExpiry<val_t>::expired(val)) {
+    expired_n++;
+  }
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline bool Group<key_t, val_t, seq, multi, max_model_n>::expired_dense()
+    const {
+  return ValExpiry<val_t>::can_expire &&
+         expired_n > config.expired_compact_ratio * array_size;
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline size_t Group<key_t, val_t, seq, multi, max_model_n>::locate_model(
     const key_t& key) {
   assert(model_n >= 1);
 
@@ -466,35 +934,56 @@ inline size_t Group<key_t, val_t, seq, max_model_n>::locate_model(
 // semantics: atomically read the value
 // only when the key exists and the record (record_t) is not logical removed,
 // return true on success
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline bool Group<key_t, val_t, seq, max_model_n>::get_from_array(
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline bool Group<key_t, val_t, seq, multi, max_model_n>::get_from_array(
     const key_t& key, val_t& val) {
   size_t pos = get_pos_from_array(key);
-  return pos != array_size &&         // position is valid (not out-of-range)
-         data[pos].first == key &&    // key matches
-         data[pos].second.read(val);  // value is not removed
+  if (multi) {  // the first not-removed occurrence
+    for (; pos < array_size && key_at(pos) == key; pos++) {
+      if (data[pos].second.read(val)) {
+        return true;
+      }
+      count_expired(val);
+    }
+    return false;
+  }
+  if (pos == array_size ||  // position is invalid (out-of-range)
+      key_at(pos) != key) {
+    return false;
+  }
+  if (data[pos].second.read(val)) {  // value is not removed
+    return true;
+  }
+  count_expired(val);
+  return false;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline result_t Group<key_t, val_t, seq, max_model_n>::update_to_array(
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline result_t Group<key_t, val_t, seq, multi, max_model_n>::update_to_array(
     const key_t& key, const val_t& val, const uint32_t worker_id) {
   if (seq) {
     seq_lock();
     size_t pos = get_pos_from_array(key);
     if (pos != array_size) {  // position is valid (not out-of-range)
       seq_unlock();
-      return (/* key matches */ data[pos].first == key &&
-              /* record updated */ data[pos].second.update(val))
-                 ? result_t::ok
-                 : result_t::failed;
+      if (/* key matches */ key_at(pos) == key &&
+          /* record updated */ data[pos].second.update(val)) {
+        note_array_write();
+        return result_t::ok;
+      }
+      return result_t::failed;
     } else {                      // might append
       if (buffer->size() == 0) {  // buf is empty
         if (capacity < 0) {
           seq_unlock();
           return result_t::retry;
         }
+        if (tiered) {  // the mapped array can not grow, use the buffer
+          seq_unlock();
+          return result_t::failed;
+        }
 
-        if ((int32_t)array_size == capacity) {
+        if ((group_ssize_t)array_size == capacity) {
           const auto prev_capacity = capacity;
           const record_t* prev_data = data;
 
@@ -504,7 +993,7 @@ inline result_t Group<key_t, val_t, seq, max_model_n>::update_to_array(
           memcpy(new_data, data, array_size * sizeof(record_t));
           data = new_data;
 
-          data[pos].first = key;
+          data[pos].first = array_keys.store(key);
           data[pos].second = wrapped_val_t(val);
           array_size++;
           seq_unlock();
@@ -519,7 +1008,7 @@ inline result_t Group<key_t, val_t, seq, max_model_n>::update_to_array(
           delete[] prev_data;
           return result_t::ok;
         } else {
-          data[pos].first = key;
+          data[pos].first = array_keys.store(key);
           data[pos].second = wrapped_val_t(val);
           array_size++;
           seq_unlock();
@@ -532,32 +1021,51 @@ inline result_t Group<key_t, val_t, seq, max_model_n>::update_to_array(
     }
   } else {  // no seq
     size_t pos = get_pos_from_array(key);
-    return pos != array_size && data[pos].first == key &&
-                   data[pos].second.update(val)
-               ? result_t::ok
-               : result_t::failed;
+    if (pos != array_size && key_at(pos) == key &&
+        data[pos].second.update(val)) {
+      note_array_write();
+      return result_t::ok;
+    }
+    return result_t::failed;
   }
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline bool Group<key_t, val_t, seq, max_model_n>::remove_from_array(
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline bool Group<key_t, val_t, seq, multi, max_model_n>::remove_from_array(
     const key_t& key) {
   size_t pos = get_pos_from_array(key);
-  return pos != array_size &&        // position is valid (not out-of-range)
-         data[pos].first == key &&   // key matches
-         data[pos].second.remove();  // value is not removed and is updated
+  bool removed = false;
+  if (multi) {  // all occurrences
+    for (; pos < array_size && key_at(pos) == key; pos++) {
+      removed = data[pos].second.remove() || removed;
+    }
+  } else {
+    removed = pos != array_size &&        // position is valid
+              key_at(pos) == key &&   // key matches
+              data[pos].second.remove();  // value is not removed and is updated
+  }
+  if (removed) {
+    note_array_write();
+  }
+  return removed;
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline typename Group<key_t, val_t, seq, multi, max_model_n>::array_keys_t::load_t
+Group<key_t, val_t, seq, multi, max_model_n>::key_at(size_t pos) const {
+  return array_keys.load(data[pos].first);
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline size_t Group<key_t, val_t, seq, max_model_n>::get_pos_from_array(
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline size_t Group<key_t, val_t, seq, multi, max_model_n>::get_pos_from_array(
     const key_t& key) {
   size_t model_i = locate_model(key);
   size_t pos = models[model_i].model.predict(key);
   return exponential_search_key(key, pos);
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline size_t Group<key_t, val_t, seq, max_model_n>::binary_search_key(
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline size_t Group<key_t, val_t, seq, multi, max_model_n>::binary_search_key(
     const key_t& key, size_t pos, size_t search_begin, size_t search_end) {
   // search within the range
   if (unlikely(search_begin > array_size)) {
@@ -570,7 +1078,7 @@ inline size_t Group<key_t, val_t, seq, max_model_n>::binary_search_key(
                    ? pos
                    : (search_begin + search_end) / 2;
   while (search_end != search_begin) {
-    if (data[mid].first < key) {
+    if (key_at(mid) < key) {
       search_begin = mid + 1;
     } else {
       search_end = mid;
@@ -583,39 +1091,48 @@ inline size_t Group<key_t, val_t, seq, max_model_n>::binary_search_key(
   return mid;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline size_t Group<key_t, val_t, seq, max_model_n>::exponential_search_key(
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline size_t
+Group<key_t, val_t, seq, multi, max_model_n>::exponential_search_key(
     const key_t& key, size_t pos) const {
-  return exponential_search_key(data, array_size, key, pos);
+  return exponential_search_key(data, array_keys, array_size, key, pos);
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline size_t Group<key_t, val_t, seq, max_model_n>::exponential_search_key(
-    record_t* const data, uint32_t array_size, const key_t& key,
-    size_t pos) const {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline size_t
+Group<key_t, val_t, seq, multi, max_model_n>::exponential_search_key(
+    record_t* const data, const array_keys_t& keys, group_size_t array_size,
+    const key_t& key, size_t pos) const {
   if (array_size == 0)
     return 0;
   pos = (pos >= array_size ? (array_size - 1) : pos);
   assert(pos < array_size);
 
-  int begin_i = 0, end_i = array_size;
+  group_ssize_t begin_i = 0, end_i = array_size;
   size_t step = 1;
 
-  if (data[pos].first <= key) {
+  // with duplicates, the first occurrence of key might precede pos, so the
+  // search only moves forward when data[pos] is strictly smaller
+  if (multi ? keys.load(data[pos].first) < key
+            : keys.load(data[pos].first) <= key) {
     begin_i = pos;
     end_i = begin_i + step;
-    while (end_i < (int)array_size && data[end_i].first <= key) {
+    while (end_i < (group_ssize_t)array_size &&
+           (multi ? keys.load(data[end_i].first) < key
+                  : keys.load(data[end_i].first) <= key)) {
       step *= 2;
       begin_i = end_i;
       end_i = begin_i + step;
     }
-    if (end_i >= (int)array_size) {
+    if (end_i >= (group_ssize_t)array_size) {
       end_i = array_size - 1;
     }
   } else {
     end_i = pos;
     begin_i = end_i - step;
-    while (begin_i >= 0 && data[begin_i].first > key) {
+    while (begin_i >= 0 &&
+           (multi ? keys.load(data[begin_i].first) >= key
+                  : keys.load(data[begin_i].first) > key)) {
       step *= 2;
       end_i = begin_i;
       begin_i = end_i - step;
@@ -626,19 +1143,26 @@ inline size_t Group<key_t, val_t, seq, max_model_n>::exponential_search_key(
   }
 
   assert(begin_i >= 0);
-  assert(end_i < (int)array_size);
+  assert(end_i < (group_ssize_t)array_size);
   assert(begin_i <= end_i);
 
   // the real range is [begin_i, end_i], both inclusive.
   // we add 1 to end_i in order to find the insert position when the given key
   // is not exist
   end_i++;
+  if constexpr (has_radix_key<key_t>::value) {
+    if ((size_t)(end_i - begin_i) <= simd::scan_max) {
+      begin_i += simd::count_less(data + begin_i, end_i - begin_i,
+                                  key.radix_key());
+      end_i = begin_i;
+    }
+  }
   // find the largest position whose key equal to the given key
   while (end_i > begin_i) {
     // here the +1 term is used to avoid the infinte loop
     // where (end_i = begin_i + 1 && mid = begin_i && data[mid].first <= key)
-    int mid = (begin_i + end_i) >> 1;
-    if (data[mid].first < key) {
+    group_ssize_t mid = (begin_i + end_i) >> 1;
+    if (keys.load(data[mid].first) < key) {
       begin_i = mid + 1;
     } else {
       // we should assign end_i with mid (not mid+1) in case infinte loop
@@ -647,8 +1171,10 @@ inline size_t Group<key_t, val_t, seq, max_model_n>::exponential_search_key(
   }
 
   assert(end_i == begin_i);
-  assert(data[end_i].first == key || end_i == 0 || end_i == (int)array_size ||
-         (data[end_i - 1].first < key && data[end_i].first > key));
+  assert(end_i == (group_ssize_t)array_size ||
+         keys.load(data[end_i].first) == key || end_i == 0 ||
+         (keys.load(data[end_i - 1].first) < key &&
+          keys.load(data[end_i].first) > key));
 
   return end_i;
 }
@@ -656,32 +1182,115 @@ inline size_t Group<key_t, val_t, seq, max_model_n>::exponential_search_key(
 // semantics: atomically read the value
 // only when the key exists and the record (record_t) is not logical removed,
 // return true on success
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline bool Group<key_t, val_t, seq, max_model_n>::get_from_buffer(
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline bool Group<key_t, val_t, seq, multi, max_model_n>::get_from_buffer(
     const key_t& key, val_t& val, buffer_t* buffer) {
-  return buffer->get(key, val);
+  if (multi) {
+    typename buffer_t::DataSource source(to_buf_key(key), buffer);
+    source.advance_to_next_valid();
+    if (source.has_next && from_buf_key(source.get_key()) == key) {
+      val = source.get_val();
+      return true;
+    }
+    return false;
+  }
+  return buffer->get(to_buf_key(key), val);
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline bool Group<key_t, val_t, seq, max_model_n>::update_to_buffer(
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline bool Group<key_t, val_t, seq, multi, max_model_n>::update_to_buffer(
     const key_t& key, const val_t& val, buffer_t* buffer) {
-  return buffer->update(key, val);
+  assert(!multi);
+  return buffer->update(to_buf_key(key), val);
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline void Group<key_t, val_t, seq, max_model_n>::insert_to_buffer(
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline void Group<key_t, val_t, seq, multi, max_model_n>::insert_to_buffer(
     const key_t& key, const val_t& val, buffer_t* buffer) {
-  buffer->insert(key, val);
+  if constexpr (multi) {
+    buffer->insert(buf_key_t(key, buffer->next_insert_seq()), val);
+  } else {
+    buffer->insert(key, val);
+  }
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline bool Group<key_t, val_t, seq, max_model_n>::remove_from_buffer(
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline bool Group<key_t, val_t, seq, multi, max_model_n>::remove_from_buffer(
     const key_t& key, buffer_t* buffer) {
-  return buffer->remove(key);
+  if (multi) {  // all occurrences
+    std::vector<buf_key_t> buf_keys;
+    typename buffer_t::DataSource source(to_buf_key(key), buffer);
+    source.advance_to_next_valid();
+    while (source.has_next && from_buf_key(source.get_key()) == key) {
+      buf_keys.push_back(source.get_key());
+      source.advance_to_next_valid();
+    }
+    bool removed = false;
+    for (const buf_key_t& buf_key : buf_keys) {
+      removed = buffer->remove(buf_key) || removed;
+    }
+    return removed;
+  }
+  return buffer->remove(to_buf_key(key));
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline void
+Group<key_t, val_t, seq, multi, max_model_n>::equal_range_from_buffer(
+    const key_t& key, std::vector<val_t>& vals, buffer_t* buffer) {
+  typename buffer_t::DataSource source(to_buf_key(key), buffer);
+  source.advance_to_next_valid();
+  while (source.has_next && from_buf_key(source.get_key()) == key) {
+    vals.push_back(source.get_val());
+    source.advance_to_next_valid();
+  }
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline size_t
+Group<key_t, val_t, seq, multi, max_model_n>::remove_range_from_buffer(
+    const key_t& begin, const key_t& end, buffer_t* buffer) {
+  // collect first, the data source holds a snapshot of one leaf at a time
+  std::vector<buf_key_t> buf_keys;
+  typename buffer_t::DataSource source(to_buf_key(begin), buffer);
+  source.advance_to_next_valid();
+  while (source.has_next && from_buf_key(source.get_key()) < end) {
+    buf_keys.push_back(source.get_key());
+    source.advance_to_next_valid();
+  }
+  size_t removed_n = 0;
+  for (const buf_key_t& buf_key : buf_keys) {
+    if (buffer->remove(buf_key)) {
+      removed_n++;
+    }
+  }
+  return removed_n;
+}
+
+// the smallest buffer key of `key`, i.e., the lower bound of its occurrences
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline typename Group<key_t, val_t, seq, multi, max_model_n>::buf_key_t
+Group<key_t, val_t, seq, multi, max_model_n>::to_buf_key(const key_t& key) {
+  if constexpr (multi) {
+    return buf_key_t(key, 0);
+  } else {
+    return key;
+  }
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-void Group<key_t, val_t, seq, max_model_n>::init_models(uint32_t model_n) {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline const key_t& Group<key_t, val_t, seq, multi, max_model_n>::from_buf_key(
+    const buf_key_t& buf_key) {
+  if constexpr (multi) {
+    return buf_key.key;
+  } else {
+    return buf_key;
+  }
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+void Group<key_t, val_t, seq, multi, max_model_n>::init_models(
+    uint32_t model_n) {
   assert(model_n >= 1);
   this->model_n = model_n;
 
@@ -695,11 +1304,22 @@ void Group<key_t, val_t, seq, max_model_n>::init_models(uint32_t model_n) {
       end++;
       trailing_n--;
     }
+    if (multi) {
+      // keep runs of equal keys within one model, so that model pivots are
+      // unique. use fewer models if the runs consume all records
+      while (end < array_size && key_at(end) == key_at(end - 1)) {
+        end++;
+      }
+      if (end >= array_size || model_i == model_n - 1) {
+        end = array_size;
+        model_n = this->model_n = model_i + 1;
+      }
+    }
     assert(end <= array_size);
     assert((model_i == model_n - 1 && end == array_size) ||
            model_i < model_n - 1);
 
-    models[model_i].pivot = data[begin].first;
+    models[model_i].pivot = key_at(begin);
     // models[model_i].offset = begin;
     mean_error += train_model(model_i, begin, end);
 
@@ -708,28 +1328,47 @@ void Group<key_t, val_t, seq, max_model_n>::init_models(uint32_t model_n) {
   mean_error /= model_n;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline double Group<key_t, val_t, seq, max_model_n>::train_model(size_t model_i,
-                                                                 size_t begin,
-                                                                 size_t end) {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline double Group<key_t, val_t, seq, multi, max_model_n>::train_model(
+    size_t model_i, size_t begin, size_t end) {
   assert(end >= begin);
   assert(array_size >= end);
 
+  std::vector<key_t> keys;
+  std::vector<size_t> positions;
+  get_training_set(begin, end, keys, positions);
+
+  models[model_i].model.prepare(keys, positions);
+  return models[model_i].model.get_error_bound(keys, positions);
+}
+
+// in multimap mode all records of a run of equal keys are trained to the
+// position of the first one, since that is where lookups start from
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline void Group<key_t, val_t, seq, multi, max_model_n>::get_training_set(
+    size_t begin, size_t end, std::vector<key_t>& keys,
+    std::vector<size_t>& positions) const {
   size_t model_data_size = end - begin;
-  std::vector<key_t> keys(model_data_size);
-  std::vector<size_t> positions(model_data_size);
+  keys.resize(model_data_size);
+  positions.resize(model_data_size);
 
+  size_t run_begin = begin;
+  if (multi) {
+    while (run_begin > 0 && key_at(run_begin - 1) == key_at(begin)) {
+      run_begin--;
+    }
+  }
   for (size_t rec_i = 0; rec_i < model_data_size; rec_i++) {
-    keys[rec_i] = data[begin + rec_i].first;
-    positions[rec_i] = begin + rec_i;
+    keys[rec_i] = key_at(begin + rec_i);
+    if (!multi || (rec_i > 0 && keys[rec_i] != keys[rec_i - 1])) {
+      run_begin = begin + rec_i;
+    }
+    positions[rec_i] = run_begin;
   }
-
-  models[model_i].model.prepare(keys, positions);
-  return models[model_i].model.get_error_bound(keys, positions);
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline void Group<key_t, val_t, seq, max_model_n>::seq_lock() {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline void Group<key_t, val_t, seq, multi, max_model_n>::seq_lock() {
   while (true) {
     uint8_t expected = 0;
     uint8_t desired = 1;
@@ -739,60 +1378,69 @@ inline void Group<key_t, val_t, seq, max_model_n>::seq_lock() {
   }
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline void Group<key_t, val_t, seq, max_model_n>::seq_unlock() {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline void Group<key_t, val_t, seq, multi, max_model_n>::seq_unlock() {
   asm volatile("" : : : "memory");
   lock = 0;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline void Group<key_t, val_t, seq, max_model_n>::enable_seq_insert_opt() {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline void
+Group<key_t, val_t, seq, multi, max_model_n>::enable_seq_insert_opt() {
   seq_lock();
   capacity = -capacity;
   INVARIANT(capacity > 0);
   seq_unlock();
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline void Group<key_t, val_t, seq, max_model_n>::disable_seq_insert_opt() {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline void
+Group<key_t, val_t, seq, multi, max_model_n>::disable_seq_insert_opt() {
   seq_lock();
   capacity = -capacity;
   INVARIANT(capacity < 0);
   seq_unlock();
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline void Group<key_t, val_t, seq, max_model_n>::merge_refs(
-    record_t*& new_data, uint32_t& new_array_size,
-    int32_t& new_capacity) const {
-  size_t est_size = array_size + buffer->size();
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline void Group<key_t, val_t, seq, multi, max_model_n>::merge_refs(
+    record_t*& new_data, array_keys_t& new_keys, group_size_t& new_array_size,
+    group_ssize_t& new_capacity) const {
+  size_t est_size = (size_t)array_size + buffer->size();
   new_capacity = est_size * seq_insert_reserve_factor;
   new_data = new record_t[new_capacity]();
   _::allocated_bytes += new_capacity * sizeof(record_t);
-  merge_refs_internal(new_data, new_array_size);
-  assert((int32_t)new_array_size <= new_capacity);
+  new_keys = merged_keys(nullptr, est_size);
+  merge_refs_internal(new_data, new_keys, new_array_size);
+  new_keys.seal();
+  assert((group_ssize_t)new_array_size <= new_capacity);
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline void Group<key_t, val_t, seq, max_model_n>::merge_refs_n_split(
-    record_t*& new_data_1, uint32_t& new_array_size_1, int32_t& new_capacity_1,
-    record_t*& new_data_2, uint32_t& new_array_size_2, int32_t& new_capacity_2,
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline void Group<key_t, val_t, seq, multi, max_model_n>::merge_refs_n_split(
+    record_t*& new_data_1, array_keys_t& new_keys_1,
+    group_size_t& new_array_size_1, group_ssize_t& new_capacity_1,
+    record_t*& new_data_2, array_keys_t& new_keys_2,
+    group_size_t& new_array_size_2, group_ssize_t& new_capacity_2,
     const key_t& key) const {
-  uint32_t intermediate_size;
-  uint32_t est_size = array_size + buffer->size();
+  group_size_t intermediate_size;
+  group_size_t est_size = array_size + buffer->size();
 
   new_capacity_1 = (est_size / 2) * seq_insert_reserve_factor;
   new_capacity_1 =
-      (int32_t)est_size > new_capacity_1 ? est_size : new_capacity_1;
+      (group_ssize_t)est_size > new_capacity_1 ? est_size : new_capacity_1;
 
   record_t* intermediate = new record_t[new_capacity_1]();
   _::allocated_bytes += new_capacity_1 * sizeof(record_t);
-  merge_refs_internal(intermediate, intermediate_size);
+  new_keys_1 = merged_keys(nullptr, est_size);
+  merge_refs_internal(intermediate, new_keys_1, intermediate_size);
+  new_keys_1.seal();
 
-  uint32_t split_pos = exponential_search_key(intermediate, intermediate_size,
-                                              key, intermediate_size / 2);
+  group_size_t split_pos =
+      exponential_search_key(intermediate, new_keys_1, intermediate_size, key,
+                             intermediate_size / 2);
   assert(split_pos != intermediate_size &&
-         intermediate[split_pos].first >= key);
+         new_keys_1.load(intermediate[split_pos].first) >= key);
 
   new_array_size_1 = split_pos;
   new_data_1 = intermediate;
@@ -803,56 +1451,74 @@ inline void Group<key_t, val_t, seq, max_model_n>::merge_refs_n_split(
   _::allocated_bytes += new_capacity_2 * sizeof(new_data_2);
   memcpy(new_data_2, intermediate + split_pos,
          new_array_size_2 * sizeof(record_t));
+  if constexpr (array_keys_t::compressed) {
+    // the second array gets keys of its own, since groups that don't share
+    // their array are freed on their own (see free_unlinked)
+    new_keys_2 = array_keys_t(
+        new_keys_1.load(new_data_2[0].first),
+        new_keys_1.load(new_data_2[new_array_size_2 - 1].first),
+        new_array_size_2);
+    for (size_t rec_i = 0; rec_i < new_array_size_2; rec_i++) {
+      new_data_2[rec_i].first =
+          new_keys_2.store(new_keys_1.load(new_data_2[rec_i].first));
+    }
+    new_keys_2.seal();
+  }
 
-  assert((int32_t)new_array_size_1 <= new_capacity_1);
-  assert((int32_t)new_array_size_2 <= new_capacity_2);
+  assert((group_ssize_t)new_array_size_1 <= new_capacity_1);
+  assert((group_ssize_t)new_array_size_2 <= new_capacity_2);
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline void Group<key_t, val_t, seq, max_model_n>::merge_refs_with(
-    const Group& next_group, record_t*& new_data, uint32_t& new_array_size,
-    int32_t& new_capacity) const {
-  size_t est_size = array_size + buffer->size() + next_group.array_size +
-                    next_group.buffer->size();
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline void Group<key_t, val_t, seq, multi, max_model_n>::merge_refs_with(
+    const Group& next_group, record_t*& new_data, array_keys_t& new_keys,
+    group_size_t& new_array_size, group_ssize_t& new_capacity) const {
+  size_t est_size = (size_t)array_size + buffer->size() +
+                    next_group.array_size + next_group.buffer->size();
   new_capacity = est_size * seq_insert_reserve_factor;
   new_data = new record_t[new_capacity]();
   _::allocated_bytes += new_capacity * sizeof(record_t);
 
-  uint32_t real_size_1, real_size_2;
-  merge_refs_internal(new_data, real_size_1);
-  next_group.merge_refs_internal(new_data + real_size_1, real_size_2);
+  group_size_t real_size_1, real_size_2;
+  new_keys = merged_keys(&next_group, est_size);
+  merge_refs_internal(new_data, new_keys, real_size_1);
+  next_group.merge_refs_internal(new_data + real_size_1, new_keys,
+                                 real_size_2);
+  new_keys.seal();
 
   new_array_size = real_size_1 + real_size_2;
 
-  assert((int32_t)new_array_size <= new_capacity);
+  assert((group_ssize_t)new_array_size <= new_capacity);
 }
 
 // no workers should insert into buffer (frozen) now, so no lock needed
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline void Group<key_t, val_t, seq, max_model_n>::merge_refs_internal(
-    record_t* new_data, uint32_t& new_array_size) const {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline void Group<key_t, val_t, seq, multi, max_model_n>::merge_refs_internal(
+    record_t* new_data, array_keys_t& new_keys,
+    group_size_t& new_array_size) const {
   size_t count = 0;
 
   auto buffer_source = typename buffer_t::RefSource(buffer);
-  auto array_source = ArrayRefSource(data, array_size);
+  auto array_source = ArrayRefSource(data, array_keys, array_size);
   array_source.advance_to_next_valid();
   buffer_source.advance_to_next_valid();
 
   while (array_source.has_next && buffer_source.has_next) {
     const key_t& base_key = array_source.get_key();
     wrapped_val_t& base_val = array_source.get_val();
-    const key_t& buf_key = buffer_source.get_key();
+    const key_t& buf_key = from_buf_key(buffer_source.get_key());
     wrapped_val_t& buf_val = buffer_source.get_val();
 
-    assert(base_key != buf_key);  // since update are inplaced
+    assert(multi || base_key != buf_key);  // since update are inplaced
 
-    if (base_key < buf_key) {
-      new_data[count].first = base_key;
+    // older occurrences of a duplicate key stay in front
+    if (base_key <= buf_key) {
+      new_data[count].first = new_keys.store(base_key);
       new_data[count].second = wrapped_val_t(&base_val);
       assert(new_data[count].second.val.ptr->val.val == base_val.val.val);
       array_source.advance_to_next_valid();
     } else {
-      new_data[count].first = buf_key;
+      new_data[count].first = new_keys.store(buf_key);
       new_data[count].second = wrapped_val_t(&buf_val);
       assert(new_data[count].second.val.ptr->val.val == buf_val.val.val);
       buffer_source.advance_to_next_valid();
@@ -864,7 +1530,7 @@ inline void Group<key_t, val_t, seq, max_model_n>::merge_refs_internal(
     const key_t& base_key = array_source.get_key();
     wrapped_val_t& base_val = array_source.get_val();
 
-    new_data[count].first = base_key;
+    new_data[count].first = new_keys.store(base_key);
     new_data[count].second = wrapped_val_t(&base_val);
     assert(new_data[count].second.val.ptr->val.val == base_val.val.val);
 
@@ -873,10 +1539,10 @@ inline void Group<key_t, val_t, seq, max_model_n>::merge_refs_internal(
   }
 
   while (buffer_source.has_next) {
-    const key_t& buf_key = buffer_source.get_key();
+    const key_t& buf_key = from_buf_key(buffer_source.get_key());
     wrapped_val_t& buf_val = buffer_source.get_val();
 
-    new_data[count].first = buf_key;
+    new_data[count].first = new_keys.store(buf_key);
     new_data[count].second = wrapped_val_t(&buf_val);
     assert(new_data[count].second.val.ptr->val.val == buf_val.val.val);
 
@@ -885,24 +1551,62 @@ inline void Group<key_t, val_t, seq, max_model_n>::merge_refs_internal(
   }
 
   for (size_t rec_i = 0; rec_i < (count == 0 ? 0 : count - 1); rec_i++) {
-    assert(new_data[rec_i].first < new_data[rec_i + 1].first);
+    assert(new_keys.load(new_data[rec_i].first) <
+               new_keys.load(new_data[rec_i + 1].first) ||
+           (multi && new_keys.load(new_data[rec_i].first) ==
+                         new_keys.load(new_data[rec_i + 1].first)));
     assert(new_data[rec_i].second.status == new_data[rec_i + 1].second.status);
-    assert(new_data[rec_i].second.status == 0x4000000000000000);
+    assert(new_data[rec_i].second.status == atomic_val_t::pointer_mask);
   }
 
   new_array_size = count;
   // assert(count > 0);
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline size_t Group<key_t, val_t, seq, max_model_n>::scan_2_way(
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+typename Group<key_t, val_t, seq, multi, max_model_n>::array_keys_t
+Group<key_t, val_t, seq, multi, max_model_n>::merged_keys(
+    const Group* next_group, size_t key_n) const {
+  if constexpr (!array_keys_t::compressed) {
+    return array_keys_t();
+  } else {
+    // the first and last records of the arrays and buffers bound the merged
+    // keys, removed ones included
+    bool bounded = false;
+    key_t lo, hi;
+    auto widen = [&](const key_t& key) {
+      lo = !bounded || key < lo ? key : lo;
+      hi = !bounded || hi < key ? key : hi;
+      bounded = true;
+    };
+    for (const Group* group : {this, next_group}) {
+      if (group == nullptr) {
+        continue;
+      }
+      if (group->array_size > 0) {
+        widen(group->key_at(0));
+        widen(group->key_at(group->array_size - 1));
+      }
+      auto buffer_source = typename buffer_t::RefSource(group->buffer);
+      buffer_source.advance_to_next_valid();
+      while (buffer_source.has_next) {
+        widen(from_buf_key(buffer_source.get_key()));
+        buffer_source.advance_to_next_valid();
+      }
+    }
+    return bounded ? array_keys_t(lo, hi, key_n) : array_keys_t();
+  }
+}
+
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline size_t Group<key_t, val_t, seq, multi, max_model_n>::scan_2_way(
     const key_t& begin, const size_t n, const key_t& end,
     std::vector<std::pair<key_t, val_t>>& result) {
   size_t remaining = n;
   bool out_of_range = false;
-  uint32_t base_i = get_pos_from_array(begin);
-  ArrayDataSource array_source(data, array_size, base_i);
-  typename buffer_t::DataSource buffer_source(begin, buffer);
+  group_size_t base_i = get_pos_from_array(begin);
+  ArrayDataSource array_source(data, array_keys, array_size, base_i);
+  typename buffer_t::DataSource buffer_source(to_buf_key(begin), buffer);
 
   // first read a not-removed value from array and buffer, to avoid double read
   // during merge
@@ -914,10 +1618,10 @@ inline size_t Group<key_t, val_t, seq, max_model_n>::scan_2_way(
     // we are sure that these key has not-removed (pre-read) value
     const key_t& base_key = array_source.get_key();
     const val_t& base_val = array_source.get_val();
-    const key_t& buf_key = buffer_source.get_key();
+    const key_t& buf_key = from_buf_key(buffer_source.get_key());
     const val_t& buf_val = buffer_source.get_val();
 
-    assert(base_key != buf_key);  // since update are inplaced
+    assert(multi || base_key != buf_key);  // since update are inplaced
 
     if (base_key < buf_key) {
       if (base_key >= end) {
@@ -951,7 +1655,7 @@ inline size_t Group<key_t, val_t, seq, max_model_n>::scan_2_way(
   }
 
   while (buffer_source.has_next && remaining && !out_of_range) {
-    const key_t& buf_key = buffer_source.get_key();
+    const key_t& buf_key = from_buf_key(buffer_source.get_key());
     const val_t& buf_val = buffer_source.get_val();
     if (buf_key >= end) {
       out_of_range = true;
@@ -965,16 +1669,17 @@ inline size_t Group<key_t, val_t, seq, max_model_n>::scan_2_way(
   return n - remaining;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-inline size_t Group<key_t, val_t, seq, max_model_n>::scan_3_way(
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+inline size_t Group<key_t, val_t, seq, multi, max_model_n>::scan_3_way(
     const key_t& begin, const size_t n, const key_t& end,
     std::vector<std::pair<key_t, val_t>>& result) {
   size_t remaining = n;
   bool out_of_range = false;
-  uint32_t base_i = get_pos_from_array(begin);
-  ArrayDataSource array_source(data, array_size, base_i);
-  typename buffer_t::DataSource buffer_source(begin, buffer);
-  typename buffer_t::DataSource temp_buffer_source(begin, buffer_temp);
+  group_size_t base_i = get_pos_from_array(begin);
+  ArrayDataSource array_source(data, array_keys, array_size, base_i);
+  typename buffer_t::DataSource buffer_source(to_buf_key(begin), buffer);
+  typename buffer_t::DataSource temp_buffer_source(to_buf_key(begin),
+                                                    buffer_temp);
 
   // first read a not-removed value from array and buffer, to avoid double read
   // during merge
@@ -988,13 +1693,14 @@ inline size_t Group<key_t, val_t, seq, max_model_n>::scan_3_way(
     // we are sure that these key has not-removed (pre-read) value
     const key_t& base_key = array_source.get_key();
     const val_t& base_val = array_source.get_val();
-    const key_t& buf_key = buffer_source.get_key();
+    const key_t& buf_key = from_buf_key(buffer_source.get_key());
     const val_t& buf_val = buffer_source.get_val();
-    const key_t& tmp_buf_key = temp_buffer_source.get_key();
+    const key_t& tmp_buf_key =
+        from_buf_key(temp_buffer_source.get_key());
     const val_t& tmp_buf_val = temp_buffer_source.get_val();
 
-    assert(base_key != buf_key);      // since update are inplaced
-    assert(base_key != tmp_buf_key);  // and removed values are skipped
+    assert(multi || base_key != buf_key);      // since update are inplaced
+    assert(multi || base_key != tmp_buf_key);  // and removed values are skipped
 
     if (base_key < buf_key && base_key < tmp_buf_key) {
       if (base_key >= end) {
@@ -1028,10 +1734,10 @@ inline size_t Group<key_t, val_t, seq, max_model_n>::scan_3_way(
     // we are sure that these key has not-removed (pre-read) value
     const key_t& base_key = array_source.get_key();
     const val_t& base_val = array_source.get_val();
-    const key_t& buf_key = buffer_source.get_key();
+    const key_t& buf_key = from_buf_key(buffer_source.get_key());
     const val_t& buf_val = buffer_source.get_val();
 
-    assert(base_key != buf_key);  // since update are inplaced
+    assert(multi || base_key != buf_key);  // since update are inplaced
 
     if (base_key < buf_key) {
       if (base_key >= end) {
@@ -1055,12 +1761,13 @@ inline size_t Group<key_t, val_t, seq, max_model_n>::scan_3_way(
   while (buffer_source.has_next && temp_buffer_source.has_next && remaining &&
          !out_of_range) {
     // we are sure that these key has not-removed (pre-read) value
-    const key_t& buf_key = buffer_source.get_key();
+    const key_t& buf_key = from_buf_key(buffer_source.get_key());
     const val_t& buf_val = buffer_source.get_val();
-    const key_t& tmp_buf_key = temp_buffer_source.get_key();
+    const key_t& tmp_buf_key =
+        from_buf_key(temp_buffer_source.get_key());
     const val_t& tmp_buf_val = temp_buffer_source.get_val();
 
-    assert(buf_key != tmp_buf_key);  // and removed values are skipped
+    assert(multi || buf_key != tmp_buf_key);  // and removed values are skipped
 
     if (buf_key < tmp_buf_key) {
       if (buf_key >= end) {
@@ -1086,10 +1793,11 @@ inline size_t Group<key_t, val_t, seq, max_model_n>::scan_3_way(
     // we are sure that these key has not-removed (pre-read) value
     const key_t& base_key = array_source.get_key();
     const val_t& base_val = array_source.get_val();
-    const key_t& tmp_buf_key = temp_buffer_source.get_key();
+    const key_t& tmp_buf_key =
+        from_buf_key(temp_buffer_source.get_key());
     const val_t& tmp_buf_val = temp_buffer_source.get_val();
 
-    assert(base_key != tmp_buf_key);  // and removed values are skipped
+    assert(multi || base_key != tmp_buf_key);  // and removed values are skipped
 
     if (base_key < tmp_buf_key) {
       if (base_key >= end) {
@@ -1124,7 +1832,7 @@ inline size_t Group<key_t, val_t, seq, max_model_n>::scan_3_way(
   }
 
   while (buffer_source.has_next && remaining && !out_of_range) {
-    const key_t& buf_key = buffer_source.get_key();
+    const key_t& buf_key = from_buf_key(buffer_source.get_key());
     const val_t& buf_val = buffer_source.get_val();
     if (buf_key >= end) {
       out_of_range = true;
@@ -1136,7 +1844,8 @@ inline size_t Group<key_t, val_t, seq, max_model_n>::scan_3_way(
   }
 
   while (temp_buffer_source.has_next && remaining && !out_of_range) {
-    const key_t& tmp_buf_key = temp_buffer_source.get_key();
+    const key_t& tmp_buf_key =
+        from_buf_key(temp_buffer_source.get_key());
     const val_t& tmp_buf_val = temp_buffer_source.get_val();
     if (tmp_buf_key >= end) {
       out_of_range = true;
@@ -1150,17 +1859,18 @@ inline size_t Group<key_t, val_t, seq, max_model_n>::scan_3_way(
   return n - remaining;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-Group<key_t, val_t, seq, max_model_n>::ArrayDataSource::ArrayDataSource(
-    record_t* data, uint32_t array_size, uint32_t pos)
-    : array_size(array_size), pos(pos), data(data) {}
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+Group<key_t, val_t, seq, multi, max_model_n>::ArrayDataSource::ArrayDataSource(
+    record_t* data, const array_keys_t& keys, group_size_t array_size,
+    group_size_t pos)
+    : array_size(array_size), pos(pos), data(data), keys(keys) {}
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-void Group<key_t, val_t, seq,
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+void Group<key_t, val_t, seq, multi,
            max_model_n>::ArrayDataSource::advance_to_next_valid() {
   while (pos < array_size) {
     if (data[pos].second.read(next_val)) {
-      next_key = data[pos].first;
+      next_key = keys.load(data[pos].first);
       has_next = true;
       pos++;
       return;
@@ -1170,29 +1880,31 @@ void Group<key_t, val_t, seq,
   has_next = false;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-const key_t& Group<key_t, val_t, seq, max_model_n>::ArrayDataSource::get_key() {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+const key_t&
+Group<key_t, val_t, seq, multi, max_model_n>::ArrayDataSource::get_key() {
   return next_key;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-const val_t& Group<key_t, val_t, seq, max_model_n>::ArrayDataSource::get_val() {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+const val_t&
+Group<key_t, val_t, seq, multi, max_model_n>::ArrayDataSource::get_val() {
   return next_val;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-Group<key_t, val_t, seq, max_model_n>::ArrayRefSource::ArrayRefSource(
-    record_t* data, uint32_t array_size)
-    : array_size(array_size), pos(0), data(data) {}
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+Group<key_t, val_t, seq, multi, max_model_n>::ArrayRefSource::ArrayRefSource(
+    record_t* data, const array_keys_t& keys, group_size_t array_size)
+    : array_size(array_size), pos(0), data(data), keys(keys) {}
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-void Group<key_t, val_t, seq,
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+void Group<key_t, val_t, seq, multi,
            max_model_n>::ArrayRefSource::advance_to_next_valid() {
   while (pos < array_size) {
     val_t temp_val;
     if (data[pos].second.read(temp_val)) {
       next_val_ptr = &data[pos].second;
-      next_key = data[pos].first;
+      next_key = keys.load(data[pos].first);
       has_next = true;
       pos++;
       return;
@@ -1202,19 +1914,20 @@ void Group<key_t, val_t, seq,
   has_next = false;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-const key_t& Group<key_t, val_t, seq, max_model_n>::ArrayRefSource::get_key() {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+const key_t&
+Group<key_t, val_t, seq, multi, max_model_n>::ArrayRefSource::get_key() {
   return next_key;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-typename Group<key_t, val_t, seq, max_model_n>::atomic_val_t&
-Group<key_t, val_t, seq, max_model_n>::ArrayRefSource::get_val() {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+typename Group<key_t, val_t, seq, multi, max_model_n>::atomic_val_t&
+Group<key_t, val_t, seq, multi, max_model_n>::ArrayRefSource::get_val() {
   return *next_val_ptr;
 }
 
-template <class key_t, class val_t, bool seq, size_t max_model_n>
-_::ByteSize Group<key_t, val_t, seq, max_model_n>::byte_size() const {
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+_::ByteSize Group<key_t, val_t, seq, multi, max_model_n>::byte_size() const {
   // purposefully exclude model size to make it explicit
   const size_t metadata_size =
       sizeof(decltype(*this)) - sizeof(decltype(models));
@@ -1224,9 +1937,12 @@ _::ByteSize Group<key_t, val_t, seq, max_model_n>::byte_size() const {
 
   // data consists of records, which are key, value pairs. Since value is wrapped in a more complex fashion,
   // it has a byte_size() to ensure we don't misscompute
+  // the array of a tiered group lives in a segment file, its keys stay here
   const size_t data_size =
-      this->capacity * (sizeof(typename record_t::first_type) +
-                        record_t::second_type::byte_size());
+      (tiered ? 0
+              : this->capacity * (sizeof(typename record_t::first_type) +
+                                  record_t::second_type::byte_size())) +
+      array_keys.byte_size();
 
   const _::ByteSize delta_buffer_size =
       buffer != nullptr ? buffer->byte_size() : _::ByteSize();
@@ -1240,6 +1956,62 @@ _::ByteSize Group<key_t, val_t, seq, max_model_n>::byte_size() const {
                   delta_buffer_size.used + temp_buffer_size.used};
 }
 
+template <class key_t, class val_t, bool seq, bool multi, size_t max_model_n>
+void Group<key_t, val_t, seq, multi, max_model_n>::collect_shape(
+    size_t group_i, IndexShape<key_t>& shape) {
+  materialize();
+
+  GroupShape<key_t> group_shape;
+  group_shape.pivot = pivot;
+  group_shape.group_i = group_i;
+  group_shape.array_size = array_size;
+  group_shape.buffer_size =
+      buffer->size() + (buffer_temp != nullptr ? buffer_temp->size() : 0);
+  group_shape.model_n = model_n;
+  group_shape.max_error = 0;
+  group_shape.bytes = byte_size().used;
+
+  // models cover consecutive records, up to the next model's pivot
+  double error_sum = 0, probe_n_sum = 0;
+  size_t pos = 0;
+  for (size_t model_i = 0; model_i < model_n; model_i++) {
+    size_t model_max_error = 0;
+    for (; pos < array_size && (model_i == (size_t)model_n - 1 ||
+                                key_at(pos) < models[model_i + 1].pivot);
+         pos++) {
+      size_t pos_pred = models[model_i].model.predict(key_at(pos));
+      pos_pred = pos_pred >= array_size ? array_size - 1 : pos_pred;
+      size_t error = pos_pred > pos ? pos_pred - pos : pos - pos_pred;
+      model_max_error = std::max(model_max_error, error);
+      error_sum += error;
+      probe_n_sum += search_probe_n(error);
+    }
+    shape.model_errors.push_back(model_max_error);
+    group_shape.max_error = std::max(group_shape.max_error, model_max_error);
+  }
+  group_shape.mean_error = array_size > 0 ? error_sum / array_size : 0;
+  group_shape.mean_probe_n = array_size > 0 ? probe_n_sum / array_size : 0;
+  shape.groups.push_back(group_shape);
+  shape.record_n += group_shape.array_size + group_shape.buffer_size;
+
+  // split like byte_size
+  const size_t models_size = max_model_n * model_info_t::byte_size();
+  const size_t metadata_size =
+      sizeof(decltype(*this)) - sizeof(decltype(models));
+  const size_t data_size =
+      (tiered ? 0
+              : this->capacity * (sizeof(typename record_t::first_type) +
+                                  record_t::second_type::byte_size())) +
+      array_keys.byte_size();
+  shape.group_bytes += _::ByteSize{metadata_size, metadata_size};
+  shape.model_bytes += _::ByteSize{models_size, models_size};
+  shape.array_bytes += _::ByteSize{data_size, data_size};
+  shape.buffer_bytes += buffer->byte_size();
+  if (buffer_temp != nullptr) {
+    shape.buffer_bytes += buffer_temp->byte_size();
+  }
+}
+
 }  // namespace xindex
 
 #endif  // XINDEX_GROUP_IMPL_H
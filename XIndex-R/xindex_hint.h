@@ -0,0 +1,184 @@
+/*
+ * The code is part of the XIndex project.
+ *
+ *    Copyright (C) 2020 Institute of Parallel and Distributed Systems (IPADS),
+ * Shanghai Jiao Tong University. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For more about XIndex, visit:
+ *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
+ */
+
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+
+#include "byte_size.hpp"
+#include "helper.h"
+#include "xindex_sort.h"
+#include "xindex_util.h"
+
+#if !defined(XINDEX_HINT_H)
+#define XINDEX_HINT_H
+
+namespace xindex {
+
+// keys that expose their bytes (e.g., StrKey) are hashed by all of them
+template <class key_t, class = void>
+struct has_key_bytes : std::false_type {};
+template <class key_t>
+struct has_key_bytes<key_t,
+                     std::void_t<decltype(std::declval<const key_t&>().data()),
+                                 decltype(std::declval<const key_t&>().size())>>
+    : std::true_type {};
+
+// mixes every byte of the key, shared by hint slots and change log stripes
+template <class key_t>
+inline uint64_t key_hash(const key_t& key) {
+  uint64_t h = 0;
+  if constexpr (has_radix_key<key_t>::value) {
+    h = key.radix_key();
+  } else if constexpr (has_key_bytes<key_t>::value) {
+    // the model features of byte string keys may only cover a prefix
+    const uint8_t* bytes = key.data();
+    size_t len = key.size();
+    for (size_t byte_i = 0; byte_i < len; byte_i += sizeof(uint64_t)) {
+      uint64_t word = 0;
+      memcpy(&word, bytes + byte_i, std::min(sizeof(word), len - byte_i));
+      h = (h ^ word) * 0x9e3779b97f4a7c15;
+    }
+    h ^= len;
+  } else {
+    for (double feat : key.to_model_key()) {
+      uint64_t bits;
+      memcpy(&bits, &feat, sizeof(bits));
+      h = (h ^ bits) * 0x9e3779b97f4a7c15;
+    }
+  }
+  h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9;
+  h = (h ^ (h >> 27)) * 0x94d049bb133111eb;
+  return h ^ (h >> 31);
+}
+
+/// Point lookup accelerator: a direct-mapped table from key hashes to the
+/// group and array record of a key, so that most gets read one slot and the
+/// record instead of searching the root and the group. Slots do not store
+/// keys: a hinted record is validated by its own key, and a hinted group, for
+/// records in its buffer, is simply searched, so a colliding or stale hint
+/// only costs a fallback to the learned path. Hints are valid for the epoch
+/// they were written in. Updates that replace groups (begin_update to
+/// end_update) may overlap, e.g., remove_range and an adjustment round; while
+/// any is in progress the epoch is odd, and hints are neither used nor
+/// written. Each update bumps the generation before it ends, and a hinted
+/// group is only freed after an rcu barrier within such an update, so it
+/// outlives every get that found its hint valid.
+template <class group_t>
+class PointHints {
+  typedef typename group_t::record_t record_t;
+
+  struct alignas(32) Slot {
+    std::atomic<uint64_t> version{0};  // odd while written
+    uint64_t epoch = 1;                // matches no epoch until written
+    group_t* group = nullptr;
+    record_t* record = nullptr;  // nullptr if in the group's buffer
+  };
+
+ public:
+  explicit PointHints(size_t slot_n) {
+    size_t size = 1;
+    while (size < slot_n) {
+      size <<= 1;
+    }
+    mask = size - 1;
+    slots.reset(new Slot[size]);
+  }
+  PointHints(const PointHints&) = delete;
+  PointHints& operator=(const PointHints&) = delete;
+
+  uint64_t epoch() const {
+    if (update_n.load() != 0) {
+      return 1;
+    }
+    return generation.load() * 2;
+  }
+  void begin_update() { update_n.fetch_add(1); }
+  void end_update() {
+    generation.fetch_add(1);  // before any reader sees no update in progress
+    update_n.fetch_sub(1);
+  }
+
+  template <class key_t>
+  bool lookup(const key_t& key, uint64_t epoch, group_t*& group,
+              record_t*& record) const {
+    if (epoch & 1) {
+      return false;
+    }
+    const Slot& slot = slots[key_hash(key) & mask];
+    uint64_t version = slot.version.load(std::memory_order_acquire);
+    if (version & 1) {
+      return false;
+    }
+    uint64_t slot_epoch = slot.epoch;
+    group = slot.group;
+    record = slot.record;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.version.load(std::memory_order_relaxed) == version &&
+           slot_epoch == epoch;
+  }
+
+  /// epoch must have been read before the group was located. with
+  /// keep_record, a current hint to an array record is left as is
+  template <class key_t>
+  void insert(const key_t& key, uint64_t epoch, group_t* group,
+              record_t* record, bool keep_record = false) {
+    if (epoch & 1) {
+      return;
+    }
+    Slot& slot = slots[key_hash(key) & mask];
+    uint64_t version = slot.version.load(std::memory_order_relaxed);
+    if (keep_record && slot.epoch == epoch && slot.record != nullptr) {
+      return;
+    }
+    // hints are best effort, so a slot written by another thread is skipped
+    if ((version & 1) ||
+        !slot.version.compare_exchange_strong(version, version + 1,
+                                              std::memory_order_relaxed)) {
+      return;
+    }
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.epoch = epoch;
+    slot.group = group;
+    slot.record = record;
+    slot.version.store(version + 2, std::memory_order_release);
+  }
+
+  _::ByteSize byte_size() const {
+    const size_t size = sizeof(*this) + (mask + 1) * sizeof(Slot);
+    return {.allocated = size, .used = size};
+  }
+
+ private:
+  size_t mask;
+  std::unique_ptr<Slot[]> slots;
+  std::atomic<uint32_t> update_n{0};  // updates in progress
+  std::atomic<uint64_t> generation{0};
+};
+
+}  // namespace xindex
+
+#endif  // XINDEX_HINT_H
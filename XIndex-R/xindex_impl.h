@@ -20,6 +20,8 @@
  *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
  */
 
+#include <algorithm>
+
 #include "xindex.h"
 #include "xindex_buffer_impl.h"
 #include "xindex_group_impl.h"
@@ -31,16 +33,89 @@
 
 namespace xindex {
 
-template <class key_t, class val_t, bool seq>
-XIndex<key_t, val_t, seq>::XIndex(const std::vector<key_t>& keys,
-                                  const std::vector<val_t>& vals,
-                                  size_t worker_num, size_t bg_n)
+template <class key_t, class val_t, bool seq, bool multi>
+XIndex<key_t, val_t, seq, multi>::XIndex(const std::vector<key_t>& keys,
+                                         const std::vector<val_t>& vals,
+                                         size_t worker_num, size_t bg_n)
+    : bg_num(bg_n) {
+  init(keys, vals, worker_num);
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+XIndex<key_t, val_t, seq, multi>::XIndex(
+    const std::vector<key_t>& keys, const std::vector<std::string_view>& vals,
+    size_t worker_num, size_t bg_n)
+    : bg_num(bg_n) {
+  static_assert(std::is_same<val_t, VarVal>::value,
+                "string values need val_t = VarVal");
+  rcu = std::make_unique<rcu_domain_t>(worker_num);
+  arena = std::make_unique<ValueArena>(*rcu);
+  std::vector<val_t> var_vals;
+  var_vals.reserve(vals.size());
+  for (const std::string_view& val : vals) {
+    var_vals.push_back(arena->allocate(val, 0));
+  }
+  init(keys, var_vals, worker_num);
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+XIndex<key_t, val_t, seq, multi>::XIndex(const key_t* keys, const val_t* vals,
+                                         size_t record_n, size_t worker_num,
+                                         size_t bg_n)
+    : bg_num(bg_n) {
+  init_config(worker_num);
+  assert(std::is_sorted(keys, keys + record_n));
+  root->init_lazy(keys, vals, record_n);
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+XIndex<key_t, val_t, seq, multi>::XIndex(
+    std::vector<std::pair<key_t, val_t>>&& records, size_t worker_num,
+    size_t bg_n, size_t sort_thread_n)
     : bg_num(bg_n) {
-  // the code leaks memory, which we have no time to fix. For now, just reset the counter
-  // assert(_::allocated_bytes > 0);
-  _::allocated_bytes = 0;
+  sort_records<key_t, val_t, multi>(records, sort_thread_n);
+  std::vector<key_t> keys(records.size());
+  std::vector<val_t> vals(records.size());
+  size_t chunk = (records.size() + sort_thread_n - 1) / sort_thread_n;
+  run_parallel(sort_thread_n, [&](size_t thread_i) {
+    size_t end = std::min(records.size(), (thread_i + 1) * chunk);
+    for (size_t i = thread_i * chunk; i < end; i++) {
+      keys[i] = records[i].first;
+      vals[i] = records[i].second;
+    }
+  });
+  std::vector<std::pair<key_t, val_t>>().swap(records);
+  init(keys, vals, worker_num);
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+XIndex<key_t, val_t, seq, multi>::XIndex(root_t* root, size_t worker_num,
+                                         size_t bg_n)
+    : root(root), rcu(new rcu_domain_t(worker_num)), bg_num(bg_n) {
+  _::index_n++;
+  if (!seq && !multi && config.point_hint_n > 0) {
+    hints = std::make_unique<hints_t>(config.point_hint_n);
+  }
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+void XIndex<key_t, val_t, seq, multi>::init(const std::vector<key_t>& keys,
+                                            const std::vector<val_t>& vals,
+                                            size_t worker_num) {
+  init_config(worker_num);
+  assert(std::is_sorted(keys.begin(), keys.end()));
+  root->init(keys, vals);
+}
 
-  config.worker_n = worker_num;
+template <class key_t, class val_t, bool seq, bool multi>
+void XIndex<key_t, val_t, seq, multi>::init_config(size_t worker_num) {
+  // the byte counter is shared by all live indexes (e.g., the shards of a
+  // ShardedXIndex), so only the first resets it
+  if (_::index_n++ == 0) {
+    // the code leaks memory, which we have no time to fix. For now, just reset the counter
+    // assert(_::allocated_bytes > 0);
+    _::allocated_bytes = 0;
+  }
   // sanity checks
   INVARIANT(config.root_error_bound > 0);
   INVARIANT(config.root_memory_constraint > 0);
@@ -49,24 +124,32 @@ XIndex<key_t, val_t, seq>::XIndex(const std::vector<key_t>& keys,
   INVARIANT(config.buffer_size_bound > 0);
   INVARIANT(config.buffer_size_tolerance > 0);
   INVARIANT(config.buffer_compact_threshold > 0);
-  INVARIANT(config.worker_n > 0);
-
-  assert(std::is_sorted(keys.begin(), keys.end()));
+  INVARIANT(worker_num > 0);
 
-  rcu_init();
+  if (rcu == nullptr) {
+    rcu = std::make_unique<rcu_domain_t>(worker_num);
+  }
+  INVARIANT(rcu->worker_n == worker_num);
+  if constexpr (std::is_same<val_t, VarVal>::value) {
+    if (arena == nullptr) {
+      arena = std::make_unique<ValueArena>(*rcu);
+    }
+  }
+  // sequential insertion may move the array of a live group
+  if (!seq && !multi && config.point_hint_n > 0) {
+    hints = std::make_unique<hints_t>(config.point_hint_n);
+  }
 
   // malloc memory for root & init root
   root = new root_t();
   _::allocated_bytes += sizeof(root_t);
 
-  root->init(keys, vals);
-
   // for our measurements, we want to manually force merging etc -> no background thread
   // start_bg();
 }
 
-template <class key_t, class val_t, bool seq>
-XIndex<key_t, val_t, seq>::~XIndex() {
+template <class key_t, class val_t, bool seq, bool multi>
+XIndex<key_t, val_t, seq, multi>::~XIndex() {
   // for our measurements, we want to manually force merging etc -> no background thread
   // terminate_bg();
 
@@ -80,61 +163,550 @@ XIndex<key_t, val_t, seq>::~XIndex() {
     root = nullptr;
   }
 
-  // by the time this destructor exits, we must have freed everything or else we leak
+  // by the time the last index is destructed, we must have freed everything or else we leak
   // assert(_::allocated_bytes == 0);
-  if (_::allocated_bytes > 0)
+  if (--_::index_n == 0 && _::allocated_bytes > 0)
     std::cerr << "LEAKING " << _::allocated_bytes << " BYTES in xindex"
               << std::endl;
 }
 
-template <class key_t, class val_t, bool seq>
-inline bool XIndex<key_t, val_t, seq>::get(const key_t& key, val_t& val,
-                                           const uint32_t worker_id) {
-  rcu_progress(worker_id);
-  return root->get(key, val) == result_t::ok;
+template <class key_t, class val_t, bool seq, bool multi>
+inline bool XIndex<key_t, val_t, seq, multi>::get(const key_t& key, val_t& val,
+                                                  const uint32_t worker_id) {
+  rcu_progress(*rcu, worker_id);
+  if (hints == nullptr) {
+    return root->get(key, val) == result_t::ok;
+  }
+
+  uint64_t epoch = hints->epoch();
+  group_t* group;
+  typename group_t::record_t* record;
+  if (hints->lookup(key, epoch, group, record) &&
+      (record == nullptr ? group->get(key, val) == result_t::ok
+                         : group->get_at(key, val, record))) {
+    return true;
+  }
+  if (root->get(key, val, group, record) != result_t::ok) {
+    return false;
+  }
+  hints->insert(key, epoch, group, record);
+  return true;
 }
 
-template <class key_t, class val_t, bool seq>
-inline bool XIndex<key_t, val_t, seq>::put(const key_t& key, const val_t& val,
-                                           const uint32_t worker_id) {
+template <class key_t, class val_t, bool seq, bool multi>
+inline bool XIndex<key_t, val_t, seq, multi>::put(const key_t& key,
+                                                  const val_t& val,
+                                                  const uint32_t worker_id) {
   result_t res;
-  rcu_progress(worker_id);
-  while ((res = root->put(key, val, worker_id)) == result_t::retry) {
-    rcu_progress(worker_id);
+  rcu_progress(*rcu, worker_id);
+  if (change_log != nullptr) {
+    change_log->lock(key, worker_id);
+  }
+  if (hints == nullptr) {
+    while ((res = root->put(key, val, worker_id)) == result_t::retry) {
+      rcu_progress(*rcu, worker_id);
+    }
+  } else {
+    uint64_t epoch;
+    group_t* group;
+    do {
+      rcu_progress(*rcu, worker_id);
+      epoch = hints->epoch();
+    } while ((res = root->put(key, val, worker_id, group)) == result_t::retry);
+    // a new key lands in the buffer, an existing one keeps its array hint
+    if (res == result_t::ok) {
+      hints->insert(key, epoch, group, nullptr, true);
+    }
+  }
+  if (change_log != nullptr) {
+    if (res == result_t::ok) {
+      change_t change{0, ChangeOp::put, key, key_t(), val};
+      change_log->append(worker_id, &change, 1);
+    }
+    change_log->unlock(key);
   }
   return res == result_t::ok;
 }
 
-template <class key_t, class val_t, bool seq>
-inline bool XIndex<key_t, val_t, seq>::remove(const key_t& key,
-                                              const uint32_t worker_id) {
-  rcu_progress(worker_id);
-  return root->remove(key) == result_t::ok;
+template <class key_t, class val_t, bool seq, bool multi>
+inline bool XIndex<key_t, val_t, seq, multi>::get(const key_t& key,
+                                                  std::string_view& val,
+                                                  const uint32_t worker_id) {
+  val_t var_val;
+  if (!get(key, var_val, worker_id)) {
+    return false;
+  }
+  val = var_val.view();
+  return true;
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+inline bool XIndex<key_t, val_t, seq, multi>::put(const key_t& key,
+                                                  std::string_view val,
+                                                  const uint32_t worker_id) {
+  static_assert(std::is_same<val_t, VarVal>::value,
+                "string values need val_t = VarVal");
+  return put(key, arena->allocate(val, worker_id), worker_id);
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+inline bool XIndex<key_t, val_t, seq, multi>::remove(const key_t& key,
+                                                     const uint32_t worker_id) {
+  rcu_progress(*rcu, worker_id);
+  if (change_log == nullptr) {
+    return root->remove(key) == result_t::ok;
+  }
+
+  change_log->lock(key, worker_id);
+  bool removed = root->remove(key) == result_t::ok;
+  if (removed) {
+    change_t change{0, ChangeOp::remove, key, key_t(), val_t()};
+    change_log->append(worker_id, &change, 1);
+  }
+  change_log->unlock(key);
+  return removed;
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+void XIndex<key_t, val_t, seq, multi>::write_batch(
+    const std::vector<batch_write_t>& writes, const uint32_t worker_id) {
+  static_assert(!seq && !multi,
+                "write_batch locks one record per key and does not support "
+                "appending to the group array");
+
+  // lock order is key order, and only the last write to a key is kept
+  std::vector<batch_write_t> sorted(writes.begin(), writes.end());
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const batch_write_t& a, const batch_write_t& b) {
+                     return a.key < b.key;
+                   });
+  size_t unique_n = 0;
+  for (size_t write_i = 0; write_i < sorted.size(); write_i++) {
+    if (write_i + 1 < sorted.size() &&
+        sorted[write_i].key == sorted[write_i + 1].key) {
+      continue;
+    }
+    sorted[unique_n++] = sorted[write_i];
+  }
+  sorted.resize(unique_n);
+
+  std::vector<size_t> stripe_ids;
+  if (change_log != nullptr) {
+    std::vector<key_t> keys;
+    for (const batch_write_t& write : sorted) {
+      keys.push_back(write.key);
+    }
+    change_log->stripes_of(keys, stripe_ids);
+    change_log->lock(stripe_ids, worker_id);
+  }
+
+  rcu_progress(*rcu, worker_id);
+  while (root->write_batch(sorted) == result_t::retry) {
+    rcu_progress(*rcu, worker_id);
+  }
+
+  if (change_log != nullptr) {
+    std::vector<change_t> changes;
+    for (const batch_write_t& write : sorted) {
+      changes.push_back({0, write.remove ? ChangeOp::remove : ChangeOp::put,
+                         write.key, key_t(), write.val});
+    }
+    change_log->append(worker_id, changes.data(), changes.size());
+    change_log->unlock(stripe_ids);
+  }
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+size_t XIndex<key_t, val_t, seq, multi>::multi_get(
+    const std::vector<key_t>& keys, std::vector<val_t>& vals,
+    std::vector<bool>& found, const uint32_t worker_id) {
+  static_assert(!multi, "multi_get returns one value per key");
+  rcu_progress(*rcu, worker_id);
+  return root->multi_get(keys, vals, found);
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+inline size_t XIndex<key_t, val_t, seq, multi>::equal_range(const key_t& key,
+                                                std::vector<val_t>& vals,
+                                                const uint32_t worker_id) {
+  rcu_progress(*rcu, worker_id);
+  return root->equal_range(key, vals);
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+void XIndex<key_t, val_t, seq, multi>::remove_range(const key_t& begin,
+                                                    const key_t& end,
+                                                    const uint32_t worker_id) {
+  rcu_progress(*rcu, worker_id);
+  if (!(begin < end)) {
+    return;
+  }
+
+  // don't hold up the barrier of a concurrent remove_range while waiting
+  rcu->status[worker_id].waiting = true;
+  std::lock_guard<std::mutex> guard(root_update_mut);
+  rcu->status[worker_id].waiting = false;
+
+  // with a change log, the stripes of all keys are held until the new root
+  // is in place, so that no logged put lands in a dropped group
+  std::vector<size_t> stripe_ids;
+  if (change_log != nullptr) {
+    change_log->all_stripes(stripe_ids);
+    change_log->lock(stripe_ids, worker_id);
+  }
+
+  if (hints != nullptr) {
+    hints->begin_update();
+  }
+  std::vector<group_t*> dropped;
+  root->remove_range(begin, end, dropped);
+  root_t* old_root = root;
+  if (!dropped.empty()) {
+    root = old_root->create_new_root(dropped);
+    memory_fence();
+  }
+
+  if (change_log != nullptr) {
+    change_t change{0, ChangeOp::remove_range, begin, end, val_t()};
+    change_log->append(worker_id, &change, 1);
+    change_log->unlock(stripe_ids);
+  }
+  if (dropped.empty()) {
+    if (hints != nullptr) {
+      hints->end_update();
+    }
+    return;
+  }
+
+  rcu_barrier(worker_id);  // no one uses the old root or dropped groups now
+  root->trim_root();
+  // the new root owns the remaining groups now
+  old_root->groups = nullptr;
+
+  const size_t bytes_to_delete = sizeof(decltype(*old_root));
+  assert(_::allocated_bytes > bytes_to_delete);
+  _::allocated_bytes -= bytes_to_delete;
+  delete old_root;
+
+  for (group_t* group : dropped) {
+    group->free_unlinked();
+    const size_t bytes_to_delete = sizeof(decltype(*group));
+    assert(_::allocated_bytes > bytes_to_delete);
+    _::allocated_bytes -= bytes_to_delete;
+    delete group;
+  }
+  if (hints != nullptr) {
+    hints->end_update();
+  }
+  DEBUG_THIS("--- [root] remove_range dropped " << dropped.size()
+                                                << " groups, group_n: "
+                                                << root->group_n);
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+void XIndex<key_t, val_t, seq, multi>::merge_from(XIndex& other,
+                                                  const uint32_t worker_id) {
+  static_assert(!ValRetire<val_t>::owns_storage,
+                "values that own storage are not shared between indexes");
+  rcu_progress(*rcu, worker_id);
+  std::vector<std::pair<key_t, val_t>> records;
+  std::pair<key_t, key_t> all(key_t::min(), key_t::max());
+  auto collect = [&records](size_t, const key_t& key, const val_t& val) {
+    records.push_back(std::pair<key_t, val_t>(key, val));
+  };
+  other.root->multi_range_scan(&all, 1, collect);
+  std::vector<val_t> max_vals;  // the scan ends before key_t::max()
+  other.root->equal_range(key_t::max(), max_vals);
+  for (const val_t& val : max_vals) {
+    collect(0, key_t::max(), val);
+  }
+  if (records.empty()) {
+    return;
+  }
+
+  rcu->status[worker_id].waiting = true;
+  std::lock_guard<std::mutex> guard(root_update_mut);
+  rcu->status[worker_id].waiting = false;
+
+  std::vector<size_t> stripe_ids;
+  if (change_log != nullptr) {
+    change_log->all_stripes(stripe_ids);
+    change_log->lock(stripe_ids, worker_id);
+  }
+
+  if (hints != nullptr) {
+    hints->begin_update();
+  }
+  std::vector<group_t*> replaced;
+  root_t* old_root = root;
+  root = old_root->merge(records, replaced);
+  memory_fence();
+
+  if (change_log != nullptr) {
+    std::vector<change_t> changes;
+    changes.reserve(records.size());
+    for (const auto& record : records) {
+      changes.push_back(
+          change_t{0, ChangeOp::put, record.first, key_t(), record.second});
+    }
+    change_log->append(worker_id, changes.data(), changes.size());
+    change_log->unlock(stripe_ids);
+  }
+
+  rcu_barrier(worker_id);  // no one uses the old root or replaced groups now
+  root->trim_root();
+  old_root->groups = nullptr;
+
+  const size_t bytes_to_delete = sizeof(decltype(*old_root));
+  assert(_::allocated_bytes > bytes_to_delete);
+  _::allocated_bytes -= bytes_to_delete;
+  delete old_root;
+
+  for (group_t* group : replaced) {
+    group->free_unlinked();
+    const size_t bytes_to_delete = sizeof(decltype(*group));
+    assert(_::allocated_bytes > bytes_to_delete);
+    _::allocated_bytes -= bytes_to_delete;
+    delete group;
+  }
+  if (hints != nullptr) {
+    hints->end_update();
+  }
+  DEBUG_THIS("--- [root] merge_from replaced " << replaced.size()
+                                               << " groups, group_n: "
+                                               << root->group_n);
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+std::unique_ptr<XIndex<key_t, val_t, seq, multi>>
+XIndex<key_t, val_t, seq, multi>::split_at(const key_t& key,
+                                           const uint32_t worker_id) {
+  static_assert(!ValRetire<val_t>::owns_storage,
+                "the value arena can not be split");
+  rcu_progress(*rcu, worker_id);
+
+  rcu->status[worker_id].waiting = true;
+  std::lock_guard<std::mutex> guard(root_update_mut);
+  rcu->status[worker_id].waiting = false;
+
+  // the keys >= key leave this index, which a replica sees as a range delete
+  std::vector<size_t> stripe_ids;
+  if (change_log != nullptr) {
+    change_log->all_stripes(stripe_ids);
+    change_log->lock(stripe_ids, worker_id);
+  }
+
+  if (hints != nullptr) {
+    hints->begin_update();
+  }
+  std::vector<group_t*> lower, upper;
+  root_t* old_root = root;
+  old_root->split_at(key, worker_id, lower, upper);
+  std::unique_ptr<XIndex> upper_index;
+  if (!lower.empty() && !upper.empty()) {
+    root = old_root->create_new_root_from(lower);
+    upper_index.reset(
+        new XIndex(old_root->create_new_root_from(upper), rcu->worker_n,
+                   bg_num));
+    memory_fence();
+  }
+
+  if (change_log != nullptr) {
+    if (upper_index != nullptr) {
+      change_t change{0, ChangeOp::remove_range, key, key_t::max(), val_t()};
+      change_log->append(worker_id, &change, 1);
+    }
+    change_log->unlock(stripe_ids);
+  }
+  if (upper_index == nullptr) {
+    if (hints != nullptr) {
+      hints->end_update();
+    }
+    return upper_index;
+  }
+
+  rcu_barrier(worker_id);  // no one uses the old root now
+  root->trim_root();
+  upper_index->root->trim_root();
+  // the new roots own the groups now
+  old_root->groups = nullptr;
+
+  const size_t bytes_to_delete = sizeof(decltype(*old_root));
+  assert(_::allocated_bytes > bytes_to_delete);
+  _::allocated_bytes -= bytes_to_delete;
+  delete old_root;
+  if (hints != nullptr) {
+    hints->end_update();
+  }
+  DEBUG_THIS("--- [root] split_at: group_n " << root->group_n << " + "
+                                              << upper_index->root->group_n);
+  return upper_index;
 }
 
-template <class key_t, class val_t, bool seq>
-inline size_t XIndex<key_t, val_t, seq>::scan(
+template <class key_t, class val_t, bool seq, bool multi>
+inline size_t XIndex<key_t, val_t, seq, multi>::scan(
     const key_t& begin, const size_t n,
     std::vector<std::pair<key_t, val_t>>& result, const uint32_t worker_id) {
-  rcu_progress(worker_id);
+  rcu_progress(*rcu, worker_id);
   return root->scan(begin, n, result);
 }
 
-template <class key_t, class val_t, bool seq>
-size_t XIndex<key_t, val_t, seq>::range_scan(
+template <class key_t, class val_t, bool seq, bool multi>
+size_t XIndex<key_t, val_t, seq, multi>::range_scan(
     const key_t& begin, const key_t& end,
     std::vector<std::pair<key_t, val_t>>& result, const uint32_t worker_id) {
-  rcu_progress(worker_id);
+  rcu_progress(*rcu, worker_id);
   return root->range_scan(begin, end, result);
 }
 
-template <class key_t, class val_t, bool seq>
-void* XIndex<key_t, val_t, seq>::background(void* this_) {
+template <class key_t, class val_t, bool seq, bool multi>
+template <class visit_t>
+size_t XIndex<key_t, val_t, seq, multi>::multi_range_scan(
+    const std::vector<std::pair<key_t, key_t>>& ranges, visit_t visit,
+    const uint32_t worker_id) {
+  rcu_progress(*rcu, worker_id);
+  return root->multi_range_scan(ranges.data(), ranges.size(), visit);
+}
+
+// the helper threads have no worker ids of their own, they are covered by the
+// caller's, which does not make progress until they are done
+template <class key_t, class val_t, bool seq, bool multi>
+template <class fn_t>
+size_t XIndex<key_t, val_t, seq, multi>::parallel_for_each(
+    const key_t& begin, const key_t& end, fn_t fn, size_t thread_n,
+    const uint32_t worker_id) {
+  INVARIANT(thread_n > 0);
+  rcu_progress(*rcu, worker_id);
+  return root->parallel_for_each(begin, end, fn, thread_n);
+}
+
+// the records are counted per part first, so that each part can be written to
+// its own region of the files in a second pass over the same root
+template <class key_t, class val_t, bool seq, bool multi>
+bool XIndex<key_t, val_t, seq, multi>::export_sosd(const std::string& key_path,
+                                                   const std::string& val_path,
+                                                   size_t thread_n,
+                                                   const uint32_t worker_id) {
+  static_assert(has_radix_key<key_t>::value,
+                "SOSD files hold 64-bit integer keys, see radix_key");
+  static_assert(std::is_trivially_copyable<val_t>::value &&
+                    !std::is_same<val_t, VarVal>::value,
+                "values are exported as raw bytes");
+  struct alignas(CACHELINE_SIZE) Part {
+    size_t record_n = 0;
+    std::unique_ptr<RegionWriter> keys, vals;
+  };
+
+  INVARIANT(thread_n > 0);
+  rcu_progress(*rcu, worker_id);
+  root_t* root = this->root;
+  std::vector<Part> parts(thread_n * root_t::parts_per_thread);
+  auto count = [&parts](size_t part_i, const key_t&, const val_t&) {
+    parts[part_i].record_n++;
+  };
+  size_t part_n =
+      root->parallel_for_each(key_t::min(), key_t::max(), count, thread_n);
+  // the parts end before key_t::max(), its records go to the last part
+  std::vector<val_t> max_vals;
+  root->equal_range(key_t::max(), max_vals);
+  for (const val_t& val : max_vals) {
+    count(part_n - 1, key_t::max(), val);
+  }
+  uint64_t record_n = 0;
+  for (size_t part_i = 0; part_i < part_n; part_i++) {
+    record_n += parts[part_i].record_n;
+  }
+
+  int key_fd = export_create(key_path, record_n, sizeof(uint64_t));
+  int val_fd = export_create(val_path, record_n, sizeof(val_t));
+  bool ok = key_fd >= 0 && val_fd >= 0;
+  if (ok) {
+    size_t offset = 0;
+    for (size_t part_i = 0; part_i < part_n; part_i++) {
+      Part& part = parts[part_i];
+      const size_t header_size = sizeof(uint64_t);
+      part.keys.reset(new RegionWriter(key_fd,
+                                       header_size + offset * sizeof(uint64_t),
+                                       part.record_n * sizeof(uint64_t)));
+      part.vals.reset(new RegionWriter(val_fd,
+                                       header_size + offset * sizeof(val_t),
+                                       part.record_n * sizeof(val_t)));
+      offset += part.record_n;
+    }
+    auto write = [&parts](size_t part_i, const key_t& key, const val_t& val) {
+      uint64_t radix_key = key.radix_key();
+      parts[part_i].keys->append(&radix_key, sizeof(uint64_t));
+      parts[part_i].vals->append(&val, sizeof(val_t));
+    };
+    root->parallel_for_each(key_t::min(), key_t::max(), write, thread_n);
+    for (const val_t& val : max_vals) {
+      write(part_n - 1, key_t::max(), val);
+    }
+    for (size_t part_i = 0; part_i < part_n; part_i++) {
+      ok = parts[part_i].keys->done() && parts[part_i].vals->done() && ok;
+    }
+  }
+  if (key_fd >= 0) {
+    close(key_fd);
+  }
+  if (val_fd >= 0) {
+    close(val_fd);
+  }
+  return ok;
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+size_t XIndex<key_t, val_t, seq, multi>::process(op_queue_t& queue,
+                                                 const uint32_t worker_id,
+                                                 size_t max_n) {
+  const size_t batch_n = 16;
+  key_t keys[batch_n];
+  size_t done_n = 0;
+  size_t n;
+  while ((n = queue.ready(std::min(batch_n, max_n - done_n))) > 0) {
+    for (size_t req_i = 0; req_i < n; req_i++) {
+      keys[req_i] = queue.submission(req_i).key;
+    }
+    rcu_progress(*rcu, worker_id);
+    root->prefetch(keys, n);
+
+    for (size_t req_i = 0; req_i < n; req_i++) {
+      const typename op_queue_t::submission_t& req = queue.submission(req_i);
+      typename op_queue_t::completion_t& comp = queue.completion(req_i);
+      comp.user_data = req.user_data;
+      comp.n = 0;
+      switch (req.op) {
+        case QueueOp::get:
+          comp.ok = get(req.key, comp.val, worker_id);
+          break;
+        case QueueOp::put:
+          comp.ok = put(req.key, req.val, worker_id);
+          break;
+        case QueueOp::remove:
+          comp.ok = remove(req.key, worker_id);
+          break;
+        case QueueOp::scan:
+          comp.n = scan(req.key, req.n, *req.scan_result, worker_id);
+          comp.ok = true;
+          break;
+      }
+    }
+    queue.complete(n);
+    done_n += n;
+  }
+  return done_n;
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+void* XIndex<key_t, val_t, seq, multi>::background(void* this_) {
   volatile XIndex& index = *(XIndex*)this_;
   if (index.bg_num == 0)
     return nullptr;
 
   size_t bg_num = index.bg_num;
+  hints_t* hints = ((XIndex*)this_)->hints.get();
+  rcu_domain = ((XIndex*)this_)->rcu.get();
+  std::mutex& root_update_mut = ((XIndex*)this_)->root_update_mut;
   std::vector<pthread_t> threads(bg_num);
   std::vector<bg_info_t> info(bg_num);
 
@@ -146,6 +718,7 @@ void* XIndex<key_t, val_t, seq>::background(void* this_) {
     info[bg_i].finished = false;
     info[bg_i].running = true;
     info[bg_i].should_update_array = false;
+    info[bg_i].rcu = rcu_domain;
 
     int ret = pthread_create(&threads[bg_i], nullptr, root_t::do_adjustment,
                              &info[bg_i]);
@@ -156,6 +729,10 @@ void* XIndex<key_t, val_t, seq>::background(void* this_) {
 
   while (index.bg_running) {
     DEBUG_THIS("--- [bg] new round of structure update");
+    std::unique_lock<std::mutex> round_guard(root_update_mut);
+    if (hints != nullptr) {
+      hints->begin_update();
+    }
 
     for (size_t bg_i = 0; bg_i < bg_num; bg_i++) {
       info[bg_i].started = true;
@@ -194,6 +771,8 @@ void* XIndex<key_t, val_t, seq>::background(void* this_) {
       memory_fence();
       rcu_barrier();
       index.root->trim_root();
+      // the new root owns the groups now
+      old_root->groups = nullptr;
 
       const size_t bytes_to_delete = sizeof(decltype(*old_root));
       assert(_::allocated_bytes > bytes_to_delete);
@@ -217,6 +796,13 @@ void* XIndex<key_t, val_t, seq>::background(void* this_) {
 
     memory_fence();  // ensure the background theads and the workers all see a
     rcu_barrier();   // correct final stage of root.groups
+    if (hints != nullptr) {
+      hints->end_update();
+    }
+    round_guard.unlock();
+    if (hints != nullptr) {
+      sleep(1);  // hints are off during rounds, leave them on in between
+    }
   }
 
   for (size_t bg_i = 0; bg_i < bg_num; bg_i++) {
@@ -235,8 +821,8 @@ void* XIndex<key_t, val_t, seq>::background(void* this_) {
   return nullptr;
 }
 
-template <class key_t, class val_t, bool seq>
-void XIndex<key_t, val_t, seq>::start_bg() {
+template <class key_t, class val_t, bool seq, bool multi>
+void XIndex<key_t, val_t, seq, multi>::start_bg() {
   bg_running = true;
   int ret = pthread_create(&bg_master, nullptr, background, this);
   if (ret) {
@@ -244,14 +830,14 @@ void XIndex<key_t, val_t, seq>::start_bg() {
   }
 }
 
-template <class key_t, class val_t, bool seq>
-void XIndex<key_t, val_t, seq>::terminate_bg() {
+template <class key_t, class val_t, bool seq, bool multi>
+void XIndex<key_t, val_t, seq, multi>::terminate_bg() {
   config.exited = true;
   bg_running = false;
 }
 
-template <class key_t, class val_t, bool seq>
-_::ByteSize XIndex<key_t, val_t, seq>::byte_size() const {
+template <class key_t, class val_t, bool seq, bool multi>
+_::ByteSize XIndex<key_t, val_t, seq, multi>::byte_size() const {
   // Metdata size like root pointer. This is not entirely accurate since the bg_master thread metadata is not fully accounted for.
   // However, this constant overhead is insignificant compared to actual data size (accounted for below)
   const auto size = sizeof(decltype(*this));
@@ -260,14 +846,59 @@ _::ByteSize XIndex<key_t, val_t, seq>::byte_size() const {
   // recursively count size of nodes
   if (root != nullptr)
     total_size += root->byte_size();
+  if (arena != nullptr)
+    total_size += arena->byte_size();
+  if (change_log != nullptr)
+    total_size += change_log->byte_size();
+  if (hints != nullptr)
+    total_size += hints->byte_size();
 
   return total_size;
 }
-template <class key_t, class val_t, bool seq>
-void XIndex<key_t, val_t, seq>::force_adjustment_sync() {
+
+template <class key_t, class val_t, bool seq, bool multi>
+IndexShape<key_t> XIndex<key_t, val_t, seq, multi>::shape() {
+  IndexShape<key_t> shape;
+  root->collect_shape(shape);
+  return shape;
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+typename XIndex<key_t, val_t, seq, multi>::change_log_t*
+XIndex<key_t, val_t, seq, multi>::enable_change_log(size_t ring_size) {
+  static_assert(!ValRetire<val_t>::owns_storage,
+                "logged values must outlive their removal from the index");
+  INVARIANT(change_log == nullptr);
+  change_log = std::make_unique<change_log_t>(*rcu, ring_size);
+  return change_log.get();
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+void XIndex<key_t, val_t, seq, multi>::materialize_all() {
+  root->materialize_all();
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+void XIndex<key_t, val_t, seq, multi>::quiesce(const uint32_t worker_id) {
+  rcu_quiesce(*rcu, worker_id);
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+void XIndex<key_t, val_t, seq, multi>::force_adjustment_sync() {
   if (root == nullptr)
     return;
 
+  // the barriers between the adjustment phases skip idle workers, including
+  // the one of the calling thread, which also must not hold up the barrier of
+  // a concurrent remove_range while waiting
+  if (rcu_worker_id < rcu->worker_n) {
+    rcu_quiesce(*rcu, rcu_worker_id);
+  }
+  rcu_domain = rcu.get();
+  std::lock_guard<std::mutex> guard(root_update_mut);
+  if (hints != nullptr) {
+    hints->begin_update();
+  }
   bool should_update_array = false;
   root->force_adjustment_sync(should_update_array);
 
@@ -275,6 +906,8 @@ void XIndex<key_t, val_t, seq>::force_adjustment_sync() {
     root_t* old_root = this->root;
     this->root = old_root->create_new_root();
     this->root->trim_root();
+    // the new root owns the groups now
+    old_root->groups = nullptr;
 
     const size_t bytes_to_delete = sizeof(decltype(*old_root));
     assert(_::allocated_bytes > bytes_to_delete);
@@ -295,6 +928,9 @@ void XIndex<key_t, val_t, seq>::force_adjustment_sync() {
     DEBUG_THIS("--- [root] avg_group_error: " << avg_group_error);
     DEBUG_THIS("--- [root] max_group_error: " << max_group_error);
   }
+  if (hints != nullptr) {
+    hints->end_update();
+  }
 }
 
 }  // namespace xindex
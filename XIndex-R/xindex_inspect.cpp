@@ -0,0 +1,366 @@
+/*
+ * The code is part of the XIndex project.
+ *
+ *    Copyright (C) 2020 Institute of Parallel and Distributed Systems (IPADS),
+ * Shanghai Jiao Tong University. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For more about XIndex, visit:
+ *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
+ */
+
+#include <getopt.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "helper.h"
+#include "xindex.h"
+#include "xindex_impl.h"
+
+class Key;
+
+typedef xindex::XIndex<Key, uint64_t> xindex_t;
+typedef xindex::IndexShape<Key> shape_t;
+
+inline void load_keys(std::vector<uint64_t>& keys);
+inline void print_shape(const shape_t& shape);
+inline void write_groups_csv(const shape_t& shape);
+inline void parse_args(int, char**);
+
+// parameters
+std::string key_path;
+std::string format;  // sosd or csv, by default from the file name
+size_t key_bits = 0;  // of SOSD keys, by default from the file name
+std::string groups_csv_path;
+bool adjust = false;
+
+class Key {
+  typedef std::array<double, 1> model_key_t;
+
+ public:
+  static constexpr size_t model_key_size() { return 1; }
+  static Key max() {
+    static Key max_key(std::numeric_limits<uint64_t>::max());
+    return max_key;
+  }
+  static Key min() {
+    static Key min_key(std::numeric_limits<uint64_t>::min());
+    return min_key;
+  }
+
+  Key() : key(0) {}
+  Key(uint64_t key) : key(key) {}
+  Key(const Key& other) { key = other.key; }
+  Key& operator=(const Key& other) {
+    key = other.key;
+    return *this;
+  }
+
+  model_key_t to_model_key() const {
+    model_key_t model_key;
+    model_key[0] = key;
+    return model_key;
+  }
+
+  uint64_t radix_key() const { return key; }
+
+  friend bool operator<(const Key& l, const Key& r) { return l.key < r.key; }
+  friend bool operator>(const Key& l, const Key& r) { return l.key > r.key; }
+  friend bool operator>=(const Key& l, const Key& r) { return l.key >= r.key; }
+  friend bool operator<=(const Key& l, const Key& r) { return l.key <= r.key; }
+  friend bool operator==(const Key& l, const Key& r) { return l.key == r.key; }
+  friend bool operator!=(const Key& l, const Key& r) { return l.key != r.key; }
+
+  uint64_t key;
+} PACKED;
+
+// counts of values in power-of-two buckets: [0], [1], [2, 4), [4, 8), ...
+class Histogram {
+ public:
+  explicit Histogram(const std::string& title) : title(title) {}
+
+  void add(double val) {
+    size_t bucket_i = val < 1 ? 0 : (size_t)std::log2(val) + 1;
+    if (bucket_i >= counts.size()) {
+      counts.resize(bucket_i + 1, 0);
+    }
+    counts[bucket_i]++;
+    total++;
+  }
+
+  void print() const {
+    const size_t bar_width = 50;
+    size_t max_count = 0;
+    for (size_t count : counts) {
+      max_count = std::max(max_count, count);
+    }
+    size_t first_i = 0;
+    while (first_i < counts.size() && counts[first_i] == 0) {
+      first_i++;
+    }
+    std::cout << title << " (" << total << ")" << std::endl;
+    for (size_t bucket_i = first_i; bucket_i < counts.size(); bucket_i++) {
+      std::string range =
+          bucket_i == 0 ? "0"
+                        : bucket_i == 1
+                              ? "1"
+                              : std::to_string(1ull << (bucket_i - 1)) + "-" +
+                                    std::to_string((1ull << bucket_i) - 1);
+      size_t bar = max_count > 0 ? counts[bucket_i] * bar_width / max_count : 0;
+      std::cout << std::setw(24) << range << " " << std::setw(10)
+                << counts[bucket_i] << " " << std::string(bar, '#')
+                << std::endl;
+    }
+    std::cout << std::endl;
+  }
+
+ private:
+  std::string title;
+  std::vector<size_t> counts;
+  size_t total = 0;
+};
+
+int main(int argc, char** argv) {
+  parse_args(argc, argv);
+
+  std::vector<uint64_t> raw_keys;
+  load_keys(raw_keys);
+  size_t loaded_n = raw_keys.size();
+  std::sort(raw_keys.begin(), raw_keys.end());
+  raw_keys.erase(std::unique(raw_keys.begin(), raw_keys.end()),
+                 raw_keys.end());
+  INVARIANT(raw_keys.size() > 0);
+  COUT_THIS("[inspect] loaded " << loaded_n << " keys, "
+                                << loaded_n - raw_keys.size()
+                                << " duplicates dropped");
+
+  std::vector<Key> keys(raw_keys.begin(), raw_keys.end());
+  std::vector<uint64_t> vals(keys.size(), 0);
+  raw_keys = std::vector<uint64_t>();
+  xindex_t table(keys, vals, 1, 0);
+  if (adjust) {
+    table.force_adjustment_sync();
+  }
+
+  shape_t shape = table.shape();
+  print_shape(shape);
+  if (!groups_csv_path.empty()) {
+    write_groups_csv(shape);
+  }
+}
+
+inline void load_keys(std::vector<uint64_t>& keys) {
+  std::ifstream in(key_path, std::ios::binary);
+  if (!in) {
+    COUT_N_EXIT("Error: can not open " << key_path);
+  }
+
+  if (format == "csv") {
+    // the first column of each line, lines that do not start with a number
+    // (e.g., a header) are skipped
+    std::string line;
+    while (std::getline(in, line)) {
+      char* end;
+      uint64_t key = strtoull(line.c_str(), &end, 10);
+      if (end != line.c_str()) {
+        keys.push_back(key);
+      }
+    }
+    return;
+  }
+
+  // SOSD: a 64-bit record count followed by the keys
+  uint64_t key_n = 0;
+  in.read((char*)&key_n, sizeof(key_n));
+  keys.resize(key_n);
+  if (key_bits == 64) {
+    in.read((char*)keys.data(), key_n * sizeof(uint64_t));
+  } else {
+    std::vector<uint32_t> keys_32(key_n);
+    in.read((char*)keys_32.data(), key_n * sizeof(uint32_t));
+    std::copy(keys_32.begin(), keys_32.end(), keys.begin());
+  }
+  if (!in) {
+    COUT_N_EXIT("Error: " << key_path << " holds less than " << key_n
+                          << " keys");
+  }
+}
+
+inline void print_shape(const shape_t& shape) {
+  size_t array_record_n = 0, model_n = 0;
+  double error_sum = 0, probe_n_sum = 0;
+  Histogram group_sizes("records per group");
+  Histogram group_errors("max error per group");
+  Histogram model_errors("max error per model");
+  Histogram group_probes("estimated key comparisons per lookup, per group");
+  for (auto& group : shape.groups) {
+    array_record_n += group.array_size;
+    model_n += group.model_n;
+    error_sum += group.mean_error * group.array_size;
+    probe_n_sum += group.mean_probe_n * group.array_size;
+    group_sizes.add(group.array_size + group.buffer_size);
+    group_errors.add(group.max_error);
+    group_probes.add(group.mean_probe_n);
+  }
+  for (size_t error : shape.model_errors) {
+    model_errors.add(error);
+  }
+
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "records: " << shape.record_n << std::endl;
+  std::cout << "groups: " << shape.groups.size() << " in "
+            << shape.root_slot_n << " root slots, " << model_n << " models"
+            << std::endl;
+  std::cout << "root rmi: " << shape.rmi_2nd_stage_model_n
+            << " 2nd stage models, max error " << shape.root_max_error
+            << " slots, mean error " << shape.root_mean_error << " slots"
+            << std::endl;
+  if (array_record_n > 0) {
+    std::cout << "group models: mean error " << error_sum / array_record_n
+              << ", estimated key comparisons per lookup "
+              << probe_n_sum / array_record_n << std::endl;
+  }
+
+  std::cout << "memory (used bytes):" << std::endl;
+  std::pair<const char*, const xindex::_::ByteSize*> components[] = {
+      {"root", &shape.root_bytes},     {"groups", &shape.group_bytes},
+      {"models", &shape.model_bytes},  {"arrays", &shape.array_bytes},
+      {"buffers", &shape.buffer_bytes}};
+  for (auto& component : components) {
+    std::cout << std::setw(24) << component.first << " " << std::setw(14)
+              << component.second->used << std::endl;
+  }
+  std::cout << std::endl;
+
+  group_sizes.print();
+  group_errors.print();
+  model_errors.print();
+  group_probes.print();
+}
+
+inline void write_groups_csv(const shape_t& shape) {
+  std::ofstream out(groups_csv_path);
+  if (!out) {
+    COUT_N_EXIT("Error: can not write " << groups_csv_path);
+  }
+  out << "group_i,pivot,array_size,buffer_size,model_n,max_error,mean_error,"
+         "mean_probe_n,bytes"
+      << std::endl;
+  for (auto& group : shape.groups) {
+    out << group.group_i << "," << group.pivot.key << "," << group.array_size
+        << "," << group.buffer_size << "," << group.model_n << ","
+        << group.max_error << "," << group.mean_error << ","
+        << group.mean_probe_n << "," << group.bytes << std::endl;
+  }
+  COUT_THIS("[inspect] wrote " << shape.groups.size() << " groups to "
+                               << groups_csv_path);
+}
+
+inline void parse_args(int argc, char** argv) {
+  struct option long_options[] = {
+      {"keys", required_argument, 0, 'a'},
+      {"format", required_argument, 0, 'b'},
+      {"key-bits", required_argument, 0, 'c'},
+      {"groups-csv", required_argument, 0, 'd'},
+      {"adjust", no_argument, 0, 'e'},
+      {"xindex-root-err-bound", required_argument, 0, 'f'},
+      {"xindex-root-memory", required_argument, 0, 'g'},
+      {"xindex-group-err-bound", required_argument, 0, 'h'},
+      {"xindex-group-err-tolerance", required_argument, 0, 'i'},
+      {"xindex-buf-size-bound", required_argument, 0, 'j'},
+      {0, 0, 0, 0}};
+  std::string ops = "a:b:c:d:ef:g:h:i:j:";
+  int option_index = 0;
+
+  while (1) {
+    int c = getopt_long(argc, argv, ops.c_str(), long_options, &option_index);
+    if (c == -1)
+      break;
+
+    switch (c) {
+      case 0:
+        if (long_options[option_index].flag != 0)
+          break;
+        abort();
+        break;
+      case 'a':
+        key_path = optarg;
+        break;
+      case 'b':
+        format = optarg;
+        INVARIANT(format == "sosd" || format == "csv");
+        break;
+      case 'c':
+        key_bits = strtoul(optarg, NULL, 10);
+        INVARIANT(key_bits == 32 || key_bits == 64);
+        break;
+      case 'd':
+        groups_csv_path = optarg;
+        break;
+      case 'e':
+        adjust = true;
+        break;
+      case 'f':
+        xindex::config.root_error_bound = strtol(optarg, NULL, 10);
+        INVARIANT(xindex::config.root_error_bound > 0);
+        break;
+      case 'g':
+        xindex::config.root_memory_constraint =
+            strtol(optarg, NULL, 10) * 1024 * 1024;
+        INVARIANT(xindex::config.root_memory_constraint > 0);
+        break;
+      case 'h':
+        xindex::config.group_error_bound = strtol(optarg, NULL, 10);
+        INVARIANT(xindex::config.group_error_bound > 0);
+        break;
+      case 'i':
+        xindex::config.group_error_tolerance = strtol(optarg, NULL, 10);
+        INVARIANT(xindex::config.group_error_tolerance > 0);
+        break;
+      case 'j':
+        xindex::config.buffer_size_bound = strtol(optarg, NULL, 10);
+        INVARIANT(xindex::config.buffer_size_bound > 0);
+        break;
+      default:
+        abort();
+    }
+  }
+
+  if (key_path.empty()) {
+    COUT_N_EXIT("Error: --keys is required");
+  }
+  if (format.empty()) {
+    bool is_csv = key_path.size() >= 4 &&
+                  key_path.compare(key_path.size() - 4, 4, ".csv") == 0;
+    format = is_csv ? "csv" : "sosd";
+  }
+  // SOSD names 32-bit data sets *_uint32
+  if (key_bits == 0) {
+    key_bits = key_path.find("uint32") != std::string::npos ? 32 : 64;
+  }
+
+  COUT_VAR(key_path);
+  COUT_VAR(format);
+  COUT_VAR(key_bits);
+  COUT_VAR(xindex::config.root_error_bound);
+  COUT_VAR(xindex::config.group_error_bound);
+  COUT_VAR(xindex::config.group_error_tolerance);
+}
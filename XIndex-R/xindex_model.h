@@ -20,25 +20,70 @@
  *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
  */
 
+#include <bitset>
+#include <type_traits>
+
 #include "mkl.h"
 #include "mkl_lapacke.h"
+#include "xindex_simd.h"
+#include "xindex_util.h"
 
 #if !defined(XINDEX_MODEL_H)
 #define XINDEX_MODEL_H
 
 namespace xindex {
 
+// Keys that implement `common_prefix_len()` and `to_model_key(prefix_len)`
+// (e.g., StrKey) are featurized after stripping the prefix shared by all
+// training keys of a model. Other keys carry no prefix state (empty base).
+template <class key_t, class = void>
+struct ModelKeyPrefix {
+  static constexpr bool enabled = false;
+  size_t get_prefix_len() const { return 0; }
+  void set_prefix_len(size_t) {}
+};
+
+template <class key_t>
+struct ModelKeyPrefix<
+    key_t, std::void_t<decltype(std::declval<const key_t&>().common_prefix_len(
+               std::declval<const key_t&>()))>> {
+  static constexpr bool enabled = true;
+  size_t get_prefix_len() const { return prefix_len; }
+  void set_prefix_len(size_t len) { prefix_len = len; }
+
+  uint32_t prefix_len = 0;
+};
+
+// Models of keys with many features (trained by LAPACK) remember which
+// features had to be dropped as linearly dependent, so retraining does not
+// repeat the failing least-squares runs. Small models need no such state.
+template <class key_t, bool enabled_ = (key_t::model_key_size() >
+                                        small_model_key_size)>
+struct ModelFeatSelection {
+  static constexpr bool enabled = false;
+};
+
 template <class key_t>
-class LinearModel {
+struct ModelFeatSelection<key_t, true> {
+  static constexpr bool enabled = true;
+
+  std::bitset<key_t::model_key_size()> dropped_feats;
+};
+
+template <class key_t>
+class LinearModel : private ModelKeyPrefix<key_t>,
+                    private ModelFeatSelection<key_t> {
   typedef std::array<double, key_t::model_key_size()> model_key_t;
-  template <class key_t_, class val_t, bool seq>
+  typedef ModelKeyPrefix<key_t> prefix_t;
+  typedef ModelFeatSelection<key_t> feat_selection_t;
+  template <class key_t_, class val_t, bool seq, bool multi>
   friend class Root;
 
  public:
   void prepare(const std::vector<key_t>& keys,
                const std::vector<size_t>& positions);
   void prepare(const typename std::vector<key_t>::const_iterator& keys_begin,
-               uint32_t size);
+               size_t size);
   void prepare_model(const std::vector<double*>& model_key_ptrs,
                      const std::vector<size_t>& positions);
   size_t predict(const key_t& key) const;
@@ -46,12 +91,18 @@ class LinearModel {
                          const std::vector<size_t>& positions);
   size_t get_error_bound(
       const typename std::vector<key_t>::const_iterator& keys_begin,
-      uint32_t size);
+      size_t size);
 
   /// computes the in memory size in bytes
   static size_t byte_size() { return sizeof(LinearModel<key_t>); }
 
  private:
+  template <class model_key_at_t, class pos_at_t>
+  void prepare_small(const model_key_at_t& model_key_at,
+                     const pos_at_t& pos_at, size_t size);
+  inline model_key_t to_model_key(const key_t& key) const;
+  void set_common_prefix(const key_t& first, const key_t& last);
+
   std::array<double, key_t::model_key_size() + 1> weights;
 };
 
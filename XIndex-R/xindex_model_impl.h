@@ -33,10 +33,17 @@ void LinearModel<key_t>::prepare(const std::vector<key_t> &keys,
   assert(keys.size() == positions.size());
   if (keys.size() == 0) return;
 
+  set_common_prefix(keys.front(), keys.back());
+  if (key_t::model_key_size() <= small_model_key_size) {
+    prepare_small([&](size_t i) { return to_model_key(keys[i]); },
+                  [&](size_t i) { return positions[i]; }, keys.size());
+    return;
+  }
+
   std::vector<model_key_t> model_keys(keys.size());
   std::vector<double *> key_ptrs(keys.size());
   for (size_t i = 0; i < keys.size(); i++) {
-    model_keys[i] = keys[i].to_model_key();
+    model_keys[i] = to_model_key(keys[i]);
     key_ptrs[i] = model_keys[i].data();
   }
 
@@ -46,14 +53,21 @@ void LinearModel<key_t>::prepare(const std::vector<key_t> &keys,
 template <class key_t>
 void LinearModel<key_t>::prepare(
     const typename std::vector<key_t>::const_iterator &keys_begin,
-    uint32_t size) {
+    size_t size) {
   if (size == 0) return;
 
+  set_common_prefix(*keys_begin, *(keys_begin + size - 1));
+  if (key_t::model_key_size() <= small_model_key_size) {
+    prepare_small([&](size_t i) { return to_model_key(*(keys_begin + i)); },
+                  [](size_t i) { return i; }, size);
+    return;
+  }
+
   std::vector<model_key_t> model_keys(size);
   std::vector<double *> key_ptrs(size);
   std::vector<size_t> positions(size);
   for (size_t i = 0; i < size; i++) {
-    model_keys[i] = (keys_begin + i)->to_model_key();
+    model_keys[i] = to_model_key(*(keys_begin + i));
     key_ptrs[i] = model_keys[i].data();
     positions[i] = i;
   }
@@ -113,21 +127,39 @@ void LinearModel<key_t>::prepare_model(
   if (model_key_ptrs.size() != 1 && useful_feat_index.size() == 0) {
     COUT_THIS("all feats are the same");
   }
+  if constexpr (feat_selection_t::enabled) {
+    // skip features that were linearly dependent in the previous training
+    auto &dropped_feats = feat_selection_t::dropped_feats;
+    decltype(feat_selection_t::dropped_feats) still_dropped;
+    if (useful_feat_index.size() > dropped_feats.count()) {
+      useful_feat_index.erase(
+          std::remove_if(useful_feat_index.begin(), useful_feat_index.end(),
+                         [&](size_t feat_i) {
+                           still_dropped[feat_i] = dropped_feats[feat_i];
+                           return dropped_feats[feat_i];
+                         }),
+          useful_feat_index.end());
+    }
+    dropped_feats = still_dropped;
+  }
   size_t useful_feat_n = useful_feat_index.size();
   bool use_bias = true;
 
+  // allocate for the largest problem once, retries only shrink it
+  int m = model_key_ptrs.size() / step;  // number of samples
+  int max_n = useful_feat_n + 1;
+  double *a = (double *)malloc(m * max_n * sizeof(double));
+  double *b = (double *)malloc(std::max(m, max_n) * sizeof(double));
+  if (a == nullptr || b == nullptr) {
+    COUT_N_EXIT("cannot allocate memory for matrix a or b");
+  }
+
   // we may need multiple runs to avoid "not full rank" error
   int fitting_res = -1;
   while (fitting_res != 0) {
     // use LAPACK to solve least square problem, i.e., to minimize ||b-Ax||_2
     // where b is the actual positions, A is inputmodel_keys
-    int m = model_key_ptrs.size() / step;                  // number of samples
     int n = use_bias ? useful_feat_n + 1 : useful_feat_n;  // number of features
-    double *a = (double *)malloc(m * n * sizeof(double));
-    double *b = (double *)malloc(std::max(m, n) * sizeof(double));
-    if (a == nullptr || b == nullptr) {
-      COUT_N_EXIT("cannot allocate memory for matrix a or b");
-    }
 
     for (int sample_i = 0; sample_i < m; ++sample_i) {
       // we only fit with useful features
@@ -158,6 +190,9 @@ void LinearModel<key_t>::prepare_model(
         use_bias = false;
       } else {
         size_t feat_i = fitting_res - 1;
+        if constexpr (feat_selection_t::enabled) {
+          feat_selection_t::dropped_feats.set(useful_feat_index[feat_i]);
+        }
         useful_feat_index.erase(useful_feat_index.begin() + feat_i);
         useful_feat_n = useful_feat_index.size();
       }
@@ -186,16 +221,129 @@ void LinearModel<key_t>::prepare_model(
       size_t key_len = key_t::model_key_size();
       weights[key_len] = b[n - 1];
     }
-
-    free(a);
-    free(b);
   }
+  free(a);
+  free(b);
   assert(fitting_res == 0);
 }
 
+// Allocation-free training for keys with few features: the least-squares
+// problem is solved through its (mean-centered) normal equations on the
+// stack. Features that are constant or linearly dependent on earlier ones
+// get a zero pivot and are dropped in the same elimination pass, so there
+// is no retry loop as with LAPACK.
+template <class key_t>
+template <class model_key_at_t, class pos_at_t>
+void LinearModel<key_t>::prepare_small(const model_key_at_t &model_key_at,
+                                       const pos_at_t &pos_at, size_t size) {
+  constexpr size_t key_len = key_t::model_key_size();
+  static_assert(key_len <= small_model_key_size, "too many features");
+  if (size == 0) return;
+  if (size == 1) {
+    weights.fill(0);
+    weights[key_len] = pos_at(0);
+    return;
+  }
+
+  if (key_len == 1) {
+    double x_expected = 0, y_expected = 0, xy_expected = 0,
+           x_square_expected = 0;
+    for (size_t key_i = 0; key_i < size; key_i++) {
+      double key = model_key_at(key_i)[0];
+      double pos = pos_at(key_i);
+      x_expected += key;
+      y_expected += pos;
+      x_square_expected += key * key;
+      xy_expected += key * pos;
+    }
+    x_expected /= size;
+    y_expected /= size;
+    x_square_expected /= size;
+    xy_expected /= size;
+
+    weights[0] = (xy_expected - x_expected * y_expected) /
+                 (x_square_expected - x_expected * x_expected);
+    weights[1] = (x_square_expected * y_expected - x_expected * xy_expected) /
+                 (x_square_expected - x_expected * x_expected);
+    return;
+  }
+
+  // trim down samples like the LAPACK path does
+  size_t step = 1;
+  if (size > desired_training_key_n) {
+    step = size / desired_training_key_n;
+  }
+
+  std::array<double, key_len> x_mean{};
+  double y_mean = 0;
+  size_t sample_n = 0;
+  for (size_t key_i = 0; key_i < size; key_i += step) {
+    model_key_t model_key = model_key_at(key_i);
+    for (size_t feat_i = 0; feat_i < key_len; feat_i++) {
+      x_mean[feat_i] += model_key[feat_i];
+    }
+    y_mean += pos_at(key_i);
+    sample_n++;
+  }
+  for (size_t feat_i = 0; feat_i < key_len; feat_i++) {
+    x_mean[feat_i] /= sample_n;
+  }
+  y_mean /= sample_n;
+
+  // [X^T X | X^T y] of the centered samples
+  std::array<std::array<double, key_len + 1>, key_len> mat{};
+  for (size_t key_i = 0; key_i < size; key_i += step) {
+    model_key_t model_key = model_key_at(key_i);
+    for (size_t feat_i = 0; feat_i < key_len; feat_i++) {
+      model_key[feat_i] -= x_mean[feat_i];
+    }
+    double pos = pos_at(key_i) - y_mean;
+    for (size_t row_i = 0; row_i < key_len; row_i++) {
+      for (size_t col_i = row_i; col_i < key_len; col_i++) {
+        mat[row_i][col_i] += model_key[row_i] * model_key[col_i];
+      }
+      mat[row_i][key_len] += model_key[row_i] * pos;
+    }
+  }
+  for (size_t row_i = 0; row_i < key_len; row_i++) {
+    for (size_t col_i = 0; col_i < row_i; col_i++) {
+      mat[row_i][col_i] = mat[col_i][row_i];
+    }
+  }
+
+  // Gauss-Jordan on the symmetric PSD system with diagonal pivots
+  std::array<double, key_len> diag;
+  for (size_t feat_i = 0; feat_i < key_len; feat_i++) {
+    diag[feat_i] = mat[feat_i][feat_i];
+  }
+  std::array<bool, key_len> useful{};
+  for (size_t piv_i = 0; piv_i < key_len; piv_i++) {
+    double pivot = mat[piv_i][piv_i];
+    if (!(pivot > 1e-9 * diag[piv_i]) || diag[piv_i] == 0) {
+      continue;  // constant or dependent on previous features
+    }
+    useful[piv_i] = true;
+    for (size_t row_i = 0; row_i < key_len; row_i++) {
+      if (row_i == piv_i || mat[row_i][piv_i] == 0) continue;
+      double factor = mat[row_i][piv_i] / pivot;
+      for (size_t col_i = 0; col_i <= key_len; col_i++) {
+        mat[row_i][col_i] -= factor * mat[piv_i][col_i];
+      }
+    }
+  }
+
+  double bias = y_mean;
+  for (size_t feat_i = 0; feat_i < key_len; feat_i++) {
+    weights[feat_i] =
+        useful[feat_i] ? mat[feat_i][key_len] / mat[feat_i][feat_i] : 0;
+    bias -= weights[feat_i] * x_mean[feat_i];
+  }
+  weights[key_len] = bias;
+}
+
 template <class key_t>
 size_t LinearModel<key_t>::predict(const key_t &key) const {
-  model_key_t model_key = key.to_model_key();
+  model_key_t model_key = to_model_key(key);
   double *model_key_ptr = model_key.data();
 
   size_t key_len = key_t::model_key_size();
@@ -203,10 +351,8 @@ size_t LinearModel<key_t>::predict(const key_t &key) const {
     double res = weights[0] * *model_key_ptr + weights[1];
     return res > 0 ? res : 0;
   } else {
-    double res = 0;
-    for (size_t feat_i = 0; feat_i < key_len; feat_i++) {
-      res += weights[feat_i] * model_key_ptr[feat_i];
-    }
+    double res = simd::dot_product<key_t::model_key_size()>(weights.data(),
+                                                            model_key_ptr);
     res += weights[key_len];  // the bias term
     return res > 0 ? res : 0;
   }
@@ -215,12 +361,12 @@ size_t LinearModel<key_t>::predict(const key_t &key) const {
 template <class key_t>
 size_t LinearModel<key_t>::get_error_bound(
     const std::vector<key_t> &keys, const std::vector<size_t> &positions) {
-  int max = 0;
+  long long int max = 0;
 
   for (size_t key_i = 0; key_i < keys.size(); ++key_i) {
     long long int pos_actual = positions[key_i];
     long long int pos_pred = predict(keys[key_i]);
-    int error = std::abs(pos_actual - pos_pred);
+    long long int error = std::abs(pos_actual - pos_pred);
 
     if (error > max) {
       max = error;
@@ -233,13 +379,13 @@ size_t LinearModel<key_t>::get_error_bound(
 template <class key_t>
 size_t LinearModel<key_t>::get_error_bound(
     const typename std::vector<key_t>::const_iterator &keys_begin,
-    uint32_t size) {
-  int max = 0;
+    size_t size) {
+  long long int max = 0;
 
   for (size_t key_i = 0; key_i < size; ++key_i) {
     long long int pos_actual = key_i;
     long long int pos_pred = predict(*(keys_begin + key_i));
-    int error = std::abs(pos_actual - pos_pred);
+    long long int error = std::abs(pos_actual - pos_pred);
 
     if (error > max) {
       max = error;
@@ -249,6 +395,27 @@ size_t LinearModel<key_t>::get_error_bound(
   return max;
 }
 
+template <class key_t>
+inline typename LinearModel<key_t>::model_key_t
+LinearModel<key_t>::to_model_key(const key_t &key) const {
+  if constexpr (prefix_t::enabled) {
+    return key.to_model_key(prefix_t::get_prefix_len());
+  } else {
+    return key.to_model_key();
+  }
+}
+
+// training keys are sorted, so the prefix shared by the first and the last
+// key is shared by all of them
+template <class key_t>
+void LinearModel<key_t>::set_common_prefix(const key_t &first,
+                                           const key_t &last) {
+  if constexpr (prefix_t::enabled) {
+    assert(first <= last);
+    prefix_t::set_prefix_len(first.common_prefix_len(last));
+  }
+}
+
 }  // namespace xindex
 
 #endif  // XINDEX_MODEL_IMPL_H
@@ -0,0 +1,192 @@
+/*
+ * The code is part of the XIndex project.
+ *
+ *    Copyright (C) 2020 Institute of Parallel and Distributed Systems (IPADS),
+ * Shanghai Jiao Tong University. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For more about XIndex, visit:
+ *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "helper.h"
+#include "xindex_util.h"
+
+#if !defined(XINDEX_QUEUE_H)
+#define XINDEX_QUEUE_H
+
+namespace xindex {
+
+enum class QueueOp : uint8_t { get, put, remove, scan };
+
+template <class key_t, class val_t>
+struct Submission {
+  QueueOp op;
+  key_t key;
+  val_t val;  // value of put
+  size_t n;   // records to scan
+  // receives the records of a scan, owned by the caller until completion
+  std::vector<std::pair<key_t, val_t>>* scan_result;
+  uint64_t user_data;  // passed through to the completion
+};
+
+template <class key_t, class val_t>
+struct Completion {
+  uint64_t user_data;
+  bool ok;    // the key was found (get, remove) or the put succeeded
+  val_t val;  // value of get
+  size_t n;   // records returned by scan
+};
+
+/// Submission and completion rings of one caller thread. The caller submits
+/// requests and reaps their completions, while XIndex::process drains the
+/// submissions in batches and posts the completions in submission order.
+/// Each side must be used by one thread at a time, either the caller itself
+/// (inline) or one of the QueueThreads.
+template <class key_t, class val_t>
+class OpQueue {
+ public:
+  typedef Submission<key_t, val_t> submission_t;
+  typedef Completion<key_t, val_t> completion_t;
+
+  explicit OpQueue(size_t size)
+      : mask(size - 1),
+        submissions(new submission_t[size]),
+        completions(new completion_t[size]) {
+    INVARIANT(size > 0 && (size & mask) == 0);
+  }
+  OpQueue(const OpQueue&) = delete;
+  OpQueue& operator=(const OpQueue&) = delete;
+
+  /// returns false if the submission ring is full
+  bool submit(const submission_t& submission) {
+    uint64_t tail = sub_tail.load(std::memory_order_relaxed);
+    if (tail - sub_head.load(std::memory_order_acquire) > mask) {
+      return false;
+    }
+    submissions[tail & mask] = submission;
+    sub_tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// moves up to max_n completions to out and returns how many
+  size_t reap(completion_t* out, size_t max_n) {
+    uint64_t head = comp_head.load(std::memory_order_relaxed);
+    size_t n = std::min<size_t>(
+        comp_tail.load(std::memory_order_acquire) - head, max_n);
+    for (size_t comp_i = 0; comp_i < n; comp_i++) {
+      out[comp_i] = completions[(head + comp_i) & mask];
+    }
+    comp_head.store(head + n, std::memory_order_release);
+    return n;
+  }
+
+  /// requests submitted but not yet reaped
+  size_t in_flight() const {
+    return sub_tail.load(std::memory_order_acquire) -
+           comp_head.load(std::memory_order_acquire);
+  }
+
+ private:
+  template <class key_tt, class val_tt, bool sequential, bool multimap>
+  friend class XIndex;
+
+  // submissions that can be executed now, limited by free completion slots
+  size_t ready(size_t max_n) const {
+    uint64_t head = sub_head.load(std::memory_order_relaxed);
+    size_t submitted_n = sub_tail.load(std::memory_order_acquire) - head;
+    size_t free_n = mask + 1 - (comp_tail.load(std::memory_order_relaxed) -
+                                comp_head.load(std::memory_order_acquire));
+    return std::min(std::min(submitted_n, free_n), max_n);
+  }
+  const submission_t& submission(size_t i) const {
+    return submissions[(sub_head.load(std::memory_order_relaxed) + i) & mask];
+  }
+  completion_t& completion(size_t i) {
+    return completions[(comp_tail.load(std::memory_order_relaxed) + i) & mask];
+  }
+  // retires the first n submissions and publishes their completions
+  void complete(size_t n) {
+    sub_head.store(sub_head.load(std::memory_order_relaxed) + n,
+                   std::memory_order_release);
+    comp_tail.store(comp_tail.load(std::memory_order_relaxed) + n,
+                    std::memory_order_release);
+  }
+
+  uint64_t mask;
+  std::unique_ptr<submission_t[]> submissions;
+  std::unique_ptr<completion_t[]> completions;
+  alignas(CACHELINE_SIZE) std::atomic<uint64_t> sub_head{0};
+  alignas(CACHELINE_SIZE) std::atomic<uint64_t> sub_tail{0};
+  alignas(CACHELINE_SIZE) std::atomic<uint64_t> comp_head{0};
+  alignas(CACHELINE_SIZE) std::atomic<uint64_t> comp_tail{0};
+};
+
+/// Dedicated index threads that poll a set of queues. Thread i serves the
+/// queues i, i + thread_n, ... with worker id first_worker_id + i, so those
+/// ids must not be used by other threads.
+template <class index_t, class queue_t>
+class QueueThreads {
+ public:
+  QueueThreads(index_t& index, const std::vector<queue_t*>& queues,
+               uint32_t first_worker_id, size_t thread_n)
+      : index(index), queues(queues) {
+    INVARIANT(thread_n > 0);
+    for (size_t thread_i = 0; thread_i < thread_n; thread_i++) {
+      threads.emplace_back([this, thread_i, thread_n, first_worker_id] {
+        run(thread_i, thread_n, first_worker_id + thread_i);
+      });
+    }
+  }
+  QueueThreads(const QueueThreads&) = delete;
+  QueueThreads& operator=(const QueueThreads&) = delete;
+  ~QueueThreads() {
+    running = false;
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+
+ private:
+  void run(size_t thread_i, size_t thread_n, uint32_t worker_id) {
+    while (running) {
+      size_t done_n = 0;
+      for (size_t queue_i = thread_i; queue_i < queues.size();
+           queue_i += thread_n) {
+        done_n += index.process(*queues[queue_i], worker_id);
+      }
+      if (done_n == 0) {
+        // an idle thread must not hold up the rcu barriers of other workers
+        index.quiesce(worker_id);
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  index_t& index;
+  std::vector<queue_t*> queues;
+  std::vector<std::thread> threads;
+  std::atomic<bool> running{true};
+};
+
+}  // namespace xindex
+
+#endif  // XINDEX_QUEUE_H
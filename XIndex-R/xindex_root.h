@@ -22,40 +22,78 @@
 
 #include "byte_size.hpp"
 #include "xindex_group.h"
+#include "xindex_sort.h"
 
 #if !defined(XINDEX_ROOT_H)
 #define XINDEX_ROOT_H
 
 namespace xindex {
 
-template <class key_t, class val_t, bool seq>
+template <class key_t, class val_t, bool seq, bool multi>
 class Root {
   typedef LinearModel<key_t> linear_model_t;
-  typedef Group<key_t, val_t, seq, max_model_n> group_t;
+  typedef Group<key_t, val_t, seq, multi, max_model_n> group_t;
+  typedef typename group_t::record_t record_t;
   typedef std::pair<key_t, group_t* volatile> group_pair_t;
+  typedef BatchWrite<key_t, val_t> batch_write_t;
 
-  template <class key_tt, class val_tt, bool sequential>
+  template <class key_tt, class val_tt, bool sequential, bool multimap>
   friend class XIndex;
 
  public:
   ~Root();
   void init(const std::vector<key_t>& keys, const std::vector<val_t>& vals);
-  void calculate_err(const std::vector<key_t>& keys,
-                     const std::vector<val_t>& vals, size_t group_n_trial,
+  /// builds only the root and group pivots, see XIndex's lazy bulk load
+  static const size_t lazy_sample_stride = 16;
+  void init_lazy(const key_t* keys, const val_t* vals, size_t record_n);
+  void materialize_all();
+  /// the group count whose group models meet group_error_bound, searched on
+  /// every stride-th key
+  size_t search_group_n(const std::vector<key_t>& keys, size_t stride);
+  void calculate_err(const std::vector<key_t>& keys, size_t group_n_trial,
                      double& err_at_percentile, double& max_err,
                      double& avg_err);
 
   inline result_t get(const key_t& key, val_t& val);
+  /// additionally reports the group and array record of the key
+  inline result_t get(const key_t& key, val_t& val, group_t*& group,
+                      record_t*& record);
   inline result_t put(const key_t& key, const val_t& val,
                       const uint32_t worker_id);
+  inline result_t put(const key_t& key, const val_t& val,
+                      const uint32_t worker_id, group_t*& group);
   inline result_t remove(const key_t& key);
+  inline void prefetch(const key_t* keys, size_t n);
+  result_t write_batch(const std::vector<batch_write_t>& writes);
+  size_t multi_get(const std::vector<key_t>& keys, std::vector<val_t>& vals,
+                   std::vector<bool>& found);
+  inline size_t equal_range(const key_t& key, std::vector<val_t>& vals);
+  void remove_range(const key_t& begin, const key_t& end,
+                    std::vector<group_t*>& dropped);
   inline size_t scan(const key_t& begin, const size_t n,
                      std::vector<std::pair<key_t, val_t>>& result);
   inline size_t range_scan(const key_t& begin, const key_t& end,
                            std::vector<std::pair<key_t, val_t>>& result);
+  template <class visit_t>
+  size_t multi_range_scan(const std::pair<key_t, key_t>* ranges,
+                          size_t range_n, visit_t& visit);
+  // parallel_for_each splits its range into at most this many parts per thread
+  static const size_t parts_per_thread = 8;
+  template <class fn_t>
+  size_t parallel_for_each(const key_t& begin, const key_t& end, fn_t& fn,
+                           size_t thread_n);
 
   static void* do_adjustment(void* args);
-  Root* create_new_root();
+  Root* create_new_root(
+      const std::vector<group_t*>& dropped = std::vector<group_t*>());
+  /// builds a root whose groups also hold the sorted records. groups without
+  /// any of them are reused, the others are rebuilt and added to `replaced`
+  Root* merge(const std::vector<std::pair<key_t, val_t>>& records,
+              std::vector<group_t*>& replaced);
+  /// splits the group holding key so that no group has records on both
+  /// sides of it, then reports the groups below and above key in key order
+  void split_at(const key_t& key, const uint32_t worker_id,
+                std::vector<group_t*>& lower, std::vector<group_t*>& upper);
   void trim_root();
 
   /// synchronously forces merging of all delta buffers
@@ -63,8 +101,13 @@ class Root {
 
   /// computes the in memory size in bytes
   _::ByteSize byte_size() const;
+  /// collects the statistics of the root and all groups
+  void collect_shape(IndexShape<key_t>& shape);
 
  private:
+  void init_groups(const key_t* keys, const val_t* vals, size_t record_n,
+                   bool lazy);
+  Root* create_new_root_from(const std::vector<group_t*>& new_groups);
   void adjust_rmi();
   void train_rmi(size_t rmi_2nd_stage_model_n);
   size_t pick_next_stage_model(size_t pos_pred);
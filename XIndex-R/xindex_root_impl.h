@@ -19,6 +19,7 @@
  * For more about XIndex, visit:
  *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
  */
+#include <atomic>
 #include <unordered_map>
 
 #include "globals.h"
@@ -28,8 +29,8 @@
 #define XINDEX_ROOT_IMPL_H
 
 namespace xindex {
-template <class key_t, class val_t, bool seq>
-Root<key_t, val_t, seq>::~Root() {
+template <class key_t, class val_t, bool seq, bool multi>
+Root<key_t, val_t, seq, multi>::~Root() {
   // free models
   if (rmi_2nd_stage != nullptr) {
     const size_t delete_size =
@@ -55,13 +56,27 @@ Root<key_t, val_t, seq>::~Root() {
   }
 }
 
-template <class key_t, class val_t, bool seq>
-void Root<key_t, val_t, seq>::init(const std::vector<key_t>& keys,
-                                   const std::vector<val_t>& vals) {
+template <class key_t, class val_t, bool seq, bool multi>
+void Root<key_t, val_t, seq, multi>::init(const std::vector<key_t>& keys,
+                                          const std::vector<val_t>& vals) {
   INVARIANT(seq == false);
 
+  // use the found group_n to initialize groups
+  group_n = search_group_n(keys, 1);
+  init_groups(keys.data(), vals.data(), keys.size(), false);
+}
+
+/*
+ * Root::search_group_n
+ */
+// semantics: `keys` holds every stride-th key of the records. a group of the
+// sample stands for stride times as many records, so the model errors are
+// scaled by stride to estimate the errors in record positions
+template <class key_t, class val_t, bool seq, bool multi>
+size_t Root<key_t, val_t, seq, multi>::search_group_n(
+    const std::vector<key_t>& keys, size_t stride) {
   // try different initial # of groups
-  size_t record_n = keys.size();
+  size_t record_n = keys.size() * stride;
   const size_t group_size_to_group_error_experience_ratio = 1000;
   size_t group_n_trial =
       record_n /
@@ -70,14 +85,22 @@ void Root<key_t, val_t, seq>::init(const std::vector<key_t>& keys,
   size_t max_trial_n = 40, trial_i = 0;
   double actual_error_at_percentile = 0, max_group_error = 0,
          avg_group_error = 0;
+  auto estimate_err = [&]() {
+    calculate_err(keys, group_n_trial, actual_error_at_percentile,
+                  max_group_error, avg_group_error);
+    actual_error_at_percentile *= stride;
+    max_group_error *= stride;
+    avg_group_error *= stride;
+  };
 
   std::unordered_map<size_t, double> group_n_tried;
 
   for (; trial_i < max_trial_n; trial_i++) {
     group_n_trial = group_n_trial != 0 ? group_n_trial : 1;
+    // a group needs at least one sampled key
+    group_n_trial = std::min(group_n_trial, keys.size());
 
-    calculate_err(keys, vals, group_n_trial, actual_error_at_percentile,
-                  max_group_error, avg_group_error);
+    estimate_err();
 
     // stop when we find ping-pong
     if (group_n_tried.count(group_n_trial) > 0) {
@@ -120,19 +143,60 @@ void Root<key_t, val_t, seq>::init(const std::vector<key_t>& keys,
   }
 
   // max group_n is keys.size()
+  group_n_trial = std::max<size_t>(group_n_trial, 1);
   if (group_n_trial > keys.size())
     group_n_trial = keys.size();
-  calculate_err(keys, vals, group_n_trial, actual_error_at_percentile,
-                max_group_error, avg_group_error);
+  estimate_err();
 
   DEBUG_THIS("--- [root] final group size: "
              << group_n_trial << " (actual_error_at_percentile="
              << actual_error_at_percentile << ", max_error=" << max_group_error
              << ", avg_group_error=" << avg_group_error << ") after " << trial_i
-             << " trial(s)");
+             << " trial(s)" << (stride > 1 ? " on a sample" : ""));
+  return group_n_trial;
+}
+
+/*
+ * Root::init_lazy
+ */
+// semantics: skip the training of group models. the group count is searched
+// like in init, but on a strided sample of the keys, so the cost of the
+// search is a fraction of a full pass
+template <class key_t, class val_t, bool seq, bool multi>
+void Root<key_t, val_t, seq, multi>::init_lazy(const key_t* keys,
+                                               const val_t* vals,
+                                               size_t record_n) {
+  INVARIANT(seq == false);
+  INVARIANT(record_n > 0);
+  std::vector<key_t> sample;
+  sample.reserve(record_n / lazy_sample_stride + 1);
+  for (size_t key_i = 0; key_i < record_n; key_i += lazy_sample_stride) {
+    sample.push_back(keys[key_i]);
+  }
+  group_n = search_group_n(sample, lazy_sample_stride);
+  init_groups(keys, vals, record_n, true);
+}
+
+/*
+ * Root::materialize_all
+ */
+template <class key_t, class val_t, bool seq, bool multi>
+void Root<key_t, val_t, seq, multi>::materialize_all() {
+  for (size_t group_i = 0; group_i < group_n; group_i++) {
+    for (group_t* group = groups[group_i].second; group != nullptr;
+         group = group->next) {
+      group->materialize();
+    }
+  }
+}
 
-  // use the found group_n_trial to initialize groups
-  group_n = group_n_trial;
+/*
+ * Root::init_groups
+ */
+template <class key_t, class val_t, bool seq, bool multi>
+void Root<key_t, val_t, seq, multi>::init_groups(const key_t* keys,
+                                                 const val_t* vals,
+                                                 size_t record_n, bool lazy) {
   groups = std::make_unique<group_pair_t[]>(group_n);
   _::allocated_bytes += group_n * sizeof(group_pair_t);
 
@@ -147,6 +211,18 @@ void Root<key_t, val_t, seq>::init(const std::vector<key_t>& keys,
       end_i++;
       trailing_record_n--;
     }
+    if (multi) {
+      // a run of equal keys must not straddle groups, because lookups only
+      // visit the last group whose pivot is <= key. use fewer groups if the
+      // runs consume all records
+      while (end_i < record_n && keys[end_i] == keys[end_i - 1]) {
+        end_i++;
+      }
+      if (end_i == record_n || group_i == group_n - 1) {
+        end_i = record_n;
+        group_n = group_i + 1;
+      }
+    }
     previous_end_i = end_i;
     INVARIANT((group_i == group_n - 1 && end_i == record_n) ||
               group_i < group_n - 1);
@@ -155,8 +231,13 @@ void Root<key_t, val_t, seq>::init(const std::vector<key_t>& keys,
     groups[group_i].second = new group_t();
     _::allocated_bytes += sizeof(group_t);
 
-    groups[group_i].second->init(keys.begin() + begin_i, vals.begin() + begin_i,
-                                 end_i - begin_i);
+    if (lazy) {
+      groups[group_i].second->init_lazy(keys + begin_i, vals + begin_i,
+                                        end_i - begin_i);
+    } else {
+      groups[group_i].second->init(keys + begin_i, vals + begin_i,
+                                   end_i - begin_i);
+    }
   }
 
 #ifdef DEBUGGING
@@ -172,12 +253,10 @@ void Root<key_t, val_t, seq>::init(const std::vector<key_t>& keys,
 /*
  * Root::calculate_err
  */
-template <class key_t, class val_t, bool seq>
-void Root<key_t, val_t, seq>::calculate_err(const std::vector<key_t>& keys,
-                                            const std::vector<val_t>& vals,
-                                            size_t group_n_trial,
-                                            double& err_at_percentile,
-                                            double& max_err, double& avg_err) {
+template <class key_t, class val_t, bool seq, bool multi>
+void Root<key_t, val_t, seq, multi>::calculate_err(
+    const std::vector<key_t>& keys, size_t group_n_trial,
+    double& err_at_percentile, double& max_err, double& avg_err) {
   double access_percentage = 0.9;
   size_t record_n = keys.size();
   avg_err = 0;
@@ -218,30 +297,265 @@ void Root<key_t, val_t, seq>::calculate_err(const std::vector<key_t>& keys,
 /*
  * Root::get
  */
-template <class key_t, class val_t, bool seq>
-inline result_t Root<key_t, val_t, seq>::get(const key_t& key, val_t& val) {
+template <class key_t, class val_t, bool seq, bool multi>
+inline result_t Root<key_t, val_t, seq, multi>::get(const key_t& key,
+                                                    val_t& val) {
   return locate_group(key)->get(key, val);
 }
 
+template <class key_t, class val_t, bool seq, bool multi>
+inline result_t Root<key_t, val_t, seq, multi>::get(const key_t& key,
+                                                    val_t& val,
+                                                    group_t*& group,
+                                                    record_t*& record) {
+  group = locate_group(key);
+  return group->get_n_locate(key, val, record);
+}
+
 /*
  * Root::put
  */
-template <class key_t, class val_t, bool seq>
-inline result_t Root<key_t, val_t, seq>::put(const key_t& key, const val_t& val,
-                                             const uint32_t worker_id) {
+template <class key_t, class val_t, bool seq, bool multi>
+inline result_t Root<key_t, val_t, seq, multi>::put(const key_t& key,
+                                                    const val_t& val,
+                                                    const uint32_t worker_id) {
   return locate_group(key)->put(key, val, worker_id);
 }
 
+template <class key_t, class val_t, bool seq, bool multi>
+inline result_t Root<key_t, val_t, seq, multi>::put(const key_t& key,
+                                                    const val_t& val,
+                                                    const uint32_t worker_id,
+                                                    group_t*& group) {
+  group = locate_group(key);
+  return group->put(key, val, worker_id);
+}
+
 /*
  * Root::remove
  */
-template <class key_t, class val_t, bool seq>
-inline result_t Root<key_t, val_t, seq>::remove(const key_t& key) {
+template <class key_t, class val_t, bool seq, bool multi>
+inline result_t Root<key_t, val_t, seq, multi>::remove(const key_t& key) {
   return locate_group(key)->remove(key);
 }
 
-template <class key_t, class val_t, bool seq>
-inline size_t Root<key_t, val_t, seq>::scan(
+/*
+ * Root::prefetch
+ */
+// semantics: bring the group array records of a batch of keys into the cache.
+// the groups are located and their headers fetched first, so the cache misses
+// of all keys overlap instead of being taken one key after another
+template <class key_t, class val_t, bool seq, bool multi>
+inline void Root<key_t, val_t, seq, multi>::prefetch(const key_t* keys,
+                                                     size_t n) {
+  const size_t max_prefetch_n = 16;
+  group_t* batch_groups[max_prefetch_n];
+  for (size_t begin_i = 0; begin_i < n; begin_i += max_prefetch_n) {
+    size_t batch_n = std::min(n - begin_i, max_prefetch_n);
+    for (size_t key_i = 0; key_i < batch_n; key_i++) {
+      batch_groups[key_i] = locate_group(keys[begin_i + key_i]);
+      __builtin_prefetch(batch_groups[key_i]);
+    }
+    for (size_t key_i = 0; key_i < batch_n; key_i++) {
+      batch_groups[key_i]->prefetch(keys[begin_i + key_i]);
+    }
+  }
+}
+
+/*
+ * Root::write_batch
+ */
+// `writes` are sorted by key without duplicates. the target records are locked
+// in key order, buffer leaves before array records, then all writes are
+// applied and the locks released. readers spin on a locked record or leaf, so
+// none of the writes is visible before all of them are. a removal of the
+// array record in between the lookup and locking makes the batch retry
+template <class key_t, class val_t, bool seq, bool multi>
+result_t Root<key_t, val_t, seq, multi>::write_batch(
+    const std::vector<batch_write_t>& writes) {
+  typedef AtomicVal<val_t> atomic_val_t;
+  typedef typename group_t::buffer_t::leaf_t leaf_t;
+
+  const size_t write_n = writes.size();
+  std::vector<group_t*> targets(write_n);
+  std::vector<atomic_val_t*> records(write_n, nullptr);
+  std::vector<leaf_t*> leaves(write_n, nullptr);
+
+  // live keys are written in the group array, others in the buffer. new keys
+  // get a removed record first, so the writes don't split locked leaves
+  for (size_t write_i = 0; write_i < write_n; write_i++) {
+    const key_t& key = writes[write_i].key;
+    group_t* group = locate_group(key);
+    if (group->buffer_temp != nullptr || group->buf_frozen) {
+      return result_t::retry;
+    }
+    targets[write_i] = group;
+
+    size_t pos = group->get_pos_from_array(key);
+    val_t val;
+    if (pos != group->array_size && group->key_at(pos) == key &&
+        group->data[pos].second.read(val)) {
+      records[write_i] = &group->data[pos].second;
+    } else if (!writes[write_i].remove) {
+      group->buffer->reserve(key);
+    }
+  }
+
+  std::vector<leaf_t*> locked_leaves;
+  group_t* held_group = nullptr;
+  for (size_t write_i = 0; write_i < write_n; write_i++) {
+    if (records[write_i] == nullptr) {
+      group_t* group = targets[write_i];
+      leaf_t* held = group == held_group ? locked_leaves.back() : nullptr;
+      leaves[write_i] = group->buffer->lock_leaf(writes[write_i].key, held);
+      if (leaves[write_i] != held) {
+        locked_leaves.push_back(leaves[write_i]);
+        held_group = group;
+      }
+    }
+  }
+
+  size_t locked_n = 0;
+  bool stale = false;
+  for (; locked_n < write_n && !stale; locked_n++) {
+    atomic_val_t* record = records[locked_n];
+    if (record != nullptr) {
+      record->lock();
+      stale = record->removed(record->status);
+    }
+  }
+
+  if (!stale) {
+    for (size_t write_i = 0; write_i < write_n; write_i++) {
+      const batch_write_t& write = writes[write_i];
+      if (records[write_i] != nullptr) {
+        if (write.remove) {
+          records[write_i]->remove_locked();
+        } else {
+          records[write_i]->write_locked(write.val);
+        }
+      } else if (write.remove) {
+        targets[write_i]->buffer->remove_locked(leaves[write_i], write.key);
+      } else {
+        targets[write_i]->buffer->write_locked(leaves[write_i], write.key,
+                                               write.val);
+      }
+    }
+    memory_fence();
+  }
+
+  for (size_t write_i = 0; write_i < locked_n; write_i++) {
+    if (records[write_i] != nullptr) {
+      records[write_i]->unlock();
+    }
+  }
+  for (leaf_t* leaf : locked_leaves) {
+    leaf->unlock();
+  }
+  return stale ? result_t::retry : result_t::ok;
+}
+
+/*
+ * Root::multi_get
+ */
+// reads all keys twice and retries until no record changed in between, which
+// gives a snapshot of the keys at the time of the last read of the first round
+template <class key_t, class val_t, bool seq, bool multi>
+size_t Root<key_t, val_t, seq, multi>::multi_get(const std::vector<key_t>& keys,
+                                                 std::vector<val_t>& vals,
+                                                 std::vector<bool>& found) {
+  typedef typename group_t::version_t version_t;
+
+  const size_t key_n = keys.size();
+  vals.resize(key_n);
+  found.resize(key_n);
+  std::vector<version_t> versions(key_n);
+  while (true) {
+    size_t found_n = 0;
+    for (size_t key_i = 0; key_i < key_n; key_i++) {
+      found[key_i] = locate_group(keys[key_i])
+                         ->get(keys[key_i], vals[key_i], versions[key_i]) ==
+                     result_t::ok;
+      found_n += found[key_i];
+    }
+
+    bool consistent = true;
+    for (size_t key_i = 0; key_i < key_n && consistent; key_i++) {
+      val_t val;
+      version_t version;
+      bool found_again =
+          locate_group(keys[key_i])->get(keys[key_i], val, version) ==
+          result_t::ok;
+      consistent = found_again == found[key_i] && version == versions[key_i];
+    }
+    if (consistent) {
+      return found_n;
+    }
+  }
+}
+
+/*
+ * Root::equal_range
+ */
+template <class key_t, class val_t, bool seq, bool multi>
+inline size_t Root<key_t, val_t, seq, multi>::equal_range(const key_t& key,
+                                              std::vector<val_t>& vals) {
+  vals.clear();
+  return locate_group(key)->equal_range(key, vals);
+}
+
+/*
+ * Root::remove_range
+ */
+// groups that lie entirely within [begin, end) are only collected in
+// `dropped`, the caller unlinks them by building a new root. the records of
+// partially covered groups are removed in place. the first group is never
+// dropped since its pivot stands for -inf
+template <class key_t, class val_t, bool seq, bool multi>
+void Root<key_t, val_t, seq, multi>::remove_range(
+    const key_t& begin, const key_t& end, std::vector<group_t*>& dropped) {
+  // the overlapping groups in key order, plus the pivot after the last one
+  std::vector<group_t*> covered;
+  bool has_end_pivot = false;
+  key_t end_pivot;
+  key_t latest_group_pivot = key_t::min();  // for cross-slot chained groups
+
+  int group_i;
+  group_t* group = locate_group_pt2(begin, locate_group_pt1(begin, group_i));
+  while (!has_end_pivot && group_i < (int)group_n) {
+    while (group && (covered.empty() ||
+                     group->get_pivot() > latest_group_pivot /* re-entry */)) {
+      if (!covered.empty() && group->get_pivot() >= end) {
+        has_end_pivot = true;
+        end_pivot = group->get_pivot();
+        break;
+      }
+      covered.push_back(group);
+      latest_group_pivot = group->get_pivot();
+      group = group->next;
+    }
+    group_i++;
+    group = group_i < (int)group_n ? groups[group_i].second : nullptr;
+  }
+
+  for (size_t covered_i = 0; covered_i < covered.size(); covered_i++) {
+    group = covered[covered_i];
+    bool is_last = covered_i == covered.size() - 1;
+    bool fully_covered =
+        group != groups[0].second && group->get_pivot() >= begin &&
+        (is_last ? has_end_pivot && end_pivot <= end
+                 : covered[covered_i + 1]->get_pivot() <= end);
+    if (fully_covered) {
+      dropped.push_back(group);
+    } else {
+      group->materialize();
+      group->remove_range(begin, end);
+    }
+  }
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+inline size_t Root<key_t, val_t, seq, multi>::scan(
     const key_t& begin, const size_t n,
     std::vector<std::pair<key_t, val_t>>& result) {
   size_t remaining = n;
@@ -252,9 +566,13 @@ inline size_t Root<key_t, val_t, seq>::scan(
 
   int group_i;
   group_t* group = locate_group_pt2(begin, locate_group_pt1(begin, group_i));
+  bool entered = false;  // the first group may have pivot key_t::min()
   while (remaining && group_i < (int)group_n) {
     while (remaining && group &&
-           group->get_pivot() > latest_group_pivot /* avoid re-entry */) {
+           (!entered ||
+            group->get_pivot() > latest_group_pivot /* avoid re-entry */)) {
+      entered = true;
+      group->materialize();
       size_t done = group->scan(next_begin, remaining, result);
       assert(done <= remaining);
       remaining -= done;
@@ -263,31 +581,140 @@ inline size_t Root<key_t, val_t, seq>::scan(
       group = group->next;
     }
     group_i++;
-    group = groups[group_i].second;
+    group = group_i < (int)group_n ? groups[group_i].second : nullptr;
   }
 
   return n - remaining;
 }
 
-template <class key_t, class val_t, bool seq>
-inline size_t Root<key_t, val_t, seq>::range_scan(
+template <class key_t, class val_t, bool seq, bool multi>
+inline size_t Root<key_t, val_t, seq, multi>::range_scan(
     const key_t& begin, const key_t& end,
     std::vector<std::pair<key_t, val_t>>& result) {
-  COUT_N_EXIT("not implemented yet");
+  result.clear();
+  std::pair<key_t, key_t> range(begin, end);
+  auto visit = [&result](size_t, const key_t& key, const val_t& val) {
+    result.push_back(std::pair<key_t, val_t>(key, val));
+  };
+  return multi_range_scan(&range, 1, visit);
+}
+
+/*
+ * Root::multi_range_scan
+ */
+// semantics: walks the groups once in key order. a group continues with the
+// next range as long as the range starts within it, and the groups between
+// two ranges are skipped by locating the next range's group
+template <class key_t, class val_t, bool seq, bool multi>
+template <class visit_t>
+size_t Root<key_t, val_t, seq, multi>::multi_range_scan(
+    const std::pair<key_t, key_t>* ranges, size_t range_n, visit_t& visit) {
+  if (range_n == 0) {
+    return 0;
+  }
+  size_t range_i = 0, visited_n = 0;
+  key_t latest_group_pivot = key_t::min();  // for cross-slot chained groups
+
+  int group_i;
+  const key_t& begin = ranges[0].first;
+  group_t* group = locate_group_pt2(begin, locate_group_pt1(begin, group_i));
+  while (group != nullptr) {
+    group->materialize();
+    range_i =
+        group->multi_range_scan(ranges, range_n, range_i, visit, visited_n);
+    if (range_i == range_n) {
+      break;
+    }
+    latest_group_pivot = group->get_pivot();
+
+    // the next group in key order, avoiding re-entry
+    group = group->next;
+    while (group == nullptr || !(group->get_pivot() > latest_group_pivot)) {
+      if (++group_i >= (int)group_n) {
+        group = nullptr;
+        break;
+      }
+      group = groups[group_i].second;
+    }
+
+    // skip the groups that lie before the range
+    const key_t& next_begin = ranges[range_i].first;
+    if (group != nullptr && group->get_pivot() <= next_begin) {
+      int located_i;
+      group_t* located = locate_group_pt2(
+          next_begin, locate_group_pt1(next_begin, located_i));
+      if (located->get_pivot() > group->get_pivot()) {
+        group = located;
+        group_i = located_i;
+      }
+    }
+  }
+  return visited_n;
+}
+
+/*
+ * Root::parallel_for_each
+ */
+// semantics: the root slots overlapping [begin, end) are split into runs,
+// a few per thread, and the threads take the runs in turn so that slow runs
+// (large buffers, long chains) are balanced out. every run is scanned like a
+// single range by one thread, in key order
+template <class key_t, class val_t, bool seq, bool multi>
+template <class fn_t>
+size_t Root<key_t, val_t, seq, multi>::parallel_for_each(const key_t& begin,
+                                                         const key_t& end,
+                                                         fn_t& fn,
+                                                         size_t thread_n) {
+  if (!(begin < end)) {
+    return 0;
+  }
+  int begin_group_i, end_group_i;
+  locate_group_pt1(begin, begin_group_i);
+  locate_group_pt1(end, end_group_i);
+  size_t slot_n = end_group_i - begin_group_i + 1;
+  size_t part_n = std::min(slot_n, thread_n * parts_per_thread);
+  std::atomic<size_t> next_part_i(0);
+
+  run_parallel(thread_n, [&](size_t) {
+    size_t part_i;
+    while ((part_i = next_part_i.fetch_add(1)) < part_n) {
+      size_t slot_begin = begin_group_i + slot_n * part_i / part_n;
+      size_t slot_end = begin_group_i + slot_n * (part_i + 1) / part_n;
+      std::pair<key_t, key_t> range(
+          part_i == 0 ? begin : groups[slot_begin].first,
+          part_i + 1 == part_n ? end : groups[slot_end].first);
+      auto visit = [&fn, part_i](size_t, const key_t& key, const val_t& val) {
+        fn(part_i, key, val);
+      };
+      multi_range_scan(&range, 1, visit);
+    }
+  });
+  return part_n;
 }
 
-template <class key_t, class val_t, bool seq>
-void Root<key_t, val_t, seq>::force_adjustment_sync(bool& should_update_array) {
+template <class key_t, class val_t, bool seq, bool multi>
+void Root<key_t, val_t, seq, multi>::force_adjustment_sync(
+    bool& should_update_array) {
   // iterate through the array, and do maintenance
   size_t m_split = 0, g_split = 0, m_merge = 0, g_merge = 0, compact = 0;
   size_t buf_size = 0, cnt = 0;
   for (size_t group_i = 0; group_i < this->group_n; group_i++) {
     group_t* volatile* group = &(this->groups[group_i].second);
     while (*group != nullptr) {
+      // groups that were never accessed have nothing to adjust
+      if (!(*group)->materialized()) {
+        group = &((*group)->next);
+        continue;
+      }
+
       // check model split/merge
       bool should_split_group = false;
       bool might_merge_group = false;
 
+      // only groups that survive the pass unchanged are tiered, so that
+      // new groups get a full pass of access sampling first
+      group_t* group_at_start = *group;
+
       // set this to avoid ping-pong effect
       size_t max_trial_n = max_model_n;
       for (size_t trial_i = 0; trial_i < max_trial_n; ++trial_i) {
@@ -348,14 +775,19 @@ void Root<key_t, val_t, seq>::force_adjustment_sync(bool& should_update_array) {
                  this->groups[group_i + 1].second) {
         next_group = &(this->groups[group_i + 1].second);
       }
+      if (next_group != nullptr && !(*next_group)->materialized()) {
+        next_group = nullptr;
+      }
 
       // check for group split/merge, if not, do compaction
       size_t buffer_size = (*group)->buffer->size();
       buf_size += buffer_size;
       cnt++;
       group_t* old_group = (*group);
-      if (should_split_group || buffer_size > config.buffer_size_bound) {
-        group_t* intermediate = old_group->split_group_pt1();
+      key_t split_pivot;
+      if ((should_split_group || buffer_size > config.buffer_size_bound) &&
+          old_group->get_split_pivot(split_pivot)) {
+        group_t* intermediate = old_group->split_group_pt1(split_pivot);
         *group = intermediate;  // create 2 new groups with freezed buffer
         group_t* new_group = intermediate->split_group_pt2();  // now merge
         *group = new_group;
@@ -370,6 +802,9 @@ void Root<key_t, val_t, seq>::force_adjustment_sync(bool& should_update_array) {
                                        sizeof(decltype(*intermediate));
         assert(_::allocated_bytes > bytes_to_delete);
         _::allocated_bytes -= bytes_to_delete;
+        // the intermediates' temp buffers are the new groups' buffers now
+        intermediate->buffer_temp = nullptr;
+        intermediate->next->buffer_temp = nullptr;
         delete old_group;
         delete intermediate->next;  // but deleting the metadata is needed
         delete intermediate;
@@ -393,6 +828,9 @@ void Root<key_t, val_t, seq>::force_adjustment_sync(bool& should_update_array) {
         old_group->free_buffer();
         old_next->free_data();
         old_next->free_buffer();
+        // the shared temp buffer is new_group's buffer now
+        old_group->buffer_temp = nullptr;
+        old_next->buffer_temp = nullptr;
 
         const size_t bytes_to_delete =
             sizeof(decltype(*old_group)) + sizeof(decltype(*old_next));
@@ -401,19 +839,24 @@ void Root<key_t, val_t, seq>::force_adjustment_sync(bool& should_update_array) {
         delete old_group;
         delete old_next;
         should_update_array = true;
-      } else if (buffer_size > config.buffer_compact_threshold) {
+      } else if (buffer_size > config.buffer_compact_threshold ||
+                 old_group->expired_dense()) {
         group_t* new_group = old_group->compact_phase_1();
         *group = new_group;
         compact++;
         new_group->compact_phase_2();
         old_group->free_data();
         old_group->free_buffer();
+        old_group->buffer_temp = nullptr;  // now new_group's buffer
 
         const size_t bytes_to_delete = sizeof(decltype(*old_group));
         assert(_::allocated_bytes > bytes_to_delete);
         _::allocated_bytes -= bytes_to_delete;
         delete old_group;
       }
+      if (!config.tier_dir.empty() && *group == group_at_start) {
+        (*group)->adjust_tier();
+      }
 
       // do next (in the chain)
       group = &((*group)->next);
@@ -421,14 +864,15 @@ void Root<key_t, val_t, seq>::force_adjustment_sync(bool& should_update_array) {
   }
 }
 
-template <class key_t, class val_t, bool seq>
-void* Root<key_t, val_t, seq>::do_adjustment(void* args) {
+template <class key_t, class val_t, bool seq, bool multi>
+void* Root<key_t, val_t, seq, multi>::do_adjustment(void* args) {
   volatile bool& should_update_array = ((BGInfo*)args)->should_update_array;
   std::atomic<bool>& started = ((BGInfo*)args)->started;
   std::atomic<bool>& finished = ((BGInfo*)args)->finished;
   size_t bg_i = (((BGInfo*)args)->bg_i);
   size_t bg_num = (((BGInfo*)args)->bg_n);
   volatile bool& running = ((BGInfo*)args)->running;
+  rcu_domain = ((BGInfo*)args)->rcu;
 
   while (running) {
     sleep(1);
@@ -452,6 +896,11 @@ void* Root<key_t, val_t, seq>::do_adjustment(void* args) {
 
         group_t* volatile* group = &(root.groups[group_i].second);
         while (*group != nullptr) {
+          if (!(*group)->materialized()) {
+            group = &((*group)->next);
+            continue;
+          }
+
           // check model split/merge
           bool should_split_group = false;
           bool might_merge_group = false;
@@ -522,17 +971,23 @@ void* Root<key_t, val_t, seq>::do_adjustment(void* args) {
                      root.groups[group_i + 1].second) {
             next_group = &(root.groups[group_i + 1].second);
           }
+          if (next_group != nullptr && !(*next_group)->materialized()) {
+            next_group = nullptr;
+          }
 
           // check for group split/merge, if not, do compaction
           size_t buffer_size = (*group)->buffer->size();
           buf_size += buffer_size;
           cnt++;
           group_t* old_group = (*group);
-          if (should_split_group || buffer_size > config.buffer_size_bound) {
+          key_t split_pivot;
+          if ((should_split_group ||
+               buffer_size > config.buffer_size_bound) &&
+              old_group->get_split_pivot(split_pivot)) {
             // DEBUG_THIS("------ [group split] buf_size="
             //            << buffer_size << ", group_i=" << group_i);
 
-            group_t* intermediate = old_group->split_group_pt1();
+            group_t* intermediate = old_group->split_group_pt1(split_pivot);
             *group = intermediate;  // create 2 new groups with freezed buffer
             memory_fence();
             rcu_barrier();  // make sure no one is inserting to buffer
@@ -554,6 +1009,9 @@ void* Root<key_t, val_t, seq>::do_adjustment(void* args) {
                 sizeof(decltype(*intermediate));
             assert(_::allocated_bytes > bytes_to_delete);
             _::allocated_bytes -= bytes_to_delete;
+            // the intermediates' temp buffers are the new groups' buffers now
+            intermediate->buffer_temp = nullptr;
+            intermediate->next->buffer_temp = nullptr;
             delete old_group;
             delete intermediate->next;  // but deleting the metadata is needed
             delete intermediate;
@@ -591,6 +1049,9 @@ void* Root<key_t, val_t, seq>::do_adjustment(void* args) {
             old_group->free_buffer();
             old_next->free_data();
             old_next->free_buffer();
+            // the shared temp buffer is new_group's buffer now
+            old_group->buffer_temp = nullptr;
+            old_next->buffer_temp = nullptr;
 
             const size_t bytes_to_delete =
                 sizeof(decltype(*old_group)) + sizeof(decltype(*old_next));
@@ -599,7 +1060,8 @@ void* Root<key_t, val_t, seq>::do_adjustment(void* args) {
             delete old_group;
             delete old_next;
             should_update_array = true;
-          } else if (buffer_size > config.buffer_compact_threshold) {
+          } else if (buffer_size > config.buffer_compact_threshold ||
+                     old_group->expired_dense()) {
             // DEBUG_THIS("------ [compaction], buf_size="
             //            << buffer_size << ", group_i=" << group_i);
 
@@ -613,6 +1075,7 @@ void* Root<key_t, val_t, seq>::do_adjustment(void* args) {
             rcu_barrier();  // make sure no one is accessing the old data
             old_group->free_data();
             old_group->free_buffer();
+            old_group->buffer_temp = nullptr;  // now new_group's buffer
 
             const size_t bytes_to_delete = sizeof(decltype(*old_group));
             assert(_::allocated_bytes > bytes_to_delete);
@@ -640,35 +1103,45 @@ void* Root<key_t, val_t, seq>::do_adjustment(void* args) {
   return nullptr;
 }
 
-template <class key_t, class val_t, bool seq>
-Root<key_t, val_t, seq>* Root<key_t, val_t, seq>::create_new_root() {
-  Root* new_root = new Root();
-  _::allocated_bytes += sizeof(Root);
-
-  size_t new_group_n = 0;
+template <class key_t, class val_t, bool seq, bool multi>
+Root<key_t, val_t, seq, multi>*
+Root<key_t, val_t, seq, multi>::create_new_root(
+    const std::vector<group_t*>& dropped) {
+  // `dropped` is in key order, so it is consumed along the chains
+  std::vector<group_t*> new_groups;
+  size_t dropped_i = 0;
   for (size_t group_i = 0; group_i < group_n; group_i++) {
     group_t* group = groups[group_i].second;
     while (group != nullptr) {
-      new_group_n++;
+      if (dropped_i < dropped.size() && group == dropped[dropped_i]) {
+        dropped_i++;
+      } else {
+        new_groups.push_back(group);
+      }
       group = group->next;
     }
   }
+  assert(dropped_i == dropped.size());
+  return create_new_root_from(new_groups);
+}
+
+// `new_groups` are in key order
+template <class key_t, class val_t, bool seq, bool multi>
+Root<key_t, val_t, seq, multi>*
+Root<key_t, val_t, seq, multi>::create_new_root_from(
+    const std::vector<group_t*>& new_groups) {
+  Root* new_root = new Root();
+  _::allocated_bytes += sizeof(Root);
 
   DEBUG_THIS("--- [root] update root array. old_group_n="
-             << group_n << ", new_group_n=" << new_group_n);
-  new_root->group_n = new_group_n;
+             << group_n << ", new_group_n=" << new_groups.size());
+  new_root->group_n = new_groups.size();
   new_root->groups = std::make_unique<group_pair_t[]>(new_root->group_n);
   _::allocated_bytes += sizeof(group_pair_t) * new_root->group_n;
 
-  size_t new_group_i = 0;
-  for (size_t group_i = 0; group_i < group_n; group_i++) {
-    group_t* group = groups[group_i].second;
-    while (group != nullptr) {
-      new_root->groups[new_group_i].first = group->get_pivot();
-      new_root->groups[new_group_i].second = group;
-      group = group->next;
-      new_group_i++;
-    }
+  for (size_t group_i = 0; group_i < new_root->group_n; group_i++) {
+    new_root->groups[group_i].first = new_groups[group_i]->get_pivot();
+    new_root->groups[group_i].second = new_groups[group_i];
   }
 
   for (size_t group_i = 1; group_i < new_root->group_n - 1; group_i++) {
@@ -676,15 +1149,191 @@ Root<key_t, val_t, seq>* Root<key_t, val_t, seq>::create_new_root() {
            new_root->groups[group_i + 1].first);
   }
 
+  // chains must not lead out of the new root before it is published, or
+  // workers entering it could reach groups that are about to be freed
+  // (dropped, replaced or split off). a chain is in key order, so a next
+  // that stays inside is the following group; workers on the old root skip
+  // the unlinked groups, whose records leave the index anyway
+  for (size_t group_i = 0; group_i < new_root->group_n; group_i++) {
+    group_t* group = new_root->groups[group_i].second;
+    group_t* following = group_i + 1 < new_root->group_n
+                             ? new_root->groups[group_i + 1].second
+                             : nullptr;
+    if (group->next != nullptr && group->next != following) {
+      group->next = following;
+    }
+  }
+  memory_fence();
+
+  // the 2nd stage models are retrained from scratch, the old ones stay with
+  // the old root since workers might still be predicting with them
   new_root->rmi_1st_stage = rmi_1st_stage;
-  new_root->rmi_2nd_stage = rmi_2nd_stage;
   new_root->adjust_rmi();
 
   return new_root;
 }
 
-template <class key_t, class val_t, bool seq>
-void Root<key_t, val_t, seq>::trim_root() {
+/*
+ * Root::merge
+ */
+// semantics: the records of a group are those from its pivot up to the next
+// group's pivot, the first group also takes all smaller keys. a rebuilt group
+// is the merge of its valid records with the new ones (which win over equal
+// keys unless multi), split into pieces of about the average group size
+template <class key_t, class val_t, bool seq, bool multi>
+Root<key_t, val_t, seq, multi>* Root<key_t, val_t, seq, multi>::merge(
+    const std::vector<std::pair<key_t, val_t>>& records,
+    std::vector<group_t*>& replaced) {
+  std::vector<group_t*> old_groups;
+  size_t old_record_n = 0;
+  for (size_t group_i = 0; group_i < group_n; group_i++) {
+    for (group_t* group = groups[group_i].second; group != nullptr;
+         group = group->next) {
+      old_groups.push_back(group);
+      old_record_n += group->array_size;
+    }
+  }
+  const size_t avg_group_size =
+      std::max((size_t)1, old_record_n / old_groups.size());
+
+  std::vector<group_t*> new_groups;
+  std::vector<std::pair<key_t, val_t>> current;
+  std::vector<key_t> keys;
+  std::vector<val_t> vals;
+  auto record_less = [](const std::pair<key_t, val_t>& record,
+                        const key_t& key) { return record.first < key; };
+  size_t rec_i = 0;
+  for (size_t group_i = 0; group_i < old_groups.size(); group_i++) {
+    group_t* group = old_groups[group_i];
+    size_t rec_end = records.size();
+    if (group_i + 1 < old_groups.size()) {
+      rec_end = std::lower_bound(records.begin() + rec_i, records.end(),
+                                 old_groups[group_i + 1]->get_pivot(),
+                                 record_less) -
+                records.begin();
+    }
+    if (rec_i == rec_end) {
+      new_groups.push_back(group);
+      continue;
+    }
+
+    group->materialize();
+    current.clear();
+    group->scan_all(current);
+    keys.clear();
+    vals.clear();
+    size_t cur_i = 0;
+    while (cur_i < current.size() || rec_i < rec_end) {
+      if (rec_i == rec_end ||
+          (cur_i < current.size() &&
+           (multi ? !(records[rec_i].first < current[cur_i].first)
+                  : current[cur_i].first < records[rec_i].first))) {
+        keys.push_back(current[cur_i].first);
+        vals.push_back(current[cur_i].second);
+        cur_i++;
+      } else {
+        if (!multi && cur_i < current.size() &&
+            current[cur_i].first == records[rec_i].first) {
+          cur_i++;  // replaced by the new record
+        }
+        keys.push_back(records[rec_i].first);
+        vals.push_back(records[rec_i].second);
+        rec_i++;
+      }
+    }
+    replaced.push_back(group);
+
+    size_t target_size = std::max(avg_group_size, (size_t)group->array_size);
+    size_t piece_n = (keys.size() + target_size - 1) / target_size;
+    size_t begin_i = 0;
+    for (size_t piece_i = 0; piece_i < piece_n && begin_i < keys.size();
+         piece_i++) {
+      size_t end_i = keys.size() * (piece_i + 1) / piece_n;
+      // a run of equal keys must not straddle groups
+      while (multi && end_i < keys.size() && keys[end_i] == keys[end_i - 1]) {
+        end_i++;
+      }
+      group_t* new_group = new group_t();
+      _::allocated_bytes += sizeof(group_t);
+      new_group->init(keys.begin() + begin_i, vals.begin() + begin_i,
+                      end_i - begin_i);
+      if (seq) {
+        new_group->enable_seq_insert_opt();
+      }
+      new_groups.push_back(new_group);
+      begin_i = end_i;
+    }
+  }
+  assert(rec_i == records.size());
+  return create_new_root_from(new_groups);
+}
+
+/*
+ * Root::split_at
+ */
+// semantics: the boundary group is split like in adjustment, with barriers
+// between the phases since readers may still use the old group. a group whose
+// records all lie on one side of key is kept whole on that side
+template <class key_t, class val_t, bool seq, bool multi>
+void Root<key_t, val_t, seq, multi>::split_at(const key_t& key,
+                                              const uint32_t worker_id,
+                                              std::vector<group_t*>& lower,
+                                              std::vector<group_t*>& upper) {
+  int group_i;
+  locate_group_pt1(key, group_i);
+  group_t* volatile* group = &(groups[group_i].second);
+  while ((*group)->next != nullptr && (*group)->next->get_pivot() <= key) {
+    group = &((*group)->next);
+  }
+
+  group_t* old_group = *group;
+  old_group->materialize();
+  std::vector<std::pair<key_t, val_t>> records;
+  old_group->scan_all(records);
+  bool has_lower = !records.empty() && records.front().first < key;
+  bool has_upper = !records.empty() && records.back().first >= key;
+  if (has_lower && has_upper) {
+    group_t* intermediate = old_group->split_group_pt1(key);
+    *group = intermediate;  // create 2 new groups with freezed buffer
+    memory_fence();
+    rcu_barrier(worker_id);  // make sure no one is inserting to buffer
+    group_t* new_group = intermediate->split_group_pt2();  // now merge
+    *group = new_group;
+    memory_fence();
+    rcu_barrier(worker_id);  // make sure no one is using old/intermedia groups
+    new_group->compact_phase_2();
+    new_group->next->compact_phase_2();
+    memory_fence();
+    rcu_barrier(worker_id);  // make sure no one is accessing the old data
+    old_group->free_data();  // intermidiates share the array and buffer
+    old_group->free_buffer();  // so no free_xxx is needed
+
+    const size_t bytes_to_delete = sizeof(decltype(*old_group)) +
+                                   sizeof(decltype(*intermediate->next)) +
+                                   sizeof(decltype(*intermediate));
+    assert(_::allocated_bytes > bytes_to_delete);
+    _::allocated_bytes -= bytes_to_delete;
+    // the intermediates' temp buffers are the new groups' buffers now
+    intermediate->buffer_temp = nullptr;
+    intermediate->next->buffer_temp = nullptr;
+    delete old_group;
+    delete intermediate->next;  // but deleting the metadata is needed
+    delete intermediate;
+    old_group = nullptr;
+  }
+
+  for (size_t group_i = 0; group_i < group_n; group_i++) {
+    for (group_t* member = groups[group_i].second; member != nullptr;
+         member = member->next) {
+      bool is_upper = member == old_group ? !has_lower && has_upper
+                                          : member->get_pivot() >= key;
+      (is_upper ? upper : lower).push_back(member);
+    }
+  }
+}
+
+template <class key_t, class val_t, bool seq, bool multi>
+void Root<key_t, val_t, seq, multi>::trim_root() {
   for (size_t group_i = 0; group_i < group_n; group_i++) {
     group_t* group = groups[group_i].second;
     if (group_i != group_n - 1) {
@@ -694,8 +1343,8 @@ void Root<key_t, val_t, seq>::trim_root() {
   }
 }
 
-template <class key_t, class val_t, bool seq>
-void Root<key_t, val_t, seq>::adjust_rmi() {
+template <class key_t, class val_t, bool seq, bool multi>
+void Root<key_t, val_t, seq, multi>::adjust_rmi() {
   size_t max_model_n = config.root_memory_constraint / sizeof(linear_model_t);
   size_t max_trial_n = 10;
 
@@ -760,8 +1409,9 @@ void Root<key_t, val_t, seq>::adjust_rmi() {
              << trial_i << " trial(s)");
 }
 
-template <class key_t, class val_t, bool seq>
-inline void Root<key_t, val_t, seq>::train_rmi(size_t rmi_2nd_stage_model_n) {
+template <class key_t, class val_t, bool seq, bool multi>
+inline void Root<key_t, val_t, seq, multi>::train_rmi(
+    size_t rmi_2nd_stage_model_n) {
   using model_t = linear_model_t;
 
   const size_t bytes_to_delete = this->rmi_2nd_stage_model_n * sizeof(model_t);
@@ -801,8 +1451,9 @@ inline void Root<key_t, val_t, seq>::train_rmi(size_t rmi_2nd_stage_model_n) {
   }
 }
 
-template <class key_t, class val_t, bool seq>
-size_t Root<key_t, val_t, seq>::pick_next_stage_model(size_t group_i_pred) {
+template <class key_t, class val_t, bool seq, bool multi>
+size_t Root<key_t, val_t, seq, multi>::pick_next_stage_model(
+    size_t group_i_pred) {
   size_t second_stage_model_i;
   second_stage_model_i = group_i_pred * rmi_2nd_stage_model_n / group_n;
 
@@ -813,8 +1464,8 @@ size_t Root<key_t, val_t, seq>::pick_next_stage_model(size_t group_i_pred) {
   return second_stage_model_i;
 }
 
-template <class key_t, class val_t, bool seq>
-inline size_t Root<key_t, val_t, seq>::predict(const key_t& key) {
+template <class key_t, class val_t, bool seq, bool multi>
+inline size_t Root<key_t, val_t, seq, multi>::predict(const key_t& key) {
   size_t pos_pred = rmi_1st_stage.predict(key);
   size_t next_stage_model_i = pick_next_stage_model(pos_pred);
   return rmi_2nd_stage[next_stage_model_i].predict(key);
@@ -823,17 +1474,18 @@ inline size_t Root<key_t, val_t, seq>::predict(const key_t& key) {
 /*
  * Root::locate_group
  */
-template <class key_t, class val_t, bool seq>
-inline typename Root<key_t, val_t, seq>::group_t*
-Root<key_t, val_t, seq>::locate_group(const key_t& key) {
+template <class key_t, class val_t, bool seq, bool multi>
+inline typename Root<key_t, val_t, seq, multi>::group_t*
+Root<key_t, val_t, seq, multi>::locate_group(const key_t& key) {
   int group_i;  // unused
   group_t* head = locate_group_pt1(key, group_i);
   return locate_group_pt2(key, head);
 }
 
-template <class key_t, class val_t, bool seq>
-inline typename Root<key_t, val_t, seq>::group_t*
-Root<key_t, val_t, seq>::locate_group_pt1(const key_t& key, int& group_i) {
+template <class key_t, class val_t, bool seq, bool multi>
+inline typename Root<key_t, val_t, seq, multi>::group_t*
+Root<key_t, val_t, seq, multi>::locate_group_pt1(const key_t& key,
+                                                 int& group_i) {
   group_i = predict(key);
   group_i = group_i > (int)group_n - 1 ? group_n - 1 : group_i;
   group_i = group_i < 0 ? 0 : group_i;
@@ -897,9 +1549,10 @@ Root<key_t, val_t, seq>::locate_group_pt1(const key_t& key, int& group_i) {
   return group;
 }
 
-template <class key_t, class val_t, bool seq>
-inline typename Root<key_t, val_t, seq>::group_t*
-Root<key_t, val_t, seq>::locate_group_pt2(const key_t& key, group_t* begin) {
+template <class key_t, class val_t, bool seq, bool multi>
+inline typename Root<key_t, val_t, seq, multi>::group_t*
+Root<key_t, val_t, seq, multi>::locate_group_pt2(const key_t& key,
+                                                 group_t* begin) {
   group_t* group = begin;
   group_t* next = group->next;
   while (next != nullptr && next->get_pivot() <= key) {
@@ -909,11 +1562,12 @@ Root<key_t, val_t, seq>::locate_group_pt2(const key_t& key, group_t* begin) {
 #ifdef DEBUGGING
   assert(group->is_first || key >= group->pivot);
 #endif
+  group->materialize();
   return group;
 }
 
-template <class key_t, class val_t, bool seq>
- _::ByteSize Root<key_t, val_t, seq>::byte_size() const {
+template <class key_t, class val_t, bool seq, bool multi>
+ _::ByteSize Root<key_t, val_t, seq, multi>::byte_size() const {
   // statically counting byte size in this way relies on some assuptions
   static_assert(
       !std::is_same<decltype(rmi_1st_stage),
@@ -941,6 +1595,41 @@ template <class key_t, class val_t, bool seq>
       .used = metadata_size + root_model_size + group_size_total.used};
 }
 
+template <class key_t, class val_t, bool seq, bool multi>
+void Root<key_t, val_t, seq, multi>::collect_shape(
+    IndexShape<key_t>& shape) {
+  using model_t = decltype(rmi_1st_stage);
+
+  shape.root_slot_n = group_n;
+  shape.rmi_2nd_stage_model_n = rmi_2nd_stage_model_n;
+  const size_t root_size = sizeof(decltype(*this)) +
+                           group_n * sizeof(group_pair_t) +
+                           rmi_2nd_stage_model_n * model_t::byte_size();
+  shape.root_bytes += _::ByteSize{root_size, root_size};
+
+  double error_sum = 0;
+  bool entered = false;  // the first group may have pivot key_t::min()
+  key_t latest_group_pivot = key_t::min();  // for cross-slot chained groups
+  for (size_t group_i = 0; group_i < group_n; group_i++) {
+    size_t slot_pred = predict(groups[group_i].first);
+    slot_pred = slot_pred >= group_n ? group_n - 1 : slot_pred;
+    size_t error =
+        slot_pred > group_i ? slot_pred - group_i : group_i - slot_pred;
+    shape.root_max_error = std::max(shape.root_max_error, error);
+    error_sum += error;
+
+    group_t* group = groups[group_i].second;
+    while (group &&
+           (!entered || group->get_pivot() > latest_group_pivot)) {
+      entered = true;
+      group->collect_shape(group_i, shape);
+      latest_group_pivot = group->get_pivot();
+      group = group->next;
+    }
+  }
+  shape.root_mean_error = group_n > 0 ? error_sum / group_n : 0;
+}
+
 }  // namespace xindex
 
 #endif  // XINDEX_ROOT_IMPL_H
@@ -0,0 +1,78 @@
+/*
+ * The code is part of the XIndex project.
+ *
+ *    Copyright (C) 2020 Institute of Parallel and Distributed Systems (IPADS),
+ * Shanghai Jiao Tong University. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For more about XIndex, visit:
+ *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "byte_size.hpp"
+
+#if !defined(XINDEX_SHAPE_H)
+#define XINDEX_SHAPE_H
+
+namespace xindex {
+
+/// statistics of one group, see XIndex::shape
+template <class key_t>
+struct GroupShape {
+  key_t pivot;
+  size_t group_i;      // root slot, groups split off later share their slot
+  size_t array_size;
+  size_t buffer_size;  // including a buffer that is being compacted
+  size_t model_n;
+  size_t max_error;    // of the array records' predicted positions
+  double mean_error;
+  double mean_probe_n;  // key comparisons of a lookup, estimated
+  size_t bytes;         // used bytes of the group, its models and buffers
+};
+
+/// shape of a whole index, for tuning configs without running workloads
+template <class key_t>
+struct IndexShape {
+  size_t record_n = 0;  // array and buffer records, removed ones included
+  size_t root_slot_n = 0;
+  size_t rmi_2nd_stage_model_n = 0;
+  size_t root_max_error = 0;  // in root slots, predicted for the pivots
+  double root_mean_error = 0;
+  std::vector<GroupShape<key_t>> groups;  // in key order
+  std::vector<size_t> model_errors;  // max error of each group model
+  _::ByteSize root_bytes, group_bytes, model_bytes, array_bytes, buffer_bytes;
+};
+
+// key comparisons of Group::exponential_search_key when the prediction is
+// error positions off: the predicted record, the doubling steps until the
+// key is passed, and the bisection of the last step
+inline size_t search_probe_n(size_t error) {
+  size_t probe_n = 2, step = 1;
+  while (step * 2 - 1 <= error) {
+    step *= 2;
+    probe_n++;
+  }
+  for (size_t window = step; window > 0; window /= 2) {
+    probe_n++;
+  }
+  return probe_n;
+}
+
+}  // namespace xindex
+
+#endif  // XINDEX_SHAPE_H
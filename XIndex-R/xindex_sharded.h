@@ -0,0 +1,216 @@
+/*
+ * The code is part of the XIndex project.
+ *
+ *    Copyright (C) 2020 Institute of Parallel and Distributed Systems (IPADS),
+ * Shanghai Jiao Tong University. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For more about XIndex, visit:
+ *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
+ */
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "byte_size.hpp"
+#include "helper.h"
+#include "xindex.h"
+#include "xindex_impl.h"
+#include "xindex_model.h"
+#include "xindex_model_impl.h"
+
+#if !defined(XINDEX_SHARDED_H)
+#define XINDEX_SHARDED_H
+
+namespace xindex {
+
+/// Range-partitioned front-end over several independent XIndex instances.
+/// Shard boundaries are quantiles of the bulk-loaded keys, so the shards start
+/// out balanced, and a key is routed by one prediction of a linear CDF model
+/// followed by a comparison with the neighbouring boundaries. Each shard has
+/// its own root, groups, RCU status and background threads. A worker is
+/// marked idle in the shard it leaves, so a barrier in one shard only waits
+/// for the workers currently inside that shard.
+template <class key_t, class val_t, bool seq = false, bool multi = false>
+class ShardedXIndex {
+  typedef XIndex<key_t, val_t, seq, multi> shard_t;
+
+  // number of keys the routing model is trained on
+  static const size_t train_sample_n = 1 << 14;
+
+ public:
+  ShardedXIndex(const std::vector<key_t>& keys, const std::vector<val_t>& vals,
+                size_t worker_num, size_t bg_n, size_t shard_num)
+      : worker_n(worker_num), worker_shards(new WorkerShard[worker_num]) {
+    INVARIANT(shard_num > 0);
+    INVARIANT(keys.size() >= shard_num);
+    INVARIANT(keys.size() == vals.size());
+    assert(std::is_sorted(keys.begin(), keys.end()));
+
+    // a shard starts at the first occurrence of its pivot, so that duplicate
+    // keys never straddle two shards
+    std::vector<size_t> starts(1, 0);
+    for (size_t shard_i = 1; shard_i < shard_num; shard_i++) {
+      size_t start = std::lower_bound(keys.begin(), keys.end(),
+                                      keys[keys.size() * shard_i / shard_num]) -
+                     keys.begin();
+      if (start > starts.back()) {
+        starts.push_back(start);
+      }
+    }
+    starts.push_back(keys.size());
+
+    for (size_t shard_i = 0; shard_i + 1 < starts.size(); shard_i++) {
+      std::vector<key_t> shard_keys(keys.begin() + starts[shard_i],
+                                    keys.begin() + starts[shard_i + 1]);
+      std::vector<val_t> shard_vals(vals.begin() + starts[shard_i],
+                                    vals.begin() + starts[shard_i + 1]);
+      pivots.push_back(shard_keys[0]);
+      shards.push_back(
+          std::make_unique<shard_t>(shard_keys, shard_vals, worker_num, bg_n));
+    }
+
+    // the model predicts the rank of a key, scaled to the shard id
+    size_t step = std::max<size_t>(keys.size() / train_sample_n, 1);
+    std::vector<key_t> sample_keys;
+    std::vector<size_t> positions;
+    for (size_t key_i = 0; key_i < keys.size(); key_i += step) {
+      sample_keys.push_back(keys[key_i]);
+      positions.push_back(key_i * pivots.size() / keys.size());
+    }
+    model.prepare(sample_keys, positions);
+
+    for (size_t w_i = 0; w_i < worker_n; w_i++) {
+      worker_shards[w_i].shard_i = shards.size();
+    }
+  }
+
+  inline bool get(const key_t& key, val_t& val, const uint32_t worker_id) {
+    return enter(shard_of(key), worker_id).get(key, val, worker_id);
+  }
+  inline bool put(const key_t& key, const val_t& val,
+                  const uint32_t worker_id) {
+    return enter(shard_of(key), worker_id).put(key, val, worker_id);
+  }
+  inline bool remove(const key_t& key, const uint32_t worker_id) {
+    return enter(shard_of(key), worker_id).remove(key, worker_id);
+  }
+  inline size_t equal_range(const key_t& key, std::vector<val_t>& vals,
+                            const uint32_t worker_id) {
+    return enter(shard_of(key), worker_id).equal_range(key, vals, worker_id);
+  }
+
+  /// removes all keys in [begin, end) from every shard the range overlaps
+  void remove_range(const key_t& begin, const key_t& end,
+                    const uint32_t worker_id) {
+    if (!(begin < end)) {
+      return;
+    }
+    for (size_t shard_i = shard_of(begin);
+         shard_i < shards.size() && pivots[shard_i] < end; shard_i++) {
+      enter(shard_i, worker_id).remove_range(begin, end, worker_id);
+    }
+  }
+
+  /// scans n records from begin on, continuing in the following shards
+  size_t scan(const key_t& begin, const size_t n,
+              std::vector<std::pair<key_t, val_t>>& result,
+              const uint32_t worker_id) {
+    size_t shard_i = shard_of(begin);
+    enter(shard_i, worker_id).scan(begin, n, result, worker_id);
+
+    std::vector<std::pair<key_t, val_t>> shard_result;
+    for (shard_i++; result.size() < n && shard_i < shards.size(); shard_i++) {
+      enter(shard_i, worker_id)
+          .scan(pivots[shard_i], n - result.size(), shard_result, worker_id);
+      result.insert(result.end(), shard_result.begin(), shard_result.end());
+    }
+    return result.size();
+  }
+
+  /// synchronously forces merging of all delta buffers of all shards
+  void force_adjustment_sync() {
+    for (auto& shard : shards) {
+      shard->force_adjustment_sync();
+    }
+  }
+  /// marks the worker idle in all shards until its next request
+  void quiesce(const uint32_t worker_id) {
+    INVARIANT(worker_id < worker_n);
+    for (auto& shard : shards) {
+      shard->quiesce(worker_id);
+    }
+    worker_shards[worker_id].shard_i = shards.size();
+  }
+
+  /// id of the shard that owns the key. a worker that only touches the keys of
+  /// one shard can be bound to it and call the shard directly, a worker that
+  /// calls several shards directly must quiesce the one it leaves
+  inline size_t shard_of(const key_t& key) const {
+    size_t shard_i = std::min(model.predict(key), pivots.size() - 1);
+    while (shard_i > 0 && key < pivots[shard_i]) {
+      shard_i--;
+    }
+    while (shard_i + 1 < pivots.size() && !(key < pivots[shard_i + 1])) {
+      shard_i++;
+    }
+    return shard_i;
+  }
+  shard_t& shard(size_t shard_i) { return *shards[shard_i]; }
+  size_t shard_n() const { return shards.size(); }
+
+  /// computes the in memory size of all shards in bytes
+  _::ByteSize byte_size() const {
+    const size_t size = sizeof(ShardedXIndex) +
+                        worker_n * sizeof(WorkerShard) +
+                        pivots.capacity() * sizeof(key_t) +
+                        shards.capacity() * sizeof(std::unique_ptr<shard_t>);
+    _::ByteSize total_size = {.allocated = size, .used = size};
+    for (const auto& shard : shards) {
+      total_size += shard->byte_size();
+    }
+    return total_size;
+  }
+
+ private:
+  // last shard the worker called, shards.size() if none. only accessed by
+  // the worker's own thread
+  struct alignas(CACHELINE_SIZE) WorkerShard {
+    size_t shard_i;
+  };
+
+  // the worker leaves its previous shard, whose barriers need not wait for it
+  // until it comes back
+  shard_t& enter(size_t shard_i, const uint32_t worker_id) {
+    size_t& prev_shard_i = worker_shards[worker_id].shard_i;
+    if (prev_shard_i != shard_i) {
+      if (prev_shard_i < shards.size()) {
+        shards[prev_shard_i]->quiesce(worker_id);
+      }
+      prev_shard_i = shard_i;
+    }
+    return *shards[shard_i];
+  }
+
+  LinearModel<key_t> model;
+  std::vector<key_t> pivots;  // first key of each shard
+  std::vector<std::unique_ptr<shard_t>> shards;
+  size_t worker_n;
+  std::unique_ptr<WorkerShard[]> worker_shards;
+};
+
+}  // namespace xindex
+
+#endif  // XINDEX_SHARDED_H
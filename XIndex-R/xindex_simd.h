@@ -0,0 +1,117 @@
+/*
+ * The code is part of the XIndex project.
+ *
+ *    Copyright (C) 2020 Institute of Parallel and Distributed Systems (IPADS),
+ * Shanghai Jiao Tong University. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For more about XIndex, visit:
+ *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
+ */
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+#include "xindex_sort.h"
+
+#if !defined(XINDEX_SIMD_H)
+#define XINDEX_SIMD_H
+
+// the kernels below are compiled once per instruction set and the variant is
+// picked by cpuid when the program is loaded (ifunc), so a portable build
+// still uses AVX2 or AVX-512 where the host has it. clang does not support
+// multiversioned templates, and XINDEX_NO_MULTIVERSION opts out, e.g. for
+// -march=native builds that do not need it
+#if defined(__x86_64__) && defined(__GNUC__) && !defined(__clang__) && \
+    defined(__ELF__) && !defined(XINDEX_NO_MULTIVERSION)
+#define XINDEX_MULTIVERSION \
+  __attribute__((target_clones("default", "sse4.2", "avx2", "avx512f")))
+#else
+#define XINDEX_MULTIVERSION
+#endif
+
+// variants with FMA would otherwise fuse multiplies and additions, which
+// rounds differently from the variants without it
+#if defined(__GNUC__) && !defined(__clang__)
+#define XINDEX_NO_FP_CONTRACT __attribute__((optimize("fp-contract=off")))
+#else
+#define XINDEX_NO_FP_CONTRACT
+#endif
+
+namespace xindex {
+namespace simd {
+
+// windows of at most this many sorted keys are counted instead of bisected
+const size_t scan_max = 32;
+
+template <class key_t>
+inline uint64_t radix_of(const key_t& key) {
+  return key.radix_key();
+}
+template <class key_t, class val_t>
+inline uint64_t radix_of(const std::pair<key_t, val_t>& record) {
+  return record.first.radix_key();
+}
+
+/// number of keys (or records) smaller than key, for key types with
+/// radix_key. on sorted input it is the lower bound, without the unpredictable
+/// branches of a binary search
+template <class elem_t>
+XINDEX_MULTIVERSION size_t count_less(const elem_t* elems, size_t n,
+                                      uint64_t key) {
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++) {
+    count += radix_of(elems[i]) < key;
+  }
+  return count;
+}
+
+/// number of keys (or records) not larger than key, i.e., the upper bound
+template <class elem_t>
+XINDEX_MULTIVERSION size_t count_not_greater(const elem_t* elems, size_t n,
+                                             uint64_t key) {
+  size_t count = 0;
+  for (size_t i = 0; i < n; i++) {
+    count += radix_of(elems[i]) <= key;
+  }
+  return count;
+}
+
+/// dot product of the weights and features of a multi-feature model. four
+/// partial sums make the order of additions the same in every variant, and
+/// no variant contracts them into FMAs, so all round alike
+template <size_t n>
+XINDEX_MULTIVERSION XINDEX_NO_FP_CONTRACT double dot_product(
+    const double* weights, const double* features) {
+#if defined(__clang__)
+#pragma clang fp contract(off)
+#endif
+  double sums[4] = {0, 0, 0, 0};
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    for (size_t lane_i = 0; lane_i < 4; lane_i++) {
+      sums[lane_i] += weights[i + lane_i] * features[i + lane_i];
+    }
+  }
+  for (; i < n; i++) {
+    sums[i % 4] += weights[i] * features[i];
+  }
+  return (sums[0] + sums[1]) + (sums[2] + sums[3]);
+}
+
+}  // namespace simd
+}  // namespace xindex
+
+#endif  // XINDEX_SIMD_H
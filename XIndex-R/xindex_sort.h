@@ -0,0 +1,210 @@
+/*
+ * The code is part of the XIndex project.
+ *
+ *    Copyright (C) 2020 Institute of Parallel and Distributed Systems (IPADS),
+ * Shanghai Jiao Tong University. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For more about XIndex, visit:
+ *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
+ */
+
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "helper.h"
+
+#if !defined(XINDEX_SORT_H)
+#define XINDEX_SORT_H
+
+namespace xindex {
+
+/// key types whose order is that of an unsigned 64-bit integer can provide
+/// `uint64_t radix_key() const` to be sorted by radix instead of comparison
+template <class key_t, class = void>
+struct has_radix_key : std::false_type {};
+template <class key_t>
+struct has_radix_key<
+    key_t, std::void_t<decltype(std::declval<const key_t&>().radix_key())>>
+    : std::true_type {};
+
+// runs fn(thread_i) for thread_i in [0, thread_n), the last on the caller
+template <class fn_t>
+void run_parallel(size_t thread_n, const fn_t& fn) {
+  std::vector<std::thread> threads;
+  for (size_t thread_i = 0; thread_i + 1 < thread_n; thread_i++) {
+    threads.emplace_back(fn, thread_i);
+  }
+  fn(thread_n - 1);
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+// stable lsd radix sort by 16-bit digits. in every pass, the threads
+// count and then scatter their own chunks in order. digits that are equal for
+// all elements are skipped
+template <class T, class radix_of_t>
+void radix_sort(T* data, size_t n, size_t thread_n,
+                const radix_of_t& radix_of) {
+  const size_t digit_bits = 16, digit_n = 1 << digit_bits;
+  size_t chunk = (n + thread_n - 1) / thread_n;
+  std::vector<std::vector<size_t>> offsets(thread_n,
+                                           std::vector<size_t>(digit_n));
+  std::unique_ptr<T[]> buffer;
+  T* src = data;
+  T* dst = nullptr;
+
+  for (size_t shift = 0; shift < 64; shift += digit_bits) {
+    run_parallel(thread_n, [&](size_t thread_i) {
+      std::vector<size_t>& counts = offsets[thread_i];
+      std::fill(counts.begin(), counts.end(), 0);
+      size_t end = std::min(n, (thread_i + 1) * chunk);
+      for (size_t i = thread_i * chunk; i < end; i++) {
+        counts[(radix_of(src[i]) >> shift) & (digit_n - 1)]++;
+      }
+    });
+
+    bool skip = false;
+    size_t pos = 0;
+    for (size_t digit = 0; digit < digit_n; digit++) {
+      size_t digit_start = pos;
+      for (size_t thread_i = 0; thread_i < thread_n; thread_i++) {
+        size_t count = offsets[thread_i][digit];
+        offsets[thread_i][digit] = pos;
+        pos += count;
+      }
+      skip = skip || pos - digit_start == n;
+    }
+    if (skip) {
+      continue;
+    }
+
+    if (dst == nullptr) {
+      buffer.reset(new T[n]);
+      dst = buffer.get();
+    }
+    run_parallel(thread_n, [&](size_t thread_i) {
+      std::vector<size_t>& next = offsets[thread_i];
+      size_t end = std::min(n, (thread_i + 1) * chunk);
+      for (size_t i = thread_i * chunk; i < end; i++) {
+        dst[next[(radix_of(src[i]) >> shift) & (digit_n - 1)]++] =
+            std::move(src[i]);
+      }
+    });
+    std::swap(src, dst);
+  }
+
+  if (src != data) {
+    run_parallel(thread_n, [&](size_t thread_i) {
+      size_t end = std::min(n, (thread_i + 1) * chunk);
+      for (size_t i = thread_i * chunk; i < end; i++) {
+        data[i] = std::move(src[i]);
+      }
+    });
+  }
+}
+
+// stable comparison sort: chunks are sorted in parallel and then merged
+// pairwise, all pairs of a round in parallel
+template <class T, class less_t>
+void merge_sort(T* data, size_t n, size_t thread_n, const less_t& less) {
+  size_t chunk = (n + thread_n - 1) / thread_n;
+  run_parallel(thread_n, [&](size_t thread_i) {
+    size_t begin = std::min(n, thread_i * chunk);
+    size_t end = std::min(n, begin + chunk);
+    std::stable_sort(data + begin, data + end, less);
+  });
+  if (chunk >= n) {
+    return;
+  }
+
+  std::unique_ptr<T[]> buffer(new T[n]);
+  T* src = data;
+  T* dst = buffer.get();
+  for (size_t width = chunk; width < n; width *= 2) {
+    size_t pair_n = (n + 2 * width - 1) / (2 * width);
+    run_parallel(pair_n, [&](size_t pair_i) {
+      size_t begin = pair_i * 2 * width;
+      size_t mid = std::min(n, begin + width);
+      size_t end = std::min(n, begin + 2 * width);
+      std::merge(std::make_move_iterator(src + begin),
+                 std::make_move_iterator(src + mid),
+                 std::make_move_iterator(src + mid),
+                 std::make_move_iterator(src + end), dst + begin, less);
+    });
+    std::swap(src, dst);
+  }
+  if (src != data) {
+    std::move(src, src + n, data);
+  }
+}
+
+/// stably sorts keys with thread_n threads
+template <class key_t>
+void parallel_sort(std::vector<key_t>& keys, size_t thread_n) {
+  INVARIANT(thread_n > 0);
+  if constexpr (has_radix_key<key_t>::value) {
+    radix_sort(keys.data(), keys.size(), thread_n,
+               [](const key_t& key) { return (uint64_t)key.radix_key(); });
+  } else {
+    merge_sort(keys.data(), keys.size(), thread_n, std::less<key_t>());
+  }
+}
+
+/// stably sorts records by key with thread_n threads. unless multi, only the
+/// last of the records with equal keys is kept (last writer wins)
+template <class key_t, class val_t, bool multi = false>
+void sort_records(std::vector<std::pair<key_t, val_t>>& records,
+                  size_t thread_n) {
+  typedef std::pair<key_t, val_t> record_t;
+  INVARIANT(thread_n > 0);
+  if constexpr (has_radix_key<key_t>::value) {
+    radix_sort(records.data(), records.size(), thread_n,
+               [](const record_t& record) {
+                 return (uint64_t)record.first.radix_key();
+               });
+  } else {
+    merge_sort(records.data(), records.size(), thread_n,
+               [](const record_t& l, const record_t& r) {
+                 return l.first < r.first;
+               });
+  }
+
+  if (multi || records.empty()) {
+    return;
+  }
+  size_t kept_n = 0;
+  for (size_t i = 0; i < records.size(); i++) {
+    if (i + 1 < records.size() && records[i + 1].first == records[i].first) {
+      continue;
+    }
+    if (kept_n != i) {
+      records[kept_n] = std::move(records[i]);
+    }
+    kept_n++;
+  }
+  records.erase(records.begin() + kept_n, records.end());
+}
+
+}  // namespace xindex
+
+#endif  // XINDEX_SORT_H
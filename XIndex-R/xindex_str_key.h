@@ -0,0 +1,329 @@
+/*
+ * The code is part of the XIndex project.
+ *
+ *    Copyright (C) 2020 Institute of Parallel and Distributed Systems (IPADS),
+ * Shanghai Jiao Tong University. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For more about XIndex, visit:
+ *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "helper.h"
+#include "xindex_util.h"
+
+#if !defined(XINDEX_STR_KEY_H)
+#define XINDEX_STR_KEY_H
+
+namespace xindex {
+
+/// Variable-length string key (SIndex-style) with inline, zero-padded storage
+/// of at most `max_len` bytes. Keys are ordered lexicographically by unsigned
+/// bytes; shorter keys sort before their extensions.
+///
+/// For model featurization the key exposes the bytes after a common prefix:
+/// `LinearModel` strips the prefix shared by all of its training keys and
+/// regresses on the next 8 bytes (big-endian), so a 1-D closed-form fit is
+/// used instead of the LAPACK multi-feature path.
+///
+/// Group arrays store the prefix shared by their keys once and only the
+/// remaining bytes of each key (see ArrayKeys below).
+template <size_t max_len>
+class StrKey {
+  static_assert(max_len > 0 && max_len < 256, "key length must fit in uint8_t");
+
+  // storage is padded to whole 16 byte lanes so compare can always use SIMD
+  static constexpr size_t lane_size = 16;
+  static constexpr size_t storage_size =
+      (max_len + lane_size - 1) / lane_size * lane_size;
+  static constexpr size_t feat_bytes = 8;
+
+  typedef std::array<double, 1> model_key_t;
+
+ public:
+  static constexpr size_t model_key_size() { return 1; }
+  static StrKey max() {
+    static StrKey max_key = [] {
+      StrKey key;
+      memset(key.buf, 0xff, max_len);
+      key.len = max_len;
+      return key;
+    }();
+    return max_key;
+  }
+  static StrKey min() {
+    static StrKey min_key;
+    return min_key;
+  }
+
+  StrKey() : len(0) { memset(buf, 0, storage_size); }
+  StrKey(const char* s, size_t n) {
+    INVARIANT(n <= max_len);
+    memset(buf, 0, storage_size);
+    memcpy(buf, s, n);
+    len = n;
+  }
+  StrKey(const std::string& s) : StrKey(s.data(), s.size()) {}
+  /// the bytes of prefix followed by n bytes of suffix
+  StrKey(const StrKey& prefix, const uint8_t* suffix, size_t n)
+      : StrKey(prefix) {
+    INVARIANT(prefix.len + n <= max_len);
+    memcpy(buf + len, suffix, n);
+    len += n;
+  }
+  StrKey(const StrKey& other) = default;
+  StrKey& operator=(const StrKey& other) = default;
+
+  model_key_t to_model_key() const { return to_model_key(0); }
+
+  /// features of the key with the first `prefix_len` bytes stripped
+  model_key_t to_model_key(size_t prefix_len) const {
+    uint64_t feat = 0;
+    for (size_t i = 0; i < feat_bytes; i++) {
+      size_t byte_i = prefix_len + i;
+      feat = (feat << 8) | (byte_i < storage_size ? buf[byte_i] : 0);
+    }
+    model_key_t model_key;
+    model_key[0] = feat;
+    return model_key;
+  }
+
+  /// length of the byte prefix shared with `other`
+  size_t common_prefix_len(const StrKey& other) const {
+    size_t n = std::min(len, other.len);
+    size_t diff_i = first_diff(*this, other);
+    return diff_i < n ? diff_i : n;
+  }
+
+  size_t size() const { return len; }
+  const uint8_t* data() const { return buf; }
+
+  friend bool operator<(const StrKey& l, const StrKey& r) {
+    return compare(l, r) < 0;
+  }
+  friend bool operator>(const StrKey& l, const StrKey& r) {
+    return compare(l, r) > 0;
+  }
+  friend bool operator>=(const StrKey& l, const StrKey& r) {
+    return compare(l, r) >= 0;
+  }
+  friend bool operator<=(const StrKey& l, const StrKey& r) {
+    return compare(l, r) <= 0;
+  }
+  friend bool operator==(const StrKey& l, const StrKey& r) {
+    return l.len == r.len && first_diff(l, r) == storage_size;
+  }
+  friend bool operator!=(const StrKey& l, const StrKey& r) {
+    return !(l == r);
+  }
+
+ private:
+  // index of the first differing byte, or storage_size if buffers are equal
+  static size_t first_diff(const StrKey& l, const StrKey& r) {
+#if defined(__SSE2__)
+    for (size_t off = 0; off < storage_size; off += lane_size) {
+      __m128i a = _mm_loadu_si128((const __m128i*)(l.buf + off));
+      __m128i b = _mm_loadu_si128((const __m128i*)(r.buf + off));
+      uint32_t eq_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b));
+      if (eq_mask != 0xffff) {
+        return off + __builtin_ctz(~eq_mask);
+      }
+    }
+    return storage_size;
+#else
+    for (size_t i = 0; i < storage_size; i++) {
+      if (l.buf[i] != r.buf[i]) {
+        return i;
+      }
+    }
+    return storage_size;
+#endif
+  }
+
+  // unused bytes are zero, so when buffers are equal the shorter key is a
+  // prefix of the longer one
+  static int compare(const StrKey& l, const StrKey& r) {
+    size_t diff_i = first_diff(l, r);
+    if (diff_i != storage_size) {
+      return (int)l.buf[diff_i] - (int)r.buf[diff_i];
+    }
+    return (int)l.len - (int)r.len;
+  }
+
+  uint8_t buf[storage_size];
+  uint8_t len;
+};
+
+/// Keys of a group array without the prefix shared by all of them, which is
+/// stored once. A record holds the length of the rest of its key and its
+/// first bytes, which decide most comparisons; the other bytes are packed in
+/// one buffer per array.
+template <size_t max_len>
+class ArrayKeys<StrKey<max_len>> {
+  typedef StrKey<max_len> key_t;
+
+  struct Storage {
+    key_t prefix;
+    std::vector<uint8_t> tails;
+  };
+
+ public:
+  // fills the padding after offset and len
+  static constexpr size_t head_size = 3;
+
+  struct stored_t {
+    uint32_t offset;  // of the bytes after the head in tails
+    uint8_t len;
+    uint8_t head[head_size];
+  };
+
+  /// a stored key, compared without copying it into a StrKey
+  class KeyRef {
+   public:
+    KeyRef(const Storage* storage, const stored_t& stored)
+        : storage(storage), stored(stored) {}
+
+    operator key_t() const {
+      key_t key(storage->prefix, stored.head,
+                std::min<size_t>(stored.len, head_size));
+      if (stored.len > head_size) {
+        key = key_t(key, storage->tails.data() + stored.offset,
+                    stored.len - head_size);
+      }
+      return key;
+    }
+
+    // sign of (this - key), in the byte order of StrKey
+    int compare(const key_t& key) const {
+      const key_t& prefix = storage->prefix;
+      const size_t prefix_len = prefix.size();
+      const size_t same_n = prefix.common_prefix_len(key);
+      if (same_n < prefix_len) {
+        // key ends within the prefix or differs from it
+        return same_n == key.size()
+                   ? 1
+                   : (int)prefix.data()[same_n] - (int)key.data()[same_n];
+      }
+      const uint8_t* rest = key.data() + prefix_len;
+      const size_t rest_len = key.size() - prefix_len;
+      const size_t n = std::min<size_t>(stored.len, rest_len);
+      const size_t head_n = std::min(n, head_size);
+      for (size_t i = 0; i < head_n; i++) {
+        if (stored.head[i] != rest[i]) {
+          return (int)stored.head[i] - (int)rest[i];
+        }
+      }
+      int cmp = n > head_n ? memcmp(storage->tails.data() + stored.offset,
+                                    rest + head_n, n - head_n)
+                           : 0;
+      return cmp != 0 ? cmp : (int)stored.len - (int)rest_len;
+    }
+
+    friend bool operator<(const KeyRef& l, const key_t& r) {
+      return l.compare(r) < 0;
+    }
+    friend bool operator>(const KeyRef& l, const key_t& r) {
+      return l.compare(r) > 0;
+    }
+    friend bool operator<=(const KeyRef& l, const key_t& r) {
+      return l.compare(r) <= 0;
+    }
+    friend bool operator>=(const KeyRef& l, const key_t& r) {
+      return l.compare(r) >= 0;
+    }
+    friend bool operator==(const KeyRef& l, const key_t& r) {
+      return l.compare(r) == 0;
+    }
+    friend bool operator!=(const KeyRef& l, const key_t& r) {
+      return l.compare(r) != 0;
+    }
+    // only off the lookup paths, e.g., in splits and assertions
+    friend bool operator<(const KeyRef& l, const KeyRef& r) {
+      return l.compare(r) < 0;
+    }
+    friend bool operator>=(const KeyRef& l, const KeyRef& r) {
+      return l.compare(r) >= 0;
+    }
+    friend bool operator==(const KeyRef& l, const KeyRef& r) {
+      return l.compare(r) == 0;
+    }
+
+   private:
+    const Storage* storage;
+    stored_t stored;
+  };
+
+  typedef KeyRef load_t;
+  static const bool compressed = true;
+
+  ArrayKeys() : storage(nullptr) {}
+  // keys between lo and hi share the prefix of lo and hi
+  ArrayKeys(const key_t& lo, const key_t& hi, size_t key_n)
+      : storage(new Storage) {
+    size_t prefix_len = lo.common_prefix_len(hi);
+    storage->prefix = key_t((const char*)lo.data(), prefix_len);
+    size_t len = std::max(lo.size(), hi.size()) - prefix_len;
+    storage->tails.reserve(key_n * (len > head_size ? len - head_size : 0));
+  }
+
+  stored_t store(const key_t& key) {
+    const size_t prefix_len = storage->prefix.size();
+    assert(key.common_prefix_len(storage->prefix) == prefix_len);
+    std::vector<uint8_t>& tails = storage->tails;
+    INVARIANT(tails.size() + max_len <= std::numeric_limits<uint32_t>::max());
+
+    stored_t stored;
+    stored.offset = tails.size();
+    stored.len = key.size() - prefix_len;
+    const uint8_t* rest = key.data() + prefix_len;
+    memset(stored.head, 0, head_size);
+    memcpy(stored.head, rest, std::min<size_t>(stored.len, head_size));
+    if (stored.len > head_size) {
+      tails.insert(tails.end(), rest + head_size, rest + stored.len);
+    }
+    return stored;
+  }
+  void seal() {
+    if (storage != nullptr) {
+      storage->tails.shrink_to_fit();
+    }
+  }
+  load_t load(const stored_t& stored) const { return KeyRef(storage, stored); }
+  void free() {
+    delete storage;
+    storage = nullptr;
+  }
+  size_t byte_size() const {
+    return storage == nullptr ? 0
+                              : sizeof(Storage) + storage->tails.capacity();
+  }
+
+ private:
+  Storage* storage;
+};
+
+}  // namespace xindex
+
+#endif  // XINDEX_STR_KEY_H
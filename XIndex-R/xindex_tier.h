@@ -0,0 +1,82 @@
+/*
+ * The code is part of the XIndex project.
+ *
+ *    Copyright (C) 2020 Institute of Parallel and Distributed Systems (IPADS),
+ * Shanghai Jiao Tong University. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For more about XIndex, visit:
+ *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#include "helper.h"
+#include "xindex_util.h"
+
+#if !defined(XINDEX_TIER_H)
+#define XINDEX_TIER_H
+
+namespace xindex {
+
+// a group counts one of this many accesses, see Group::sample_access
+const uint32_t tier_access_sample_rate = 64;
+// an array is tiered after being cold for this many adjustment passes in a row
+const uint8_t tier_cold_pass_n = 2;
+
+std::atomic<uint64_t> tier_segment_n(0);
+
+/// writes len bytes to a new segment file in config.tier_dir and returns a
+/// shared mapping of it, or nullptr if the file can not be written. the file
+/// is unlinked right away, so it lives exactly as long as the mapping, and its
+/// pages are dropped from the page cache until they are accessed again
+void* tier_map(const void* data, size_t len) {
+  std::string path = config.tier_dir + "/xindex_segment_" +
+                     std::to_string(getpid()) + "_" +
+                     std::to_string(tier_segment_n++);
+  int fd = open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+  if (fd < 0) {
+    return nullptr;
+  }
+  unlink(path.c_str());
+
+  const char* src = (const char*)data;
+  size_t written = 0;
+  while (written < len) {
+    ssize_t ret = write(fd, src + written, len - written);
+    if (ret <= 0) {
+      close(fd);
+      return nullptr;
+    }
+    written += ret;
+  }
+  void* addr = nullptr;
+  if (fdatasync(fd) == 0) {
+    posix_fadvise(fd, 0, len, POSIX_FADV_DONTNEED);
+    addr = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  close(fd);  // the mapping keeps the file open
+  return addr == MAP_FAILED ? nullptr : addr;
+}
+
+void tier_unmap(void* addr, size_t len) { munmap(addr, len); }
+
+}  // namespace xindex
+
+#endif  // XINDEX_TIER_H
@@ -0,0 +1,68 @@
+/*
+ * The code is part of the XIndex project.
+ *
+ *    Copyright (C) 2020 Institute of Parallel and Distributed Systems (IPADS),
+ * Shanghai Jiao Tong University. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For more about XIndex, visit:
+ *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
+ */
+
+#include <cstdint>
+#include <ctime>
+
+#if !defined(XINDEX_TTL_H)
+#define XINDEX_TTL_H
+
+namespace xindex {
+
+// wall clock in seconds, the coarse clock is enough for expiry
+inline uint32_t ttl_now() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+  return (uint32_t)ts.tv_sec;
+}
+
+/// Value with an optional expiry time. Once expired, the record reads as
+/// removed: gets and scans skip it, and compaction drops it from the group
+/// (see ValExpiry). A put overwrites an expired record as usual. The expiry
+/// is packed after the value, so a TtlVal<uint64_t> takes 12 bytes.
+#pragma pack(push, 4)
+template <class val_t>
+struct TtlVal {
+  val_t val;
+  uint32_t expire_at;  // seconds since the epoch, 0 never expires
+
+  TtlVal() : val(), expire_at(0) {}
+  TtlVal(const val_t& val) : val(val), expire_at(0) {}
+  TtlVal(const val_t& val, uint32_t expire_at)
+      : val(val), expire_at(expire_at) {}
+
+  // expires ttl_s seconds from now
+  static TtlVal with_ttl(const val_t& val, uint32_t ttl_s) {
+    return TtlVal(val, ttl_now() + ttl_s);
+  }
+
+  bool expired() const { return expire_at != 0 && expire_at <= ttl_now(); }
+
+  bool operator==(const TtlVal& rhs) const {
+    return val == rhs.val && expire_at == rhs.expire_at;
+  }
+};
+#pragma pack(pop)
+
+}  // namespace xindex
+
+#endif  // XINDEX_TTL_H
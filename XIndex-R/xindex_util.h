@@ -23,8 +23,12 @@
 #include <atomic>
 #include <cstdint>
 #include <cstdlib>
+#include <limits>
 #include <memory>
 #include <mutex>
+#include <string>
+#include <type_traits>
+#include <utility>
 
 #if !defined(XINDEX_UTIL_H)
 #define XINDEX_UTIL_H
@@ -32,23 +36,66 @@
 namespace xindex {
 
 static const size_t desired_training_key_n = 10000000;
+// keys with at most this many features are trained by an allocation-free
+// normal-equation solver instead of LAPACK
+static const size_t small_model_key_size = 8;
 static const size_t max_model_n = 4;
 static const size_t seq_insert_reserve_factor =
     1;  // we don't insert in SOSD, hence we don't need the sequential insert optimization
 
 struct alignas(CACHELINE_SIZE) RCUStatus;
+struct RCUDomain;
 enum class Result;
 struct alignas(CACHELINE_SIZE) BGInfo;
 struct IndexConfig;
 
 typedef RCUStatus rcu_status_t;
+typedef RCUDomain rcu_domain_t;
 typedef Result result_t;
 typedef BGInfo bg_info_t;
 typedef IndexConfig index_config_t;
 
+// record counts and positions within a group and its buffer. 32 bits keep the
+// group header compact, build with XINDEX_64BIT_SIZES for groups of more than
+// 2^31 records
+#if defined(XINDEX_64BIT_SIZES)
+typedef uint64_t group_size_t;
+typedef int64_t group_ssize_t;
+#else
+typedef uint32_t group_size_t;
+typedef int32_t group_ssize_t;
+#endif
+
+// the status word of AtomicVal, a version plus lock, removed and pointer bits.
+// build with XINDEX_COMPACT_STATUS for a 32-bit word with a 28-bit version,
+// which also packs the value to 4-byte alignment: a value slot then takes 12
+// instead of 16 bytes, and so does an array record besides its key
+#if defined(XINDEX_COMPACT_STATUS)
+typedef uint32_t val_status_t;
+#else
+typedef uint64_t val_status_t;
+#endif
+
 struct RCUStatus {
   std::atomic<int64_t> status;
   std::atomic<bool> waiting;
+  std::atomic<bool> quiescent;  // idle until the next request, see rcu_quiesce
+};
+/// RCU status of the workers of one index. Every index, e.g., every shard of
+/// a ShardedXIndex, has its own, so that its barriers only wait for the
+/// workers that use it.
+struct RCUDomain {
+  explicit RCUDomain(size_t worker_n)
+      : worker_n(worker_n), status(new rcu_status_t[worker_n]) {
+    for (size_t worker_i = 0; worker_i < worker_n; worker_i++) {
+      status[worker_i].status = 0;
+      status[worker_i].waiting = false;
+      status[worker_i].quiescent = false;
+    }
+  }
+
+  size_t worker_n;
+  std::unique_ptr<rcu_status_t[]> status;
 };
 enum class Result { ok, failed, retry };
 struct BGInfo {
@@ -56,6 +103,7 @@ struct BGInfo {
   size_t bg_n;  // for calculation responsible range
   volatile void* root_ptr;
   volatile bool should_update_array;
+  rcu_domain_t* rcu;  // of the index, for the barriers of the thread
   std::atomic<bool> started;
   std::atomic<bool> finished;
   volatile bool running;
@@ -68,66 +116,182 @@ struct IndexConfig {
   size_t buffer_size_bound = 256;
   double buffer_size_tolerance = 3;
   size_t buffer_compact_threshold = 8;
-  size_t worker_n = 0;
-  std::unique_ptr<rcu_status_t[]> rcu_status;
+  // compact a group once its gets hit expired array records more often than
+  // this fraction of the array size, only for values that can expire
+  double expired_compact_ratio = 0.05;
   volatile bool exited = false;
+  // directory of the segment files of cold group arrays, empty to keep all
+  // arrays in memory. the thresholds count sampled accesses per adjustment
+  std::string tier_dir;
+  size_t tier_cold_access_n = 0;
+  size_t tier_hot_access_n = 4;
+  // slots of the point lookup hint table, 0 to disable it (see PointHints)
+  size_t point_hint_n = 0;
 };
 
 index_config_t config;
-std::mutex config_mutex;
+static const uint32_t rcu_no_worker = std::numeric_limits<uint32_t>::max();
+// worker that issued the current operation on this thread
+thread_local uint32_t rcu_worker_id = rcu_no_worker;
+// domain of the index of the current operation, which the barriers in the
+// group and root code wait on
+thread_local rcu_domain_t* rcu_domain = nullptr;
 
 // TODO replace it with user space RCU (e.g., qsbr)
-void rcu_init() {
-  config_mutex.lock();
-  if (config.rcu_status.get() == nullptr) {
-    config.rcu_status = std::make_unique<rcu_status_t[]>(config.worker_n);
-    for (size_t worker_i = 0; worker_i < config.worker_n; worker_i++) {
-      config.rcu_status[worker_i].status = 0;
-      config.rcu_status[worker_i].waiting = false;
-    }
+void rcu_progress(rcu_domain_t& rcu, const uint32_t worker_id) {
+  rcu_domain = &rcu;
+  rcu_worker_id = worker_id;
+  // cleared before the new request reads anything
+  if (rcu.status[worker_id].quiescent.load(std::memory_order_relaxed)) {
+    rcu.status[worker_id].quiescent = false;
   }
-  config_mutex.unlock();
+  rcu.status[worker_id].status++;
 }
 
-void rcu_progress(const uint32_t worker_id) {
-  config.rcu_status[worker_id].status++;
+// the worker holds no references until its next request (rcu_progress), so
+// barriers need not wait for it. only called by the worker's own thread
+void rcu_quiesce(rcu_domain_t& rcu, const uint32_t worker_id) {
+  rcu.status[worker_id].quiescent = true;
 }
 
-// wait for all workers
+// whether a worker has left the grace period that began at prev_status: it
+// issued a new request since, is idle, or had never issued any request
+bool rcu_passed(const rcu_domain_t& rcu, const size_t worker_i,
+                const int64_t prev_status) {
+  return prev_status == 0 || rcu.status[worker_i].status > prev_status ||
+         rcu.status[worker_i].quiescent;
+}
+
+// wait for all workers, except those waiting for root_update_mut or a change
+// log stripe, which hold no references yet. barriers of other updates are
+// excluded by root_update_mut
 void rcu_barrier() {
-  int64_t prev_status[config.worker_n];
-  for (size_t w_i = 0; w_i < config.worker_n; w_i++) {
-    prev_status[w_i] = config.rcu_status[w_i].status;
+  rcu_domain_t& rcu = *rcu_domain;
+  int64_t prev_status[rcu.worker_n];
+  for (size_t w_i = 0; w_i < rcu.worker_n; w_i++) {
+    prev_status[w_i] = rcu.status[w_i].status;
   }
-  for (size_t w_i = 0; w_i < config.worker_n; w_i++) {
-    while (config.rcu_status[w_i].status <= prev_status[w_i] && !config.exited)
+  for (size_t w_i = 0; w_i < rcu.worker_n; w_i++) {
+    while (!rcu_passed(rcu, w_i, prev_status[w_i]) &&
+           !rcu.status[w_i].waiting && !config.exited)
       ;
   }
 }
 
 // wait for workers whose 'waiting' is false
 void rcu_barrier(const uint32_t worker_id) {
+  rcu_domain_t& rcu = *rcu_domain;
   // set myself to waiting for barrier
-  config.rcu_status[worker_id].waiting = true;
+  rcu.status[worker_id].waiting = true;
 
-  int64_t prev_status[config.worker_n];
-  for (size_t w_i = 0; w_i < config.worker_n; w_i++) {
-    prev_status[w_i] = config.rcu_status[w_i].status;
+  int64_t prev_status[rcu.worker_n];
+  for (size_t w_i = 0; w_i < rcu.worker_n; w_i++) {
+    prev_status[w_i] = rcu.status[w_i].status;
   }
-  for (size_t w_i = 0; w_i < config.worker_n; w_i++) {
+  for (size_t w_i = 0; w_i < rcu.worker_n; w_i++) {
     // skipped workers that is wating for barrier (include myself)
-    while (config.rcu_status[w_i].status <= prev_status[w_i] &&
-           !config.rcu_status[w_i].waiting && !config.exited)
+    while (!rcu_passed(rcu, w_i, prev_status[w_i]) &&
+           !rcu.status[w_i].waiting && !config.exited)
       ;
   }
-  config.rcu_status[worker_id].waiting = false;  // restore my state
+  rcu.status[worker_id].waiting = false;  // restore my state
 }
 
+// key of delta buffer records in multimap mode. duplicates of a user key are
+// told apart by a per-buffer insertion sequence number; 0 is never assigned,
+// so {key, 0} is the lower bound of all occurrences of key
+template <class key_t>
+struct DupKey {
+  key_t key;
+  uint64_t seq_no;
+
+  static DupKey min() { return DupKey(key_t::min(), 0); }
+  static DupKey max() {
+    return DupKey(key_t::max(), std::numeric_limits<uint64_t>::max());
+  }
+
+  DupKey() : key(), seq_no(0) {}
+  DupKey(const key_t& key, uint64_t seq_no) : key(key), seq_no(seq_no) {}
+
+  friend bool operator<(const DupKey& l, const DupKey& r) {
+    return l.key < r.key || (l.key == r.key && l.seq_no < r.seq_no);
+  }
+  friend bool operator>(const DupKey& l, const DupKey& r) { return r < l; }
+  friend bool operator>=(const DupKey& l, const DupKey& r) {
+    return !(l < r);
+  }
+  friend bool operator<=(const DupKey& l, const DupKey& r) {
+    return !(r < l);
+  }
+  friend bool operator==(const DupKey& l, const DupKey& r) {
+    return l.seq_no == r.seq_no && l.key == r.key;
+  }
+  friend bool operator!=(const DupKey& l, const DupKey& r) {
+    return !(l == r);
+  }
+};
+
+/// Storage of the keys of a group array, which is built once, e.g., during a
+/// compaction, and immutable afterwards. By default keys are stored as they
+/// are; a key type may specialize it to store them compressed (see StrKey).
+/// Copies refer to the same storage, as groups may share an array.
+template <class key_t>
+struct ArrayKeys {
+  typedef key_t stored_t;
+  typedef const key_t& load_t;
+  static const bool compressed = false;
+
+  ArrayKeys() {}
+  // for key_n keys within [lo, hi]
+  ArrayKeys(const key_t& lo, const key_t& hi, size_t key_n) {}
+
+  stored_t store(const key_t& key) { return key; }
+  // called once all keys are stored
+  void seal() {}
+  load_t load(const stored_t& stored) const { return stored; }
+  // only by the last user of the storage
+  void free() {}
+  size_t byte_size() const { return 0; }
+};
+
+// values that own out-of-line storage (those with `retire()`, e.g. VarVal)
+// hand it back when AtomicVal overwrites or removes them
+template <class val_t, class = void>
+struct ValRetire {
+  static const bool owns_storage = false;
+  static void retire(const val_t&) {}
+};
+
+template <class val_t>
+struct ValRetire<val_t,
+                 std::void_t<decltype(std::declval<const val_t&>().retire())>> {
+  static const bool owns_storage = true;
+  static void retire(const val_t& val) { val.retire(); }
+};
+
+// values that can expire (those with `expired()`, e.g. TtlVal) read as
+// removed once expired, so compaction drops them like removed records
+template <class val_t, class = void>
+struct ValExpiry {
+  static const bool can_expire = false;
+  static bool expired(const val_t&) { return false; }
+};
+
+template <class val_t>
+struct ValExpiry<
+    val_t, std::void_t<decltype(std::declval<const val_t&>().expired())>> {
+  static const bool can_expire = true;
+  static bool expired(const val_t& val) { return val.expired(); }
+};
+
 template <class val_t>
 struct AtomicVal {
   union ValUnion;
   typedef ValUnion val_union_t;
   typedef val_t value_type;
+#if defined(XINDEX_COMPACT_STATUS)
+#pragma pack(push, 4)
+#endif
   union ValUnion {
     val_t val;
     AtomicVal* ptr;
@@ -135,16 +299,22 @@ struct AtomicVal {
     ValUnion(val_t val) : val(val) {}
     ValUnion(AtomicVal* ptr) : ptr(ptr) {}
   };
+#if defined(XINDEX_COMPACT_STATUS)
+#pragma pack(pop)
+#endif
 
-  // 60 bits for version
-  static const uint64_t version_mask = 0x0fffffffffffffff;
-  static const uint64_t lock_mask = 0x1000000000000000;
-  static const uint64_t removed_mask = 0x2000000000000000;
-  static const uint64_t pointer_mask = 0x4000000000000000;
+  // the top 4 bits are flags, the rest is the version (60 bits or 28 bits)
+  static const int status_bits = sizeof(val_status_t) * 8;
+  static const val_status_t lock_mask = (val_status_t)1 << (status_bits - 4);
+  static const val_status_t removed_mask = (val_status_t)1
+                                           << (status_bits - 3);
+  static const val_status_t pointer_mask = (val_status_t)1
+                                           << (status_bits - 2);
+  static const val_status_t version_mask = lock_mask - 1;
 
   val_union_t val;
   // lock - removed - is_ptr
-  volatile uint64_t status;
+  volatile val_status_t status;
 
   static size_t byte_size() {
     // all values inlined
@@ -155,31 +325,35 @@ struct AtomicVal {
   AtomicVal(val_t val) : val(val), status(0) {}
   AtomicVal(AtomicVal* ptr) : val(ptr), status(0) { set_is_ptr(); }
 
-  bool is_ptr(uint64_t status) { return status & pointer_mask; }
-  bool removed(uint64_t status) { return status & removed_mask; }
-  bool locked(uint64_t status) { return status & lock_mask; }
-  uint64_t get_version(uint64_t status) { return status & version_mask; }
+  bool is_ptr(val_status_t status) { return status & pointer_mask; }
+  bool removed(val_status_t status) { return status & removed_mask; }
+  bool locked(val_status_t status) { return status & lock_mask; }
+  val_status_t get_version(val_status_t status) {
+    return status & version_mask;
+  }
 
   void set_is_ptr() { status |= pointer_mask; }
   void unset_is_ptr() { status &= ~pointer_mask; }
   void set_removed() { status |= removed_mask; }
   void lock() {
     while (true) {
-      uint64_t old = status;
-      uint64_t expected = old & ~lock_mask;  // expect to be unlocked
-      uint64_t desired = old | lock_mask;    // desire to lock
-      if (likely(cmpxchg((uint64_t*)&this->status, expected, desired) ==
+      val_status_t old = status;
+      val_status_t expected = old & ~lock_mask;  // expect to be unlocked
+      val_status_t desired = old | lock_mask;    // desire to lock
+      if (likely(cmpxchg((val_status_t*)&this->status, expected, desired) ==
                  expected)) {
         return;
       }
     }
   }
   void unlock() { status &= ~lock_mask; }
+  // the version wraps around within its bits instead of carrying into the
+  // flags, which matters for the 28-bit version
   void incr_version() {
-    uint64_t version = get_version(status);
+    val_status_t version = get_version(status);
     UNUSED(version);
-    status++;
-    assert(get_version(status) == version + 1);
+    status = (status & ~version_mask) | ((status + 1) & version_mask);
+    assert(get_version(status) == ((version + 1) & version_mask));
   }
 
   friend std::ostream& operator<<(std::ostream& os, const AtomicVal& leaf) {
@@ -194,13 +368,18 @@ struct AtomicVal {
 
   // semantics: atomically read the value and the `removed` flag
   bool read(val_t& val) {
+    uint64_t version;
+    return read(val, version);
+  }
+  // additionally reports the version, which changes with every write
+  bool read(val_t& val, uint64_t& version) {
     while (true) {
-      uint64_t status = this->status;
+      val_status_t status = this->status;
       memory_fence();
       val_union_t val_union = this->val;
       memory_fence();
 
-      uint64_t current_status = this->status;
+      val_status_t current_status = this->status;
       memory_fence();
 
       if (unlikely(locked(current_status))) {  // check lock
@@ -211,22 +390,24 @@ struct AtomicVal {
                  get_version(current_status))) {  // check version
         if (unlikely(is_ptr(status))) {
           assert(!removed(status));
-          return val_union.ptr->read(val);
+          return val_union.ptr->read(val, version);
         } else {
           val = val_union.val;
-          return !removed(status);
+          version = get_version(status);
+          return !removed(status) && !ValExpiry<val_t>::expired(val);
         }
       }
     }
   }
   bool update(const val_t& val) {
     lock();
-    uint64_t status = this->status;
+    val_status_t status = this->status;
     bool res;
     if (unlikely(is_ptr(status))) {
       assert(!removed(status));
       res = this->val.ptr->update(val);
     } else if (!removed(status)) {
+      ValRetire<val_t>::retire(this->val.val);
       this->val.val = val;
       res = true;
     } else {
@@ -240,14 +421,16 @@ struct AtomicVal {
   }
   bool remove() {
     lock();
-    uint64_t status = this->status;
+    val_status_t status = this->status;
     bool res;
     if (unlikely(is_ptr(status))) {
       assert(!removed(status));
       res = this->val.ptr->remove();
     } else if (!removed(status)) {
+      // an expired record is removed too, but was already gone to readers
+      res = !ValExpiry<val_t>::expired(this->val.val);
+      ValRetire<val_t>::retire(this->val.val);
       set_removed();
-      res = true;
     } else {
       res = false;
     }
@@ -259,7 +442,7 @@ struct AtomicVal {
   }
   void replace_pointer() {
     lock();
-    uint64_t status = this->status;
+    val_status_t status = this->status;
     UNUSED(status);
     assert(is_ptr(status));
     assert(!removed(status));
@@ -273,8 +456,12 @@ struct AtomicVal {
     unlock();
   }
   bool read_ignoring_ptr(val_t& val) {
+    uint64_t version;
+    return read_ignoring_ptr(val, version);
+  }
+  bool read_ignoring_ptr(val_t& val, uint64_t& version) {
     while (true) {
-      uint64_t status = this->status;
+      val_status_t status = this->status;
       memory_fence();
       val_union_t val_union = this->val;
       memory_fence();
@@ -283,18 +470,20 @@ struct AtomicVal {
       }
       memory_fence();
 
-      uint64_t current_status = this->status;
+      val_status_t current_status = this->status;
       if (likely(get_version(status) == get_version(current_status))) {
         val = val_union.val;
-        return !removed(status);
+        version = get_version(status);
+        return !removed(status) && !ValExpiry<val_t>::expired(val);
       }
     }
   }
   bool update_ignoring_ptr(const val_t& val) {
     lock();
-    uint64_t status = this->status;
+    val_status_t status = this->status;
     bool res;
     if (!removed(status)) {
+      ValRetire<val_t>::retire(this->val.val);
       this->val.val = val;
       res = true;
     } else {
@@ -308,11 +497,12 @@ struct AtomicVal {
   }
   bool remove_ignoring_ptr() {
     lock();
-    uint64_t status = this->status;
+    val_status_t status = this->status;
     bool res;
     if (!removed(status)) {
+      res = !ValExpiry<val_t>::expired(this->val.val);
+      ValRetire<val_t>::retire(this->val.val);
       set_removed();
-      res = true;
     } else {
       res = false;
     }
@@ -322,6 +512,37 @@ struct AtomicVal {
     unlock();
     return res;
   }
+  // semantics: overwrite the value (reviving a removed record) while the
+  // caller holds the lock, used by batch writes that unlock all at once
+  void write_locked(const val_t& val) {
+    assert(locked(status) && !is_ptr(status));
+    if (!removed(status)) {
+      ValRetire<val_t>::retire(this->val.val);
+    }
+    this->val.val = val;
+    status &= ~removed_mask;
+    memory_fence();
+    incr_version();
+    memory_fence();
+  }
+  void remove_locked() {
+    assert(locked(status) && !is_ptr(status));
+    if (!removed(status)) {
+      ValRetire<val_t>::retire(this->val.val);
+      set_removed();
+    }
+    memory_fence();
+    incr_version();
+    memory_fence();
+  }
+};
+
+// one write of XIndex::write_batch, `val` is ignored for removals
+template <class key_t, class val_t>
+struct BatchWrite {
+  key_t key;
+  val_t val;
+  bool remove;
 };
 
 }  // namespace xindex
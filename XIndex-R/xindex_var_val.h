@@ -0,0 +1,246 @@
+/*
+ * The code is part of the XIndex project.
+ *
+ *    Copyright (C) 2020 Institute of Parallel and Distributed Systems (IPADS),
+ * Shanghai Jiao Tong University. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * For more about XIndex, visit:
+ *     https://ppopp20.sigplan.org/details/PPoPP-2020-papers/13/XIndex-A-Scalable-Learned-Index-for-Multicore-Data-Storage
+ */
+
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <vector>
+
+#include "byte_size.hpp"
+#include "helper.h"
+#include "xindex_util.h"
+
+#if !defined(XINDEX_VAR_VAL_H)
+#define XINDEX_VAR_VAL_H
+
+namespace xindex {
+
+class ValueArena;
+
+// immutable value bytes, followed by the payload
+struct VarValBlob {
+  uint32_t size;
+  uint32_t size_class;
+
+  const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+  char* data() { return reinterpret_cast<char*>(this + 1); }
+};
+
+/// Out-of-line variable-length value. Records only hold a pointer into the
+/// index's ValueArena, so group arrays and buffers stay small regardless of
+/// the payload size. Blobs are never modified: updates store a new blob and
+/// retire the old one, which is reclaimed once every worker has started a new
+/// operation (see rcu_progress), so views returned by `get` stay valid until
+/// the reading worker calls into the index again.
+class VarVal {
+  friend class ValueArena;
+
+ public:
+  VarVal() : blob(nullptr) {}
+
+  std::string_view view() const {
+    return blob ? std::string_view(blob->data(), blob->size)
+                : std::string_view();
+  }
+  // called by AtomicVal when the value is overwritten or removed
+  inline void retire() const;
+
+  // handles are equal if they refer to the same blob, blobs are immutable
+  friend bool operator==(const VarVal& l, const VarVal& r) {
+    return l.blob == r.blob;
+  }
+  friend bool operator!=(const VarVal& l, const VarVal& r) {
+    return !(l == r);
+  }
+
+ private:
+  explicit VarVal(const VarValBlob* blob) : blob(blob) {}
+
+  const VarValBlob* blob;
+};
+
+/// Per-index storage of VarVal blobs. Memory is carved from chunks aligned to
+/// their size, so a blob finds its arena through the chunk header. Each
+/// worker allocates from its own chunk and size-class free lists, and batches
+/// retired blobs together with a snapshot of the RCU counters of the index.
+class ValueArena {
+  struct Chunk {
+    ValueArena* arena;
+  };
+
+  struct RetiredBatch {
+    std::vector<int64_t> epochs;
+    std::vector<VarValBlob*> blobs;
+  };
+
+  struct alignas(CACHELINE_SIZE) WorkerState {
+    char* bump = nullptr;
+    char* bump_end = nullptr;
+    std::unique_ptr<VarValBlob*[]> free_lists;
+    std::vector<VarValBlob*> retiring;
+    std::deque<RetiredBatch> pending;
+    std::atomic<size_t> used_bytes{0};
+  };
+
+  static const size_t chunk_size = 1 << 20;
+  static const size_t chunk_header_size = CACHELINE_SIZE;
+  static const size_t size_class_bytes = 16;
+  static const size_t retire_batch_size = 64;
+
+ public:
+  static const size_t max_val_size = (1 << 16) - sizeof(VarValBlob);
+
+  explicit ValueArena(const rcu_domain_t& rcu)
+      : rcu(rcu), worker_n(rcu.worker_n), workers(new WorkerState[worker_n]) {
+    for (size_t w_i = 0; w_i < worker_n; w_i++) {
+      workers[w_i].free_lists =
+          std::make_unique<VarValBlob*[]>(size_class_n());
+    }
+  }
+  ~ValueArena() {
+    for (void* chunk : chunks) {
+      std::free(chunk);
+    }
+  }
+  ValueArena(const ValueArena&) = delete;
+  ValueArena& operator=(const ValueArena&) = delete;
+
+  static ValueArena* of(const VarValBlob* blob) {
+    uintptr_t chunk = (uintptr_t)blob & ~(uintptr_t)(chunk_size - 1);
+    return ((Chunk*)chunk)->arena;
+  }
+
+  VarVal allocate(std::string_view val, const uint32_t worker_id) {
+    INVARIANT(val.size() <= max_val_size);
+    INVARIANT(worker_id < worker_n);
+    WorkerState& worker = workers[worker_id];
+
+    uint32_t size_class =
+        (sizeof(VarValBlob) + val.size() + size_class_bytes - 1) /
+        size_class_bytes;
+    size_t alloc_size = size_class * size_class_bytes;
+
+    VarValBlob* blob = worker.free_lists[size_class];
+    if (blob != nullptr) {
+      worker.free_lists[size_class] = *(VarValBlob**)blob;
+    } else {
+      if (worker.bump + alloc_size > worker.bump_end) {
+        char* chunk = allocate_chunk();
+        worker.bump = chunk + chunk_header_size;
+        worker.bump_end = chunk + chunk_size;
+      }
+      blob = (VarValBlob*)worker.bump;
+      worker.bump += alloc_size;
+    }
+
+    blob->size = val.size();
+    blob->size_class = size_class;
+    memcpy(blob->data(), val.data(), val.size());
+    worker.used_bytes += alloc_size;
+    return VarVal(blob);
+  }
+
+  void retire(const VarValBlob* blob, const uint32_t worker_id) {
+    INVARIANT(worker_id < worker_n);
+    WorkerState& worker = workers[worker_id];
+    worker.retiring.push_back(const_cast<VarValBlob*>(blob));
+
+    if (worker.retiring.size() >= retire_batch_size) {
+      RetiredBatch batch;
+      batch.epochs.resize(worker_n);
+      for (size_t w_i = 0; w_i < worker_n; w_i++) {
+        batch.epochs[w_i] = rcu.status[w_i].status;
+      }
+      batch.blobs.swap(worker.retiring);
+      worker.pending.push_back(std::move(batch));
+    }
+
+    // a batch is free once all other workers have started a new operation,
+    // the retiring worker itself holds no views during its own put/remove
+    while (!worker.pending.empty() &&
+           grace_period_passed(worker.pending.front(), worker_id)) {
+      for (VarValBlob* freed : worker.pending.front().blobs) {
+        worker.used_bytes -= freed->size_class * size_class_bytes;
+        *(VarValBlob**)freed = worker.free_lists[freed->size_class];
+        worker.free_lists[freed->size_class] = freed;
+      }
+      worker.pending.pop_front();
+    }
+  }
+
+  /// computes the in memory size in bytes
+  _::ByteSize byte_size() const {
+    size_t metadata_size =
+        sizeof(ValueArena) + worker_n * (sizeof(WorkerState) +
+                                         size_class_n() * sizeof(VarValBlob*));
+    size_t used = metadata_size;
+    for (size_t w_i = 0; w_i < worker_n; w_i++) {
+      used += workers[w_i].used_bytes;
+    }
+    return {.allocated = metadata_size + chunks.size() * chunk_size,
+            .used = used};
+  }
+
+ private:
+  static constexpr size_t size_class_n() {
+    return (sizeof(VarValBlob) + max_val_size) / size_class_bytes + 1;
+  }
+
+  char* allocate_chunk() {
+    char* chunk = (char*)std::aligned_alloc(chunk_size, chunk_size);
+    INVARIANT(chunk != nullptr);
+    ((Chunk*)chunk)->arena = this;
+    std::lock_guard<std::mutex> guard(chunk_mut);
+    chunks.push_back(chunk);
+    return chunk;
+  }
+
+  bool grace_period_passed(const RetiredBatch& batch,
+                           const uint32_t worker_id) const {
+    for (size_t w_i = 0; w_i < batch.epochs.size(); w_i++) {
+      if (w_i != worker_id && !rcu_passed(rcu, w_i, batch.epochs[w_i])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const rcu_domain_t& rcu;
+  size_t worker_n;
+  std::unique_ptr<WorkerState[]> workers;
+  std::mutex chunk_mut;
+  std::vector<void*> chunks;
+};
+
+inline void VarVal::retire() const {
+  if (blob != nullptr) {
+    ValueArena::of(blob)->retire(blob, rcu_worker_id);
+  }
+}
+
+}  // namespace xindex
+
+#endif  // XINDEX_VAR_VAL_H